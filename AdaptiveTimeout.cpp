@@ -0,0 +1,50 @@
+#include "AdaptiveTimeout.h"
+
+AdaptiveTimeout::AdaptiveTimeout() 
+    : meanMs(0.0f), deviationMs(0.0f), samples(0), backoff(0) {
+}
+
+void AdaptiveTimeout::addSample(unsigned long latencyMs) {
+    float sample = (float)latencyMs;
+    
+    if (samples == 0) {
+        meanMs = sample;
+        deviationMs = sample / 2.0f;
+    } else {
+        float error = sample - meanMs;
+        meanMs += Adaptive_Config::MEAN_GAIN * error;
+        deviationMs += Adaptive_Config::DEVIATION_GAIN * (fabsf(error) - deviationMs);
+    }
+    
+    if (samples < UINT16_MAX) {
+        samples++;
+    }
+    backoff = 0;
+}
+
+void AdaptiveTimeout::addTimeout() {
+    if (backoff < Adaptive_Config::MAX_BACKOFF) {
+        backoff++;
+    }
+}
+
+unsigned long AdaptiveTimeout::getLimitMs() const {
+    if (!isTrained()) {
+        return 0;
+    }
+    
+    unsigned long limit = (unsigned long)(meanMs + Adaptive_Config::DEVIATIONS * deviationMs);
+    return limit << backoff;
+}
+
+unsigned long AdaptiveTimeout::getTimeoutMs() const {
+    if (!isTrained()) {
+        return Timeouts::ELM_COMMAND;
+    }
+    
+    unsigned long timeout = getLimitMs() + Adaptive_Config::HOST_MARGIN;
+    if (timeout < Timeouts::ELM_COMMAND_MIN) {
+        return Timeouts::ELM_COMMAND_MIN;
+    }
+    return timeout > Timeouts::ELM_COMMAND ? Timeouts::ELM_COMMAND : timeout;
+}
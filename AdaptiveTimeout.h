@@ -0,0 +1,38 @@
+#ifndef ADAPTIVE_TIMEOUT_H
+#define ADAPTIVE_TIMEOUT_H
+
+#include <Arduino.h>
+#include "Config.h"
+
+// Learns the response latency of one PID and derives a timeout from it.
+// Mean and mean deviation are tracked as EWMAs (the same estimator TCP uses
+// for its retransmit timeout), and the limit is mean + 4 deviations, which
+// covers nearly every response while still failing fast on a silent ECU.
+// Each timeout doubles the limit until the next successful response.
+class AdaptiveTimeout {
+public:
+    AdaptiveTimeout();
+    
+    void addSample(unsigned long latencyMs);
+    void addTimeout();
+    
+    bool isTrained() const { return samples >= Adaptive_Config::MIN_SAMPLES; }
+    
+    // Expected worst-case response time, 0 until trained
+    unsigned long getLimitMs() const;
+    
+    // Host-side timeout for the next request: the limit plus a margin so
+    // the adapter's own NO DATA arrives first, Timeouts::ELM_COMMAND until trained
+    unsigned long getTimeoutMs() const;
+    
+    unsigned long getMeanMs() const { return (unsigned long)meanMs; }
+    unsigned long getDeviationMs() const { return (unsigned long)deviationMs; }
+    
+private:
+    float meanMs;
+    float deviationMs;
+    uint16_t samples;
+    uint8_t backoff;
+};
+
+#endif // ADAPTIVE_TIMEOUT_H
@@ -1,336 +1,632 @@
-#include "BLEClientSerial.h"
-
-static boolean doConnect = false;
-static boolean connected = false;
-static boolean doScan = false;
-static std::string staticBuffer = "";
-
-std::string targetDeviceName = "OBDLink CX"; // Target BLE device
-BLEUUID serviceUUID_FFF0("FFF0"); 
-BLEUUID rxUUID("FFF1");
-BLEUUID txUUID("FFF2");
-
-static BLEAdvertisedDevice *myDevice;
-
-static void printFriendlyResponse(uint8_t *pData, size_t length)
-{
-    Serial.print("");
-    for (int i = 0; i < length; i++)
-    {
-        char recChar = (char)pData[i];
-        if (recChar == '\f')
-            Serial.print(F("\\f"));
-        else if (recChar == '\n')
-            Serial.print(F("\\n"));
-        else if (recChar == '\r')
-            Serial.print(F("\\r"));
-        else if (recChar == '\t')
-            Serial.print(F("\\t"));
-        else if (recChar == '\v')
-            Serial.print(F("\\v"));
-        // convert spaces to underscore, easier to see in debug output
-        else if (recChar == ' ')
-            Serial.print(F("_"));
-        // display regular printable
-        else
-            Serial.print(recChar);
-    }
-    Serial.println("");
-}
-
-static void notifyCallback(
-    BLERemoteCharacteristic *pBLERemoteCharacteristic,
-    uint8_t *pData,
-    size_t length,
-    bool isNotify)
-{   
-    Serial.print("[DEBUG] ELM RESPONSE > ");
-    printFriendlyResponse(pData, length);
-
-    // Convertiamo i dati ricevuti in una stringa
-    std::string receivedData((char*)pData, length);
-
-    // Se la nuova stringa è già presente alla fine di staticBuffer, evitiamo di concatenarla
-    if (staticBuffer.size() < length || staticBuffer.substr(staticBuffer.size() - length) != receivedData) {
-        staticBuffer += receivedData;
-    }
-
-    //Serial.print("[DEBUG] staticBuffer after append: ");
-    //Serial.println(staticBuffer.c_str());
-}
-
-class MyClientCallback : public BLEClientCallbacks
-{
-
-    void onConnect(BLEClient *pclient)
-    {
-        connected = true;
-    }
-
-    void onDisconnect(BLEClient *pclient)
-    {
-        connected = false;
-    }
-};
-
-class MySecurity : public BLESecurityCallbacks
-{
-
-    uint32_t onPassKeyRequest()
-    {
-        return 123456;
-    }
-    void onPassKeyNotify(uint32_t pass_key)
-    {
-        Serial.printf("The passkey Notify number: %d", pass_key);
-    }
-    bool onConfirmPIN(uint32_t pass_key)
-    {
-        Serial.printf("The passkey YES/NO number: %d", pass_key);
-        vTaskDelay(5000);
-        return true;
-    }
-    bool onSecurityRequest()
-    {
-        Serial.printf("Security Request");
-        return true;
-    }
-    void onAuthenticationComplete(esp_ble_auth_cmpl_t auth_cmpl)
-    {
-        if (auth_cmpl.success)
-        {
-            Serial.printf("remote BD_ADDR: ");
-            Serial.printf("address type = %d ", auth_cmpl.addr_type);
-        }
-        Serial.printf("pair status = %s ", auth_cmpl.success ? "success" : "fail");
-    }
-};
-
-class MyAdvertisedDeviceCallbacks : public BLEAdvertisedDeviceCallbacks
-{
-    /**
-     * Called for each advertising BLE server.
-     */
-    void onResult(BLEAdvertisedDevice advertisedDevice)
-    {
-        if (advertisedDevice.getName().c_str() == targetDeviceName)
-        {
-            Serial.print(targetDeviceName.c_str());
-            Serial.println(" found.");
-            BLEDevice::getScan()->stop();
-            myDevice = new BLEAdvertisedDevice(advertisedDevice);
-            doConnect = true;
-            doScan = true;
-        }
-    }
-};
-
-// Constructor
-
-BLEClientSerial::BLEClientSerial()
-{
-    // nothing
-}
-
-// Destructor
-
-BLEClientSerial::~BLEClientSerial(void)
-{
-    // clean up
-}
-
-// Begin bluetooth serial
-
-bool BLEClientSerial::begin(char *localName)
-{
-    targetDeviceName = localName;
-    BLEDevice::init("");
-    BLEScan* pBLEScan = BLEDevice::getScan();
-    pBLEScan->setAdvertisedDeviceCallbacks(new MyAdvertisedDeviceCallbacks());
-    pBLEScan->setInterval(1349);
-    pBLEScan->setWindow(449);
-    pBLEScan->setActiveScan(true);
-    pBLEScan->start(5, false);
-    return true;
-}
-
-int BLEClientSerial::available(void)
-{
-    // reply with data available
-    return staticBuffer.length();
-}
-
-int BLEClientSerial::peek(void)
-{
-    // return first character available
-    // but don't remove it from the buffer
-    if ((staticBuffer.length() > 0))
-    {
-        uint8_t c = staticBuffer[0];
-        return c;
-    }
-    else
-        return -1;
-}
-
-bool BLEClientSerial::connect(void)
-{
-    return connect(15000); // Default 15 second timeout
-}
-
-bool BLEClientSerial::connect(unsigned long timeout_ms)
-{
-    unsigned long start_time = millis();
-    
-    Serial.println("Forming a connection to ");
-    Serial.println(myDevice->getAddress().toString().c_str());
-
-    BLEDevice::setEncryptionLevel(ESP_BLE_SEC_ENCRYPT);
-    BLEDevice::setSecurityCallbacks(new MySecurity());
-
-    BLESecurity *pSecurity = new BLESecurity();
-    pSecurity->setKeySize();
-    pSecurity->setStaticPIN(123456);
-    pSecurity->setAuthenticationMode(ESP_LE_AUTH_BOND);
-    pSecurity->setCapability(ESP_IO_CAP_NONE);
-
-    BLEClient *pClient = BLEDevice::createClient();
-    pClient->setClientCallbacks(new MyClientCallback());
-
-    // Add timeout to the actual connection attempt
-    Serial.println("Attempting BLE client connection...");
-    unsigned long connect_start = millis();
-    
-    // Try to connect with timeout monitoring
-    while (!pClient->connect(myDevice)) {
-        if (millis() - connect_start > timeout_ms) {
-            Serial.println("BLE connection timeout!");
-            delete pClient;
-            return false;
-        }
-        delay(100);
-        Serial.print(".");
-    }
-    
-    Serial.println("\nBLE client connected successfully!");
-
-    // Check for overall timeout
-    if (millis() - start_time > timeout_ms) {
-        Serial.println("Overall connection setup timeout!");
-        pClient->disconnect();
-        delete pClient;
-        return false;
-    }
-
-    std::map<std::string, BLERemoteService *> *pRemoteServices = pClient->getServices();
-    if (pRemoteServices == nullptr)
-    {
-        Serial.println(" - No services");
-        pClient->disconnect();
-        delete pClient;
-        return false;
-    }
-
-    BLERemoteService *pService = pClient->getService(serviceUUID_FFF0);
-    if (pService)
-    {
-        Serial.println("[DEBUG] Service FFF0 found.");
-
-        pRxCharacteristic = pService->getCharacteristic(rxUUID);
-        if (!pRxCharacteristic) {
-            Serial.println("[DEBUG] CHAR rxUUID NOT found.");
-            pClient->disconnect();
-            delete pClient;
-            return false;
-        }
-        Serial.println("[DEBUG] CHAR rxUUID found.");
-        Serial.print("[DEBUG] canNotify ");
-        Serial.println(pRxCharacteristic->canNotify());
-
-        pTxCharacteristic = pService->getCharacteristic(txUUID);
-        if (!pTxCharacteristic) {
-            Serial.println("[DEBUG] CHAR txUUID NOT found.");
-            pClient->disconnect();
-            delete pClient;
-            return false;
-        }
-        Serial.println("[DEBUG] CHAR txUUID found.");
-        Serial.print("[DEBUG] canWrite ");
-        Serial.println(pTxCharacteristic->canWrite());
-
-        // Check and setup Rx notification
-        if (pRxCharacteristic->canNotify())
-        {
-            Serial.println("[DEBUG] RX subscribed");
-            pRxCharacteristic->registerForNotify(notifyCallback, true);
-        }
-        
-        // Store client reference for cleanup
-        pBLEClient = pClient;
-        connected = true;
-        return true;
-    }
-    else 
-    {
-        Serial.println("[DEBUG] Service FFF0 NOT found.");
-        pClient->disconnect();
-        delete pClient;
-        return false;
-    }
-}
-
-bool BLEClientSerial::isConnected(void)
-{
-    return connected;
-}
-
-int BLEClientSerial::read(void)
-{   
-    // read a character
-    if ((staticBuffer.length() > 0))
-    {
-        uint8_t c = staticBuffer[0];
-        staticBuffer.erase(0, 1); // remove it from the buffer
-        return c;
-    }
-    else
-        return -1;
-}
-
-size_t BLEClientSerial::write(uint8_t c)
-{
-    if (connected && pTxCharacteristic) {
-        pTxCharacteristic->writeValue(c, true);
-        delay(10); 
-        return 1;
-    }
-    return 0;
-}
-
-size_t BLEClientSerial::write(const uint8_t *buffer, size_t size)
-{   
-    if (connected && pTxCharacteristic) {
-        for (int i = 0; i < size; i++)
-        {
-            pTxCharacteristic->writeValue(buffer[i],false);
-        }
-        return size;
-    }
-    return 0;
-}
-
-void BLEClientSerial::flush()
-{
-    staticBuffer.clear();
-}
-
-void BLEClientSerial::end()
-{
-    if (connected && pBLEClient) {
-        Serial.println("Ending BLE connection...");
-        pBLEClient->disconnect();
-        delete pBLEClient;
-        pBLEClient = nullptr;
-        connected = false;
-    }
+#include "BLEClientSerial.h"
+#include "Diagnostics.h"
+#include "BLETrace.h"
+#include "RadioStats.h"
+#include "Config.h"
+#include <atomic>
+
+BLEUUID serviceUUID_FFF0("FFF0"); 
+BLEUUID rxUUID("FFF1");
+BLEUUID txUUID("FFF2");
+
+// Every live instance, so the shared BLE callbacks can find their owner.
+// One adapter per vehicle (plus spares for benchmarks); only one scans at a time.
+static const int MAX_INSTANCES = Vehicles::COUNT + 2;
+static BLEClientSerial* instances[MAX_INSTANCES] = {};
+static BLEClientSerial* scanningInstance = nullptr;
+
+static void printFriendlyResponse(uint8_t *pData, size_t length)
+{
+    Serial.print("");
+    for (int i = 0; i < length; i++)
+    {
+        char recChar = (char)pData[i];
+        if (recChar == '\f')
+            Serial.print(F("\\f"));
+        else if (recChar == '\n')
+            Serial.print(F("\\n"));
+        else if (recChar == '\r')
+            Serial.print(F("\\r"));
+        else if (recChar == '\t')
+            Serial.print(F("\\t"));
+        else if (recChar == '\v')
+            Serial.print(F("\\v"));
+        // convert spaces to underscore, easier to see in debug output
+        else if (recChar == ' ')
+            Serial.print(F("_"));
+        // display regular printable
+        else
+            Serial.print(recChar);
+    }
+    Serial.println("");
+}
+
+void notifyCallback(
+    BLERemoteCharacteristic *pBLERemoteCharacteristic,
+    uint8_t *pData,
+    size_t length,
+    bool isNotify)
+{   
+    Serial.print("[DEBUG] ELM RESPONSE > ");
+    printFriendlyResponse(pData, length);
+    BLETrace::record(TraceEvent::NOTIFY, pData, length);
+
+    BLEClientSerial *owner = BLEClientSerial::findByCharacteristic(pBLERemoteCharacteristic);
+    if (owner)
+        owner->ingest(pData, length);
+}
+
+class MyClientCallback : public BLEClientCallbacks
+{
+
+    void onConnect(BLEClient *pclient)
+    {
+        BLEClientSerial *owner = BLEClientSerial::findByClient(pclient);
+        if (owner)
+            owner->connected = true;
+    }
+
+    void onDisconnect(BLEClient *pclient)
+    {
+        BLEClientSerial *owner = BLEClientSerial::findByClient(pclient);
+        if (owner)
+            owner->connected = false;
+    }
+};
+
+class MySecurity : public BLESecurityCallbacks
+{
+
+    uint32_t onPassKeyRequest()
+    {
+        return 123456;
+    }
+    void onPassKeyNotify(uint32_t pass_key)
+    {
+        Serial.printf("The passkey Notify number: %d", pass_key);
+    }
+    bool onConfirmPIN(uint32_t pass_key)
+    {
+        Serial.printf("The passkey YES/NO number: %d", pass_key);
+        vTaskDelay(5000);
+        return true;
+    }
+    bool onSecurityRequest()
+    {
+        Serial.printf("Security Request");
+        return true;
+    }
+    void onAuthenticationComplete(esp_ble_auth_cmpl_t auth_cmpl)
+    {
+        if (auth_cmpl.success)
+        {
+            Serial.printf("remote BD_ADDR: ");
+            Serial.printf("address type = %d ", auth_cmpl.addr_type);
+        }
+        Serial.printf("pair status = %s ", auth_cmpl.success ? "success" : "fail");
+    }
+};
+
+class MyAdvertisedDeviceCallbacks : public BLEAdvertisedDeviceCallbacks
+{
+    /**
+     * Called for each advertising BLE server.
+     */
+    void onResult(BLEAdvertisedDevice advertisedDevice)
+    {
+        BLEClientSerial *scanner = scanningInstance;
+        if (scanner == nullptr || scanner->deviceFound || !scanner->isTarget(advertisedDevice))
+            return;
+
+        Serial.print(scanner->targetDeviceName.c_str());
+        Serial.print(" found at ");
+        Serial.println(advertisedDevice.getAddress().toString().c_str());
+
+        // Stopping the scan releases the blocking start() in begin()
+        BLEDevice::getScan()->stop();
+        memcpy(scanner->deviceAddress, *advertisedDevice.getAddress().getNative(), ESP_BD_ADDR_LEN);
+        scanner->deviceAddressType = advertisedDevice.getAddressType();
+        scanner->deviceFound = true;
+    }
+};
+
+// Callback objects live for the whole program, registering them again
+// each cycle must not allocate
+
+static MyAdvertisedDeviceCallbacks advertisedDeviceCallbacks;
+static MyClientCallback clientCallback;
+static MySecurity securityCallbacks;
+static BLESecurity security;
+
+// Constructor
+
+BLEClientSerial::BLEClientSerial()
+    : rxHead(0), rxTail(0), requestSeq(0), responseSeq(0), frameCount(0), radioLink(Radio::BLE)
+{
+    for (int i = 0; i < MAX_INSTANCES; i++)
+    {
+        if (instances[i] == nullptr)
+        {
+            instances[i] = this;
+            return;
+        }
+    }
+    Serial.println("BLEClientSerial: too many instances, notifications will be ignored");
+}
+
+// Destructor
+
+BLEClientSerial::~BLEClientSerial(void)
+{
+    // clean up
+    for (int i = 0; i < MAX_INSTANCES; i++)
+    {
+        if (instances[i] == this)
+            instances[i] = nullptr;
+    }
+    if (scanningInstance == this)
+        scanningInstance = nullptr;
+}
+
+BLEClientSerial* BLEClientSerial::findByClient(BLEClient *pClient)
+{
+    for (int i = 0; i < MAX_INSTANCES; i++)
+    {
+        if (instances[i] && instances[i]->pBLEClient == pClient)
+            return instances[i];
+    }
+    return nullptr;
+}
+
+BLEClientSerial* BLEClientSerial::findByCharacteristic(BLERemoteCharacteristic *pCharacteristic)
+{
+    for (int i = 0; i < MAX_INSTANCES; i++)
+    {
+        if (instances[i] && instances[i]->pRxCharacteristic == pCharacteristic)
+            return instances[i];
+    }
+    return nullptr;
+}
+
+// Begin bluetooth serial
+
+bool BLEClientSerial::begin(const char *localName, const char *address)
+{
+    targetDeviceName = localName;
+    hasTargetAddress = address != nullptr && address[0] != '\0';
+    if (hasTargetAddress)
+        memcpy(targetAddress, *BLEAddress(address).getNative(), ESP_BD_ADDR_LEN);
+
+    // The BLE stack is shared by all adapters, init() is a no-op after the first call
+    BLEDevice::init("");
+    BLEScan* pBLEScan = BLEDevice::getScan();
+    pBLEScan->setAdvertisedDeviceCallbacks(&advertisedDeviceCallbacks, false);
+    pBLEScan->setInterval(OBD::SCAN_INTERVAL_MS);
+    pBLEScan->setWindow(OBD::SCAN_WINDOW_MS);
+    pBLEScan->setActiveScan(OBD::SCAN_ACTIVE);
+
+    // Blocks until the adapter is seen (the callback stops the scan early)
+    // or the scan duration runs out
+    unsigned long scan_start = millis();
+    deviceFound = false;
+    scanningInstance = this;
+    pBLEScan->start((Timeouts::BLE_SCAN + 999) / 1000, false);
+    scanningInstance = nullptr;
+    pBLEScan->clearResults();
+    RadioStats::addScan(millis() - scan_start);
+
+    if (!deviceFound)
+    {
+        Serial.printf("%s not found.\n", targetDeviceName.c_str());
+        Diagnostics::record(Stage::BLE_SCAN, scan_start, StageResult::TIMEOUT);
+        return false;
+    }
+
+    Serial.printf("Scan finished after %lu ms\n", millis() - scan_start);
+    Diagnostics::record(Stage::BLE_SCAN, scan_start, StageResult::SUCCESS);
+    return true;
+}
+
+bool BLEClientSerial::isTarget(BLEAdvertisedDevice &advertisedDevice)
+{
+    // A configured address identifies the adapter on its own
+    if (hasTargetAddress)
+        return memcmp(*advertisedDevice.getAddress().getNative(), targetAddress, ESP_BD_ADDR_LEN) == 0;
+
+    // Otherwise accept the FFF0 serial service, unless the advertised
+    // name shows it belongs to some other device
+    if (advertisedDevice.haveServiceUUID() && advertisedDevice.isAdvertisingService(serviceUUID_FFF0))
+        return !advertisedDevice.haveName() || targetDeviceName == advertisedDevice.getName().c_str();
+
+    return advertisedDevice.haveName() && targetDeviceName == advertisedDevice.getName().c_str();
+}
+
+// Append received data to the receive buffer, a frame at a time
+
+void BLEClientSerial::ingest(const uint8_t *pData, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        uint8_t c = pData[i];
+
+        if (rawMode)
+        {
+            push(c);
+            continue;
+        }
+
+        // Longer than the staging buffer: decide now and stream the rest
+        if (frameLength == FRAME_SIZE)
+        {
+            if ((int32_t)(responseSeq.load() + 1 - requestSeq.load()) == 0)
+            {
+                for (size_t j = 0; j < frameLength; j++)
+                    push(frameBuffer[j]);
+                responseSeq++;
+                framePassThrough = true;
+            }
+            else
+            {
+                droppedFrames++;
+            }
+            frameLength = 0;
+        }
+
+        if (framePassThrough)
+        {
+            push(c);
+            if (c == '>')
+            {
+                framePassThrough = false;
+                frameCount++;
+            }
+            continue;
+        }
+
+        // A command sent since this frame began means the host is done
+        // with whatever the bytes so far answered, e.g. a response whose
+        // prompt was lost; start over with the new command's answer
+        uint32_t request = requestSeq.load();
+        if (frameLength > 0 && request != frameRequest)
+        {
+            droppedFrames++;
+            frameLength = 0;
+        }
+        if (frameLength == 0)
+            frameRequest = request;
+
+        frameBuffer[frameLength++] = c;
+        if (c == '>')
+            completeFrame();
+    }
+}
+
+void BLEClientSerial::completeFrame(void)
+{
+    uint32_t seq = responseSeq.load() + 1;
+    int32_t ahead = (int32_t)(seq - requestSeq.load());
+
+    if (ahead == 0)
+    {
+        // Answer to the newest command
+        for (size_t i = 0; i < frameLength; i++)
+            push(frameBuffer[i]);
+        responseSeq.store(seq);
+        frameCount++;
+    }
+    else if (ahead < 0)
+    {
+        // Late answer to a command the host already gave up on
+        responseSeq.store(seq);
+        droppedFrames++;
+    }
+    else
+    {
+        // No command outstanding: duplicate notification or stray prompt
+        droppedFrames++;
+    }
+    frameLength = 0;
+}
+
+bool BLEClientSerial::push(uint8_t c)
+{
+    size_t head = rxHead.load(std::memory_order_relaxed);
+    size_t next = (head + 1) % RX_BUFFER_SIZE;
+    if (next == rxTail.load(std::memory_order_acquire))
+    {
+        rxOverflows++;
+        return false;
+    }
+    rxBuffer[head] = c;
+    rxHead.store(next, std::memory_order_release);
+    return true;
+}
+
+void BLEClientSerial::resetFraming(void)
+{
+    frameLength = 0;
+    framePassThrough = false;
+    frameRequest = 0;
+    requestSeq.store(0);
+    responseSeq.store(0);
+    frameCount.store(0);
+}
+
+void BLEClientSerial::markRequest(void)
+{
+    requestSeq++;
+}
+
+void BLEClientSerial::markTimeout(void)
+{
+    // A slow answer that still finishes is flushed by ELMduino before the next command
+    unsigned long start = millis();
+    while ((int32_t)(requestSeq.load() - responseSeq.load()) > 0 && millis() - start < OBD::RESYNC_WAIT)
+        delay(Adaptive_Config::RESPONSE_POLL_MS);
+
+    // No prompt came: count the command as answered so the next answer
+    // isn't taken for this one's and dropped. Its partial frame goes once
+    // the next command is sent
+    if ((int32_t)(requestSeq.load() - responseSeq.load()) > 0)
+    {
+        responseSeq.store(requestSeq.load());
+        droppedFrames++;
+    }
+}
+
+int BLEClientSerial::framesAvailable(void)
+{
+    return frameCount.load();
+}
+
+int BLEClientSerial::readFrame(char *buffer, size_t size)
+{
+    if (frameCount.load() == 0 || size == 0)
+        return -1;
+
+    size_t length = 0;
+    int c;
+    while ((c = read()) != -1)
+    {
+        if (length < size - 1)
+            buffer[length++] = (char)c;
+        if (c == '>')
+            break;
+    }
+    buffer[length] = '\0';
+    return length;
+}
+
+void BLEClientSerial::setRawMode(bool raw)
+{
+    if (!raw)
+    {
+        // Whatever was sent while raw is considered answered
+        frameLength = 0;
+        responseSeq.store(requestSeq.load());
+    }
+    rawMode = raw;
+}
+
+int BLEClientSerial::available(void)
+{
+    // reply with data available
+    size_t head = rxHead.load(std::memory_order_acquire);
+    size_t tail = rxTail.load(std::memory_order_relaxed);
+    return (head - tail + RX_BUFFER_SIZE) % RX_BUFFER_SIZE;
+}
+
+int BLEClientSerial::peek(void)
+{
+    // return first character available
+    // but don't remove it from the buffer
+    size_t tail = rxTail.load(std::memory_order_relaxed);
+    if (tail != rxHead.load(std::memory_order_acquire))
+        return rxBuffer[tail];
+    else
+        return -1;
+}
+
+bool BLEClientSerial::connect(void)
+{
+    return connect(15000); // Default 15 second timeout
+}
+
+bool BLEClientSerial::connect(unsigned long timeout_ms)
+{
+    // The radio is counted as on from the first connection attempt until end()
+    radioLink.acquire();
+    if (!connectClient(timeout_ms)) {
+        radioLink.release();
+        return false;
+    }
+    return true;
+}
+
+bool BLEClientSerial::connectClient(unsigned long timeout_ms)
+{
+    unsigned long start_time = millis();
+    
+    if (!deviceFound) {
+        Serial.println("No device to connect to, scan first.");
+        return false;
+    }
+    
+    BLEAddress address(deviceAddress);
+    Serial.println("Forming a connection to ");
+    Serial.println(address.toString().c_str());
+
+    BLEDevice::setEncryptionLevel(ESP_BLE_SEC_ENCRYPT);
+    BLEDevice::setSecurityCallbacks(&securityCallbacks);
+
+    security.setKeySize();
+    security.setStaticPIN(123456);
+    security.setAuthenticationMode(ESP_LE_AUTH_BOND);
+    security.setCapability(ESP_IO_CAP_NONE);
+
+    // The client is created once and reused for every connection
+    if (pBLEClient == nullptr) {
+        pBLEClient = BLEDevice::createClient();
+        pBLEClient->setClientCallbacks(&clientCallback);
+    }
+    BLEClient *pClient = pBLEClient;
+
+    // Add timeout to the actual connection attempt
+    Serial.println("Attempting BLE client connection...");
+    unsigned long connect_start = millis();
+    
+    // Try to connect with timeout monitoring
+    while (!pClient->connect(address, deviceAddressType)) {
+        if (millis() - connect_start > timeout_ms) {
+            Serial.println("BLE connection timeout!");
+            Diagnostics::record(Stage::BLE_CONNECT, start_time, StageResult::TIMEOUT);
+            return false;
+        }
+        delay(100);
+        Serial.print(".");
+    }
+    
+    Serial.println("\nBLE client connected successfully!");
+
+    // Check for overall timeout
+    if (millis() - start_time > timeout_ms) {
+        Serial.println("Overall connection setup timeout!");
+        Diagnostics::record(Stage::BLE_CONNECT, start_time, StageResult::TIMEOUT);
+        pClient->disconnect();
+        return false;
+    }
+
+    std::map<std::string, BLERemoteService *> *pRemoteServices = pClient->getServices();
+    if (pRemoteServices == nullptr)
+    {
+        Serial.println(" - No services");
+        Diagnostics::record(Stage::BLE_CONNECT, start_time, StageResult::FAILURE);
+        pClient->disconnect();
+        return false;
+    }
+
+    BLERemoteService *pService = pClient->getService(serviceUUID_FFF0);
+    if (pService)
+    {
+        Serial.println("[DEBUG] Service FFF0 found.");
+
+        pRxCharacteristic = pService->getCharacteristic(rxUUID);
+        if (!pRxCharacteristic) {
+            Serial.println("[DEBUG] CHAR rxUUID NOT found.");
+            Diagnostics::record(Stage::BLE_CONNECT, start_time, StageResult::FAILURE);
+            pClient->disconnect();
+            return false;
+        }
+        Serial.println("[DEBUG] CHAR rxUUID found.");
+        Serial.print("[DEBUG] canNotify ");
+        Serial.println(pRxCharacteristic->canNotify());
+
+        pTxCharacteristic = pService->getCharacteristic(txUUID);
+        if (!pTxCharacteristic) {
+            Serial.println("[DEBUG] CHAR txUUID NOT found.");
+            Diagnostics::record(Stage::BLE_CONNECT, start_time, StageResult::FAILURE);
+            pClient->disconnect();
+            return false;
+        }
+        Serial.println("[DEBUG] CHAR txUUID found.");
+        Serial.print("[DEBUG] canWrite ");
+        Serial.println(pTxCharacteristic->canWrite());
+
+        // Check and setup Rx notification
+        if (pRxCharacteristic->canNotify())
+        {
+            Serial.println("[DEBUG] RX subscribed");
+            pRxCharacteristic->registerForNotify(notifyCallback, true);
+        }
+        
+        resetFraming();
+        connected = true;
+        Diagnostics::record(Stage::BLE_CONNECT, start_time, StageResult::SUCCESS);
+        BLETrace::record(TraceEvent::CONNECT);
+        return true;
+    }
+    else 
+    {
+        Serial.println("[DEBUG] Service FFF0 NOT found.");
+        Diagnostics::record(Stage::BLE_CONNECT, start_time, StageResult::FAILURE);
+        pClient->disconnect();
+        return false;
+    }
+}
+
+bool BLEClientSerial::isConnected(void)
+{
+    return connected;
+}
+
+int BLEClientSerial::read(void)
+{   
+    // read a character
+    size_t tail = rxTail.load(std::memory_order_relaxed);
+    if (tail != rxHead.load(std::memory_order_acquire))
+    {
+        uint8_t c = rxBuffer[tail];
+        rxTail.store((tail + 1) % RX_BUFFER_SIZE, std::memory_order_release); // remove it from the buffer
+        if (c == '>' && frameCount.load() > 0)
+            frameCount--;
+        return c;
+    }
+    else
+        return -1;
+}
+
+size_t BLEClientSerial::write(uint8_t c)
+{
+    if (connected && pTxCharacteristic) {
+        BLETrace::record(TraceEvent::WRITE, &c, 1);
+        // Counted before sending, the answer can arrive before writeValue returns
+        if (c == '\r')
+            markRequest();
+        pTxCharacteristic->writeValue(c, true);
+        RadioStats::countTx(Radio::BLE);
+        delay(10); 
+        return 1;
+    }
+    return 0;
+}
+
+size_t BLEClientSerial::write(const uint8_t *buffer, size_t size)
+{   
+    if (connected && pTxCharacteristic) {
+        BLETrace::record(TraceEvent::WRITE, buffer, size);
+        for (int i = 0; i < size; i++)
+        {
+            if (buffer[i] == '\r')
+                markRequest();
+            pTxCharacteristic->writeValue(buffer[i],false);
+            RadioStats::countTx(Radio::BLE);
+        }
+        return size;
+    }
+    return 0;
+}
+
+void BLEClientSerial::flush()
+{
+    rxTail.store(rxHead.load(std::memory_order_acquire), std::memory_order_release);
+    frameCount.store(0);
+}
+
+void BLEClientSerial::end()
+{
+    if (connected && pBLEClient) {
+        Serial.println("Ending BLE connection...");
+        pBLEClient->disconnect();
+        connected = false;
+        BLETrace::record(TraceEvent::DISCONNECT);
+        if (rxOverflows > 0) {
+            Serial.printf("RX buffer overflowed %lu times\n", (unsigned long)rxOverflows);
+            rxOverflows = 0;
+        }
+        if (droppedFrames > 0) {
+            Serial.printf("Dropped %lu stale or duplicate frames\n", (unsigned long)droppedFrames);
+            droppedFrames = 0;
+        }
+    }
+    radioLink.release();
 }
\ No newline at end of file
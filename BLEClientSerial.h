@@ -1,42 +1,105 @@
-#ifndef _BLE_CLIENT_SERIAL_H_
-#define _BLE_CLIENT_SERIAL_H_
-
-#include "Arduino.h"
-#include "Stream.h"
-#include <BLEDevice.h>
-#include <BLEUtils.h>
-#include <BLEScan.h>
-#include <BLEAdvertisedDevice.h>
-
-class BLEClientSerial: public Stream
-{
-    public:
-
-        BLEClientSerial(void);
-        ~BLEClientSerial(void);
-
-        bool begin(char* localName);
-        int available(void);
-        int peek(void);
-        bool connect(void);
-        bool connect(unsigned long timeout_ms);  // New timeout version
-        bool isConnected(void);                   // New connection status method
-        int read(void);
-        size_t write(uint8_t c);
-        size_t write(const uint8_t *buffer, size_t size);
-        void flush();
-        void end(void);
-
-    private:
-        BLERemoteCharacteristic* pTxCharacteristic;
-        BLERemoteCharacteristic* pRxCharacteristic;
-        BLEClient* pBLEClient = nullptr;          // New client reference
-        String targetDeviceName;
-
-        friend class MyClientCallback;
-        friend class MySecurity;
-        friend class MyAdvertisedDeviceCallbacks;
-
-};
-
+#ifndef _BLE_CLIENT_SERIAL_H_
+#define _BLE_CLIENT_SERIAL_H_
+
+#include "Arduino.h"
+#include "Stream.h"
+#include "OBDTransport.h"
+#include "RadioStats.h"
+#include <BLEDevice.h>
+#include <BLEUtils.h>
+#include <BLEScan.h>
+#include <BLEAdvertisedDevice.h>
+#include <atomic>
+
+class BLEClientSerial: public OBDTransport
+{
+    public:
+
+        BLEClientSerial(void);
+        ~BLEClientSerial(void);
+
+        const char* getName() const override { return "BLE"; }
+
+        // Scans for the adapter, false if not found. An empty address matches
+        // any adapter advertising the serial service or the given name
+        bool begin(const char* localName, const char* address = "") override;
+        int available(void) override;
+        int peek(void) override;
+        bool connect(void);
+        bool connect(unsigned long timeout_ms) override;     // New timeout version
+        bool isConnected(void) override;                    // New connection status method
+        int read(void) override;
+        size_t write(uint8_t c) override;
+        size_t write(const uint8_t *buffer, size_t size) override;
+        void flush() override;
+        void end(void) override;
+
+        // Receive path used by the notification callback (and benchmarks)
+        void ingest(const uint8_t *pData, size_t length);
+
+        // Framing: notifications are assembled into complete responses
+        // ending in the '>' prompt. Each command sent is numbered, and each
+        // completed frame is matched to the oldest unanswered one; frames
+        // for abandoned commands and frames with no command outstanding
+        // (duplicate or unsolicited prompts) are dropped.
+        void markRequest(void);                     // write() calls this for each '\r' sent
+        void markTimeout(void) override;            // The host gave up on the last command
+        bool isFramed(void) const override { return true; }
+        int framesAvailable(void) override;
+        int readFrame(char *buffer, size_t size);   // One frame up to its '>', -1 if none
+        void setRawMode(bool raw) override;         // Pass bytes through unframed (monitor mode)
+        uint32_t getDroppedFrames(void) const { return droppedFrames; }
+
+    private:
+        static const size_t RX_BUFFER_SIZE = 512;
+
+        BLERemoteCharacteristic* pTxCharacteristic = nullptr;
+        BLERemoteCharacteristic* pRxCharacteristic = nullptr;
+        BLEClient* pBLEClient = nullptr;          // Created once, reused for every connection
+        std::string targetDeviceName;
+        esp_bd_addr_t targetAddress;
+        bool hasTargetAddress = false;
+
+        // Adapter found by the last scan
+        bool deviceFound = false;
+        esp_bd_addr_t deviceAddress;
+        esp_ble_addr_type_t deviceAddressType = BLE_ADDR_TYPE_PUBLIC;
+        volatile bool connected = false;
+
+        // Receive ring buffer: written from the BLE task, read from the main loop
+        uint8_t rxBuffer[RX_BUFFER_SIZE];
+        std::atomic<size_t> rxHead;   // next write position (producer)
+        std::atomic<size_t> rxTail;   // next read position (consumer)
+        uint32_t rxOverflows = 0;
+
+        // Frame assembly, owned by the BLE task
+        static const size_t FRAME_SIZE = 256;
+        uint8_t frameBuffer[FRAME_SIZE];
+        size_t frameLength = 0;
+        bool framePassThrough = false;          // Oversized frame being streamed straight through
+        uint32_t frameRequest = 0;              // requestSeq when the frame's first byte arrived
+        std::atomic<uint32_t> requestSeq;       // Commands sent
+        std::atomic<uint32_t> responseSeq;      // Commands answered (or abandoned)
+        std::atomic<int> frameCount;            // Complete frames waiting in the ring buffer
+        volatile bool rawMode = false;
+        uint32_t droppedFrames = 0;
+        RadioLink radioLink;
+
+        bool push(uint8_t c);
+        void completeFrame(void);
+        void resetFraming(void);
+
+        bool connectClient(unsigned long timeout_ms);
+        bool isTarget(BLEAdvertisedDevice &advertisedDevice);
+        static BLEClientSerial* findByClient(BLEClient *pClient);
+        static BLEClientSerial* findByCharacteristic(BLERemoteCharacteristic *pCharacteristic);
+
+        friend void notifyCallback(BLERemoteCharacteristic*, uint8_t*, size_t, bool);
+
+        friend class MyClientCallback;
+        friend class MySecurity;
+        friend class MyAdvertisedDeviceCallbacks;
+
+};
+
 #endif
\ No newline at end of file
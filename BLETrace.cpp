@@ -0,0 +1,227 @@
+#include "BLETrace.h"
+#include <LittleFS.h>
+
+namespace {
+    const uint8_t MAGIC[] = { 'B', 'T', 'R', 'C' };
+    const uint8_t FORMAT_VERSION = 1;
+    
+    // Largest encoded record header: event, 5-byte varint, length
+    const size_t MAX_HEADER = 7;
+    
+    portMUX_TYPE traceMux = portMUX_INITIALIZER_UNLOCKED;
+}
+
+uint8_t BLETrace::buffers[2][Trace_Config::BUFFER_SIZE];
+size_t BLETrace::lengths[2] = { 0, 0 };
+int BLETrace::active = 0;
+uint32_t BLETrace::lastRecordMs = 0;
+uint32_t BLETrace::dropped = 0;
+size_t BLETrace::fileSize = 0;
+bool BLETrace::recording = false;
+
+void BLETrace::begin() {
+    if (!BLE_TRACE_ENABLED) {
+        return;
+    }
+    
+    if (Trace_Config::SINK == Trace_Config::Sink::FLASH) {
+        if (!LittleFS.begin(true)) {
+            LOG_ERROR("BLE trace: LittleFS mount failed, recording disabled");
+            return;
+        }
+        if (Trace_Config::CLEAR_ON_BOOT) {
+            LittleFS.remove(Trace_Config::FILE_PATH);
+        }
+        
+        File file = LittleFS.open(Trace_Config::FILE_PATH, FILE_APPEND);
+        if (!file) {
+            LOG_ERROR("BLE trace: cannot open trace file, recording disabled");
+            return;
+        }
+        fileSize = file.size();
+        if (fileSize == 0) {
+            file.write(MAGIC, sizeof(MAGIC));
+            file.write(FORMAT_VERSION);
+            fileSize = sizeof(MAGIC) + 1;
+        }
+        file.close();
+        LOG_INFO_F("BLE trace: recording to %s (%u bytes so far)", Trace_Config::FILE_PATH, (unsigned)fileSize);
+    } else {
+        // Each serial capture is a complete file once hex-decoded
+        uint8_t header[sizeof(MAGIC) + 1];
+        memcpy(header, MAGIC, sizeof(MAGIC));
+        header[sizeof(MAGIC)] = FORMAT_VERSION;
+        writeOut(header, sizeof(header));
+        LOG_INFO("BLE trace: recording to the debug port");
+    }
+    
+    lastRecordMs = millis();
+    recording = true;
+    record(TraceEvent::BOOT);
+}
+
+void BLETrace::record(TraceEvent event, const uint8_t* data, size_t length) {
+    if (!BLE_TRACE_ENABLED || !recording) {
+        return;
+    }
+    
+    taskENTER_CRITICAL(&traceMux);
+    uint32_t now = millis();
+    uint32_t delta = now - lastRecordMs;
+    lastRecordMs = now;
+    
+    do {
+        uint8_t chunk = length > 255 ? 255 : (uint8_t)length;
+        append(event, delta, data, chunk);
+        delta = 0;
+        data += chunk;
+        length -= chunk;
+    } while (length > 0);
+    taskEXIT_CRITICAL(&traceMux);
+}
+
+void BLETrace::append(TraceEvent event, uint32_t deltaMs, const uint8_t* data, uint8_t length) {
+    uint8_t* buffer = buffers[active];
+    size_t& used = lengths[active];
+    
+    if (used + MAX_HEADER + length > Trace_Config::BUFFER_SIZE) {
+        dropped++;
+        return;
+    }
+    
+    buffer[used++] = (uint8_t)event;
+    do {
+        uint8_t byte = deltaMs & 0x7F;
+        deltaMs >>= 7;
+        buffer[used++] = byte | (deltaMs ? 0x80 : 0);
+    } while (deltaMs);
+    buffer[used++] = length;
+    if (length > 0) {
+        memcpy(buffer + used, data, length);
+        used += length;
+    }
+}
+
+void BLETrace::flush() {
+    if (!BLE_TRACE_ENABLED || !recording) {
+        return;
+    }
+    
+    // Swap buffers so the BLE task keeps recording while this one is written
+    taskENTER_CRITICAL(&traceMux);
+    int full = active;
+    active = 1 - active;
+    lengths[active] = 0;
+    uint32_t lost = dropped;
+    dropped = 0;
+    taskEXIT_CRITICAL(&traceMux);
+    
+    if (lengths[full] > 0) {
+        writeOut(buffers[full], lengths[full]);
+        lengths[full] = 0;
+    }
+    
+    // Reported once per flush that lost records, not on every flush after
+    if (lost > 0) {
+        LOG_WARNING_F("BLE trace: %lu records dropped, buffer full", (unsigned long)lost);
+    }
+}
+
+void BLETrace::writeOut(const uint8_t* data, size_t length) {
+    if (Trace_Config::SINK == Trace_Config::Sink::SERIAL_HEX) {
+        static const char HEX_DIGITS[] = "0123456789ABCDEF";
+        const size_t BYTES_PER_LINE = 64;
+        for (size_t offset = 0; offset < length; offset += BYTES_PER_LINE) {
+            char line[8 + BYTES_PER_LINE * 2 + 1] = "#TRACE ";
+            size_t pos = 7;
+            for (size_t i = offset; i < length && i < offset + BYTES_PER_LINE; i++) {
+                line[pos++] = HEX_DIGITS[data[i] >> 4];
+                line[pos++] = HEX_DIGITS[data[i] & 0x0F];
+            }
+            line[pos] = '\0';
+            DEBUG_PORT.println(line);
+        }
+        return;
+    }
+    
+    if (fileSize + length > Trace_Config::MAX_FILE_SIZE) {
+        LOG_WARNING("BLE trace: file size limit reached, recording stopped");
+        recording = false;
+        return;
+    }
+    
+    File file = LittleFS.open(Trace_Config::FILE_PATH, FILE_APPEND);
+    if (!file) {
+        LOG_ERROR("BLE trace: cannot open trace file");
+        return;
+    }
+    fileSize += file.write(data, length);
+    file.close();
+}
+
+TraceReader::TraceReader() 
+    : timeMs(0) {
+}
+
+bool TraceReader::open(const char* path) {
+    if (!LittleFS.begin(false)) {
+        return false;
+    }
+    
+    file = LittleFS.open(path, FILE_READ);
+    if (!file) {
+        return false;
+    }
+    
+    uint8_t header[sizeof(MAGIC) + 1];
+    if (file.read(header, sizeof(header)) != sizeof(header) || 
+        memcmp(header, MAGIC, sizeof(MAGIC)) != 0 || header[sizeof(MAGIC)] != FORMAT_VERSION) {
+        LOG_ERROR_F("%s is not a BLE trace", path);
+        file.close();
+        return false;
+    }
+    
+    timeMs = 0;
+    return true;
+}
+
+bool TraceReader::next(TraceRecord& record) {
+    if (!file) {
+        return false;
+    }
+    
+    int event = file.read();
+    if (event < 0) {
+        return false;
+    }
+    
+    uint32_t delta = 0;
+    int shift = 0;
+    int byte;
+    do {
+        byte = file.read();
+        if (byte < 0) {
+            return false;
+        }
+        delta |= (uint32_t)(byte & 0x7F) << shift;
+        shift += 7;
+    } while ((byte & 0x80) && shift < 35);
+    
+    int length = file.read();
+    if (length < 0 || file.read(data, length) != (size_t)length) {
+        return false;
+    }
+    
+    record.event = (TraceEvent)event;
+    timeMs = record.event == TraceEvent::BOOT ? 0 : timeMs + delta;
+    record.timeMs = timeMs;
+    record.length = (uint8_t)length;
+    record.data = data;
+    return true;
+}
+
+void TraceReader::close() {
+    if (file) {
+        file.close();
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef BLE_TRACE_H
+#define BLE_TRACE_H
+
+#include <Arduino.h>
+#include <FS.h>
+#include "Config.h"
+#include "Logger.h"
+
+enum class TraceEvent : uint8_t {
+    BOOT,           // Start of a recording session, resets the time base
+    CONNECT,
+    DISCONNECT,
+    NOTIFY,         // Adapter -> host (GATT notification)
+    WRITE           // Host -> adapter (characteristic write)
+};
+
+// Trace file layout: "BTRC", format version, then records of
+//   [event:1][time since previous record in ms: LEB128][length:1][data]
+// Payloads longer than 255 bytes are split over several records.
+struct TraceRecord {
+    TraceEvent event;
+    uint32_t timeMs;            // Since the session's BOOT record
+    uint8_t length;
+    const uint8_t* data;        // Valid until the next record is read
+};
+
+// Records BLE traffic for offline analysis and replay. record() is safe to
+// call from the BLE task; it only appends to a RAM buffer. flush() moves the
+// buffer to the configured sink and must be called from the main loop.
+class BLETrace {
+public:
+    static void begin();
+    static void record(TraceEvent event, const uint8_t* data = nullptr, size_t length = 0);
+    static void flush();
+    
+    static uint32_t getDropped() { return dropped; }     // Since the last flush()
+    
+private:
+    static uint8_t buffers[2][Trace_Config::BUFFER_SIZE];
+    static size_t lengths[2];
+    static int active;
+    static uint32_t lastRecordMs;
+    static uint32_t dropped;
+    static size_t fileSize;
+    static bool recording;
+    
+    static void append(TraceEvent event, uint32_t deltaMs, const uint8_t* data, uint8_t length);
+    static void writeOut(const uint8_t* data, size_t length);
+};
+
+// Sequential reader for trace files written by BLETrace
+class TraceReader {
+public:
+    TraceReader();
+    
+    bool open(const char* path);
+    bool next(TraceRecord& record);
+    void close();
+    
+private:
+    File file;
+    uint32_t timeMs;
+    uint8_t data[255];
+};
+
+#endif // BLE_TRACE_H
@@ -0,0 +1,37 @@
+#include "Backoff.h"
+#include "Logger.h"
+
+namespace {
+    // Past this the doubled bound is always above any cap
+    const uint8_t MAX_DOUBLINGS = 16;
+}
+
+Backoff::Backoff() 
+    : lastType(FailureType::COUNT), attempts(0) {
+}
+
+unsigned long Backoff::nextDelay(FailureType type) {
+    if (type != lastType) {
+        lastType = type;
+        attempts = 0;
+    }
+    if (attempts < UINT8_MAX) {
+        attempts++;
+    }
+    
+    const Backoff_Config::Policy& policy = Backoff_Config::POLICIES[(int)type];
+    uint8_t doublings = attempts - 1 < MAX_DOUBLINGS ? attempts - 1 : MAX_DOUBLINGS;
+    unsigned long bound = policy.baseMs << doublings;
+    if (bound > policy.capMs || bound < policy.baseMs) {
+        bound = policy.capMs;
+    }
+    
+    unsigned long delayMs = policy.baseMs + (bound > policy.baseMs ? esp_random() % (bound - policy.baseMs + 1) : 0);
+    LOG_INFO_F("Retry %u after failure type %d in %lu ms", attempts, (int)type, delayMs);
+    return delayMs;
+}
+
+void Backoff::reset() {
+    lastType = FailureType::COUNT;
+    attempts = 0;
+}
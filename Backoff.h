@@ -0,0 +1,27 @@
+#ifndef BACKOFF_H
+#define BACKOFF_H
+
+#include <Arduino.h>
+#include "Config.h"
+
+// Exponential retry backoff with jitter, one policy per FailureType.
+// Consecutive failures of the same type double the upper bound of the
+// delay up to the policy's cap; the delay itself is drawn at random so
+// retries of several vehicles (or devices) don't line up. A failure of a
+// different type starts that type's sequence from the beginning.
+class Backoff {
+public:
+    Backoff();
+    
+    // Record a failure and return how long to wait before retrying
+    unsigned long nextDelay(FailureType type);
+    void reset();
+    
+    uint8_t getAttempts() const { return attempts; }
+    
+private:
+    FailureType lastType;
+    uint8_t attempts;
+};
+
+#endif // BACKOFF_H
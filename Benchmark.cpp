@@ -0,0 +1,469 @@
+#include "Benchmark.h"
+#include "BLEClientSerial.h"
+#include "Diagnostics.h"
+#include "CustomPids.h"
+#include "ELMEmulator.h"
+#include "LANServer.h"
+#include "MQTTEmulator.h"
+#include "MQTTNetworkManager.h"
+#include "OBDManager.h"
+#include "RadioStats.h"
+#include "TimeManager.h"
+#include "TraceReplay.h"
+
+namespace {
+    // Keeps results observable so the compiler can't drop the measured work
+    volatile uint32_t sink = 0;
+
+    struct LatencyProfile {
+        const char* name;
+        unsigned long latencyMs;
+    };
+
+    // Response latencies seen from the OBDLink CX: adapter answering from
+    // its own state, a typical BLE round trip, and a slow/busy ECU
+    const LatencyProfile CYCLE_PROFILES[] = {
+        { "cycle_fast", 5 },
+        { "cycle_ble", 60 },
+        { "cycle_slow_ecu", 250 },
+    };
+    
+    struct ReplayProfile {
+        const char* name;
+        float speed;
+    };
+    
+    // Recorded timing, and as fast as the receive path allows
+    const ReplayProfile REPLAY_PROFILES[] = {
+        { "replay_1x", 1.0f },
+        { "replay_max", 0.0f },
+    };
+    
+    // Upper bound on sessions replayed per profile, keeps boot time sane
+    const uint32_t MAX_REPLAY_SESSIONS = 20;
+    
+    struct PublishProfile {
+        const char* topicName;      // One message per value, as published today
+        const char* batchName;      // All values in one JSON message
+        unsigned long ackDelayMs;
+    };
+    
+    // Broker answering at once, and a PUBACK round trip on a busy LAN
+    const PublishProfile PUBLISH_PROFILES[] = {
+        { "mqtt_topics_fast", "mqtt_batch_fast", 0 },
+        { "mqtt_topics_lan", "mqtt_batch_lan", 20 },
+    };
+}
+
+void Benchmark::runAll() {
+    LOG_INFO("Running benchmark suite...");
+    Diagnostics::setRecording(false);
+    RadioStats::setRecording(false);
+
+    benchHexDecode();
+    benchReceiveBuffer();
+    checkFraming();
+    benchLogger();
+    benchPayloadFormat();
+    benchCycle();
+    benchSoak();
+    benchReplay();
+    benchProfiles();
+    benchFormula();
+    benchPublish();
+
+    RadioStats::setRecording(true);
+    Diagnostics::setRecording(true);
+    LOG_INFO("Benchmark suite complete");
+}
+
+void Benchmark::report(const char* name, uint32_t iterations, unsigned long elapsedUs) {
+    double nsPerOp = iterations > 0 ? (elapsedUs * 1000.0) / iterations : 0.0;
+    DEBUG_PORT.printf("{\"bench\":\"%s\",\"fw\":\"%s\",\"iters\":%lu,\"total_us\":%lu,\"ns_per_op\":%.1f}\n",
+                      name, FIRMWARE_VERSION, (unsigned long)iterations, elapsedUs, nsPerOp);
+}
+
+void Benchmark::benchHexDecode() {
+    const char* payload = "7EF05621FFC401F";
+    const uint32_t iterations = 100000;
+
+    unsigned long start = micros();
+    for (uint32_t i = 0; i < iterations; i++) {
+        int A = (OBDManager::charToInt(payload[11]) << 4) | OBDManager::charToInt(payload[12]);
+        int B = (OBDManager::charToInt(payload[13]) << 4) | OBDManager::charToInt(payload[14]);
+        sink += A + B * 256;
+    }
+    report("hex_decode", iterations, micros() - start);
+}
+
+void Benchmark::benchReceiveBuffer() {
+    // A typical PID response split the way the OBDLink CX notifies it
+    const char* chunks[] = { "7EF05621F", "FC401F\r", "\r>" };
+    const uint32_t iterations = 2000;
+    BLEClientSerial serial;
+    serial.flush();
+
+    unsigned long start = micros();
+    for (uint32_t i = 0; i < iterations; i++) {
+        serial.markRequest();
+        for (const char* chunk : chunks) {
+            serial.ingest((const uint8_t*)chunk, strlen(chunk));
+        }
+        int c;
+        while ((c = serial.read()) != -1) {
+            sink += c;
+        }
+    }
+    report("ble_receive", iterations, micros() - start);
+}
+
+void Benchmark::checkFraming() {
+    // Responses that go wrong on the air, each followed by a good one that
+    // must come out of the receive path whole
+    const char* answer = "7EF05621FFC402A\r\r>";
+    BLEClientSerial serial;
+    char frame[64];
+    uint32_t cases = 0;
+    uint32_t failures = 0;
+
+    auto expect = [&](const char* name) {
+        cases++;
+        serial.markRequest();
+        serial.ingest((const uint8_t*)answer, strlen(answer));
+        int length = serial.readFrame(frame, sizeof(frame));
+        if (length < 0 || strcmp(frame, answer) != 0 || serial.framesAvailable() != 0) {
+            LOG_ERROR_F("Framing check %s: expected %s, got %s", name, answer, length < 0 ? "nothing" : frame);
+            failures++;
+        }
+    };
+
+    expect("normal");
+
+    // Prompt lost: the host times out, the next answer must still get through
+    const char* partial = "7EF05621FFC401F\r";
+    serial.markRequest();
+    serial.ingest((const uint8_t*)partial, strlen(partial));
+    serial.markTimeout();
+    expect("missing_prompt");
+
+    // No answer at all
+    serial.markRequest();
+    serial.markTimeout();
+    expect("no_answer");
+
+    // Prompt with no command outstanding
+    serial.ingest((const uint8_t*)"\r>", 2);
+    expect("stray_prompt");
+
+    DEBUG_PORT.printf("{\"bench\":\"ble_framing_check\",\"fw\":\"%s\",\"cases\":%lu,\"failures\":%lu}\n",
+                      FIRMWARE_VERSION, (unsigned long)cases, (unsigned long)failures);
+}
+
+void Benchmark::benchLogger() {
+    const uint32_t filteredIterations = 10000;
+    unsigned long start = micros();
+    for (uint32_t i = 0; i < filteredIterations; i++) {
+        LOG_DEBUG_F("State of Charge: %.2f%%", 80.0f);
+    }
+    report("log_filtered", filteredIterations, micros() - start);
+
+    // Emitted lines go to the debug port, so this includes the serial write
+    const uint32_t emittedIterations = 100;
+    start = micros();
+    for (uint32_t i = 0; i < emittedIterations; i++) {
+        LOG_INFO_F("State of Charge: %.2f%%", 80.0f);
+    }
+    report("log_emitted", emittedIterations, micros() - start);
+}
+
+void Benchmark::benchPayloadFormat() {
+    const uint32_t floatIterations = 10000;
+    char value[16];
+
+    // Same formatting path as MQTTNetworkManager::publishFloat
+    unsigned long start = micros();
+    for (uint32_t i = 0; i < floatIterations; i++) {
+        sink += snprintf(value, sizeof(value), "%.2f", 80.0f + (i & 0xFF) / 100.0f);
+    }
+    report("mqtt_float", floatIterations, micros() - start);
+
+    char message[Diagnostics::MESSAGE_SIZE];
+    const uint32_t diagIterations = 200;
+    start = micros();
+    for (uint32_t i = 0; i < diagIterations; i++) {
+        sink += Diagnostics::format(message, sizeof(message));
+    }
+    report("mqtt_diag", diagIterations, micros() - start);
+}
+
+void Benchmark::benchCycle() {
+    const uint32_t iterations = 3;
+
+    for (const LatencyProfile& profile : CYCLE_PROFILES) {
+        ELMEmulator emulator(profile.latencyMs);
+        BasicOBDManager<SealProfile> obd;
+        VehicleData data;
+
+        if (!obd.attachStream(emulator)) {
+            LOG_ERROR_F("Benchmark %s: emulator initialization failed", profile.name);
+            continue;
+        }
+
+        unsigned long start = micros();
+        for (uint32_t i = 0; i < iterations; i++) {
+            if (!obd.readAllData(data)) {
+                LOG_ERROR_F("Benchmark %s: readAllData failed", profile.name);
+            }
+        }
+        report(profile.name, iterations, micros() - start);
+
+        obd.disconnect();
+    }
+}
+
+void Benchmark::benchSoak() {
+    // Repeats the steady-state work of a cycle and checks that the free heap
+    // ends where it started, i.e. nothing allocates without freeing
+    const uint32_t iterations = 50;
+    ELMEmulator emulator(0);
+    BasicOBDManager<SealProfile> obd;
+    TimeManager timeManager;
+    VehicleData data;
+    BLEClientSerial serial;
+    char buffer[Diagnostics::MESSAGE_SIZE];
+
+    if (!obd.attachStream(emulator)) {
+        LOG_ERROR("Benchmark soak_heap: emulator initialization failed");
+        return;
+    }
+
+    auto cycle = [&]() {
+        obd.readAllData(data);
+        const char* chunk = "7EF05621FFC401F\r\r>";
+        serial.markRequest();
+        serial.ingest((const uint8_t*)chunk, strlen(chunk));
+        while (serial.read() != -1) {
+        }
+        timeManager.getCurrentTimestamp(buffer, sizeof(buffer));
+        Diagnostics::format(buffer, sizeof(buffer));
+        Diagnostics::formatHeap(buffer, sizeof(buffer));
+    };
+
+    // One warm-up cycle so lazily created objects are not counted as growth
+    cycle();
+    uint32_t heapBefore = ESP.getFreeHeap();
+
+    unsigned long start = micros();
+    for (uint32_t i = 0; i < iterations; i++) {
+        cycle();
+    }
+    unsigned long elapsed = micros() - start;
+    uint32_t heapAfter = ESP.getFreeHeap();
+
+    obd.disconnect();
+
+    DEBUG_PORT.printf("{\"bench\":\"soak_heap\",\"fw\":\"%s\",\"iters\":%lu,\"total_us\":%lu,"
+                      "\"heap_before\":%lu,\"heap_after\":%lu,\"heap_delta\":%ld}\n",
+                      FIRMWARE_VERSION, (unsigned long)iterations, elapsed,
+                      (unsigned long)heapBefore, (unsigned long)heapAfter,
+                      (long)heapAfter - (long)heapBefore);
+}
+
+void Benchmark::benchReplay() {
+    // Replays the recorded BLE trace (see BLETrace.h), one connect/read/
+    // disconnect session per readAllData call, through the real receive path
+    for (const ReplayProfile& profile : REPLAY_PROFILES) {
+        TraceReplay replay(profile.speed);
+        if (!replay.open(Trace_Config::FILE_PATH)) {
+            LOG_INFO_F("Benchmark %s: no BLE trace at %s, skipped", profile.name, Trace_Config::FILE_PATH);
+            return;
+        }
+        
+        BasicOBDManager<SealProfile> obd;
+        VehicleData data;
+        uint32_t sessions = 0;
+        uint32_t fieldsRead = 0;
+        
+        unsigned long start = micros();
+        while (!replay.isFinished() && sessions < MAX_REPLAY_SESSIONS) {
+            if (obd.attachStream(replay) && obd.readAllData(data)) {
+                for (uint8_t mask = data.validMask; mask; mask &= mask - 1) {
+                    fieldsRead++;
+                }
+            }
+            obd.disconnect();
+            sessions++;
+        }
+        unsigned long elapsed = micros() - start;
+        
+        report(profile.name, sessions, elapsed);
+        DEBUG_PORT.printf("{\"bench\":\"%s_check\",\"fw\":\"%s\",\"commands\":%lu,\"mismatches\":%lu,"
+                          "\"notifications\":%lu,\"fields\":%lu}\n",
+                          profile.name, FIRMWARE_VERSION, replay.getCommandCount(), replay.getMismatches(),
+                          replay.getNotifications(), (unsigned long)fieldsRead);
+    }
+}
+
+void Benchmark::benchProfiles() {
+    // Every built-in profile, against the emulator's e-Platform 3.0 answers
+    benchProfile<SealProfile>("profile_seal");
+    benchProfile<Atto3Profile>("profile_atto3");
+}
+
+template <typename Profile>
+void Benchmark::benchProfile(const char* name) {
+    const uint32_t iterations = 3;
+    ELMEmulator emulator(0);
+    BasicOBDManager<Profile> obd;
+    VehicleData data;
+    
+    if (!obd.attachStream(emulator)) {
+        LOG_ERROR_F("Benchmark %s: emulator initialization failed", name);
+        return;
+    }
+    
+    uint32_t complete = 0;
+    unsigned long start = micros();
+    for (uint32_t i = 0; i < iterations; i++) {
+        if (obd.readAllData(data) && data.isValid()) {
+            complete++;
+        }
+    }
+    report(name, iterations, micros() - start);
+    
+    if (complete != iterations) {
+        LOG_ERROR_F("Benchmark %s (%s): %lu of %lu reads incomplete", name, Profile::NAME,
+                    (unsigned long)(iterations - complete), (unsigned long)iterations);
+    }
+    
+    // Each header once on the first pass, later passes start on the last one
+    uint16_t headers[Pids::COUNT];
+    uint32_t distinct = 0;
+    for (int i = 0; i < Pids::COUNT; i++) {
+        uint16_t header = obd.headerOf(1 << i);
+        bool seen = false;
+        for (uint32_t j = 0; j < distinct; j++) {
+            seen = seen || headers[j] == header;
+        }
+        if (!seen) {
+            headers[distinct++] = header;
+        }
+    }
+    uint32_t expected = distinct + (iterations - 1) * (distinct - 1);
+    if (obd.getHeaderSwitches() > expected) {
+        LOG_ERROR_F("Benchmark %s: %lu header switches, expected %lu", name,
+                    (unsigned long)obd.getHeaderSwitches(), (unsigned long)expected);
+    }
+    obd.disconnect();
+}
+
+void Benchmark::benchFormula() {
+    // The SoC decoder as a custom PID formula, against the compiled-in one
+    const uint32_t iterations = 100000;
+    Formula formula;
+    if (!formula.compile("(A+B*256)/100")) {
+        LOG_ERROR_F("Benchmark formula: %s", formula.getError());
+        return;
+    }
+    
+    uint8_t bytes[2] = { 0x40, 0x1F };
+    float total = 0.0f;
+    unsigned long start = micros();
+    for (uint32_t i = 0; i < iterations; i++) {
+        bytes[0] = i;
+        total += formula.evaluate(bytes);
+    }
+    report("formula_eval", iterations, micros() - start);
+    
+    float nativeTotal = 0.0f;
+    start = micros();
+    for (uint32_t i = 0; i < iterations; i++) {
+        bytes[0] = i;
+        nativeTotal += SealProfile::decodeSoc(bytes[0], bytes[1]);
+    }
+    report("formula_native", iterations, micros() - start);
+    
+    sink += (uint32_t)total;
+    if (total != nativeTotal) {
+        LOG_ERROR_F("Benchmark formula: %.2f, native decoder %.2f", total, nativeTotal);
+    }
+}
+
+void Benchmark::benchPublish() {
+    // A vehicle's publish as in publishVehicle(): status, the six values
+    // and the update time, per topic or batched into one message
+    const uint32_t iterations = 10;
+    VehicleSample sample;
+    sample.data.set(Pids::SOC, 0x1F40);
+    sample.data.set(Pids::TEMP, 0x41);
+    sample.data.set(Pids::VOLTAGE, 0x0190);
+    sample.data.set(Pids::TOTAL_CHARGES, 0x0096);
+    sample.data.set(Pids::KWH_CHARGED, 0xEA60);
+    sample.data.set(Pids::KWH_DISCHARGED, 0xC350);
+    const VehicleData& data = sample.data;
+    char message[Lan_Config::MESSAGE_SIZE];
+    LANServer::formatSample(sample, message, sizeof(message));
+    
+    for (const PublishProfile& profile : PUBLISH_PROFILES) {
+        MQTTEmulator broker(profile.ackDelayMs);
+        MQTTNetworkManager network(broker);
+        if (!network.connectMQTT()) {
+            LOG_ERROR_F("Benchmark %s: emulator connection failed", profile.topicName);
+            continue;
+        }
+        
+        auto run = [&](const char* name, bool batched) {
+            uint32_t messages = broker.getPublishCount();
+            uint32_t bytes = broker.getPayloadBytes();
+            LogLevel level = Logger::getLevel();
+            Logger::setLevel(LogLevel::WARNING);   // Every publish logs at INFO
+            unsigned long start = micros();
+            for (uint32_t i = 0; i < iterations; i++) {
+                network.publishStatus(ErrorMessages::CONNECTED);
+                if (batched) {
+                    network.publishString("state", message);
+                } else {
+                    network.publishFloat(MQTT::TOPIC_SOC, data.stateOfCharge());
+                    network.publishFloat(MQTT::TOPIC_TEMP, data.batteryTemperature());
+                    network.publishFloat(MQTT::TOPIC_VOLTAGE, data.batteryVoltage());
+                    network.publishFloat(MQTT::TOPIC_CHARGES_UPDATE, data.totalCharges());
+                    network.publishFloat(MQTT::TOPIC_KWH_CHARGED_UPDATE, data.totalKwhCharged());
+                    network.publishFloat(MQTT::TOPIC_KWH_DISCHARGED_UPDATE, data.totalKwhDischarged());
+                }
+                network.publishLastUpdate("2026-01-01 00:00:00");
+                network.pollMQTT();     // Takes the PUBACKs
+            }
+            unsigned long elapsed = micros() - start;
+            Logger::setLevel(level);
+            report(name, iterations, elapsed);
+            
+            messages = broker.getPublishCount() - messages;
+            bytes = broker.getPayloadBytes() - bytes;
+            LOG_INFO_F("Benchmark %s: %lu messages, %lu payload bytes, %.0f messages/s", name,
+                       (unsigned long)messages, (unsigned long)bytes,
+                       elapsed > 0 ? messages * 1000000.0 / elapsed : 0.0);
+        };
+        run(profile.topicName, false);
+        run(profile.batchName, true);
+        
+        network.disconnectMQTT();
+    }
+    
+    // A broker dropping the connection: the next publish must fail, then
+    // reconnecting must bring publishing back
+    MQTTEmulator broker;
+    MQTTNetworkManager network(broker);
+    network.connectMQTT();
+    broker.dropAfter(1);
+    network.publishStatus(ErrorMessages::CONNECTED);
+    if (network.publishStatus(ErrorMessages::CONNECTED)) {
+        LOG_ERROR("Benchmark mqtt_reconnect: publish succeeded on a dropped connection");
+    }
+    unsigned long start = micros();
+    bool reconnected = network.connectMQTT();
+    report("mqtt_reconnect", 1, micros() - start);
+    if (!reconnected || !network.publishStatus(ErrorMessages::CONNECTED)) {
+        LOG_ERROR("Benchmark mqtt_reconnect: publishing did not recover");
+    }
+    network.disconnectMQTT();
+}
@@ -0,0 +1,35 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <Arduino.h>
+#include "Config.h"
+#include "Logger.h"
+
+// On-device benchmark suite. Each result is printed to the debug port as
+// one JSON object per line, e.g.
+//   {"bench":"hex_decode","fw":"2.0.0","iters":100000,"total_us":5123,"ns_per_op":51.2}
+// so runs can be captured and compared between firmware versions.
+class Benchmark {
+public:
+    static void runAll();
+
+private:
+    static void report(const char* name, uint32_t iterations, unsigned long elapsedUs);
+
+    static void benchHexDecode();
+    static void benchReceiveBuffer();
+    static void checkFraming();
+    static void benchLogger();
+    static void benchPayloadFormat();
+    static void benchCycle();
+    static void benchSoak();
+    static void benchReplay();
+    static void benchProfiles();
+    static void benchFormula();
+    static void benchPublish();
+    
+    template <typename Profile>
+    static void benchProfile(const char* name);
+};
+
+#endif // BENCHMARK_H
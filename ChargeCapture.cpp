@@ -0,0 +1,210 @@
+#include "ChargeCapture.h"
+
+namespace {
+    const uint8_t FORMAT_VERSION = 1;
+
+    // Writes to out if there is one, returns the bytes it takes either way
+    size_t writeBytes(Print* out, const uint8_t* bytes, size_t length) {
+        if (out != nullptr) {
+            out->write(bytes, length);
+        }
+        return length;
+    }
+
+    size_t writeVarint(Print* out, uint32_t value) {
+        uint8_t bytes[5];
+        size_t length = 0;
+        do {
+            uint8_t byte = value & 0x7F;
+            value >>= 7;
+            bytes[length++] = value != 0 ? (byte | 0x80) : byte;
+        } while (value != 0);
+        return writeBytes(out, bytes, length);
+    }
+
+    size_t writeDelta(Print* out, int32_t delta) {
+        // Zigzag, so small changes either way take one byte
+        return writeVarint(out, ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31));
+    }
+
+    int32_t scaled(float value, float scale) {
+        return (int32_t)lroundf(value * scale);
+    }
+}
+
+ChargeCapture::ChargeCapture()
+    : state(State::IDLE), capturedVehicle(NO_VEHICLE), startEpoch(0), startTime(0),
+      sampleInterval(Charge_Config::SAMPLE_INTERVAL), lastRiseTime(0), peakSoc(0), sampleCount(0),
+      uploadAttempts(0) {
+    for (int i = 0; i < Vehicles::COUNT; i++) {
+        lastSoc[i] = 0.0f;
+        hasLastSoc[i] = false;
+        risingPasses[i] = 0;
+        riseStartSoc[i] = 0.0f;
+        riseTime[i] = 0;
+    }
+}
+
+void ChargeCapture::add(int vehicle, const VehicleData& data, time_t epoch) {
+    if (vehicle < 0 || vehicle >= Vehicles::COUNT || !(data.validMask & Pids::SOC)) {
+        return;
+    }
+
+    unsigned long now = millis();
+    float soc = data.stateOfCharge();
+    if (hasLastSoc[vehicle] && soc > lastSoc[vehicle]) {
+        if (risingPasses[vehicle] == 0) {
+            riseStartSoc[vehicle] = lastSoc[vehicle];
+        }
+        if (risingPasses[vehicle] < 0xFF) {
+            risingPasses[vehicle]++;
+        }
+        riseTime[vehicle] = now;
+    } else if (!hasLastSoc[vehicle] || soc < lastSoc[vehicle] ||
+               now - riseTime[vehicle] >= Charge_Config::CONFIRM_WINDOW) {
+        // Reads during confirmation are closer together than a 0.1 % step
+        // takes on a slow charger, so only a drop or a long flat spell
+        // gives up on the rise
+        risingPasses[vehicle] = 0;
+    }
+    lastSoc[vehicle] = soc;
+    hasLastSoc[vehicle] = true;
+
+    bool charging = risingPasses[vehicle] >= Charge_Config::START_PASSES &&
+                    soc - riseStartSoc[vehicle] >= Charge_Config::START_SOC_RISE;
+
+    if (charging && canStart()) {
+        if (state == State::FINISHED) {
+            LOG_WARNING_F("Charge session not uploaded after %u attempts, replaced", uploadAttempts);
+        }
+        start(vehicle, epoch);
+    }
+    if (!isCapturing(vehicle)) {
+        return;
+    }
+
+    record(data, now);
+    if (now - lastRiseTime >= Charge_Config::END_IDLE) {
+        finish("SoC stopped rising");
+    }
+}
+
+bool ChargeCapture::isConfirming(int vehicle) const {
+    return risingPasses[vehicle] > 0 && state != State::CAPTURING && canStart();
+}
+
+bool ChargeCapture::canStart() const {
+    // A finished session blocks the next one until it's uploaded, or until
+    // uploading it has failed often enough to give it up
+    return state == State::IDLE ||
+           (state == State::FINISHED && uploadAttempts >= Charge_Config::MAX_UPLOAD_ATTEMPTS);
+}
+
+void ChargeCapture::stop(int vehicle) {
+    hasLastSoc[vehicle] = false;
+    risingPasses[vehicle] = 0;
+    if (isCapturing(vehicle)) {
+        finish("car stopped answering");
+    }
+}
+
+void ChargeCapture::clearSession() {
+    state = State::IDLE;
+    capturedVehicle = NO_VEHICLE;
+    sampleCount = 0;
+    uploadAttempts = 0;
+}
+
+void ChargeCapture::uploadFailed() {
+    if (state == State::FINISHED && uploadAttempts < 0xFF) {
+        uploadAttempts++;
+    }
+}
+
+void ChargeCapture::start(int vehicle, time_t epoch) {
+    state = State::CAPTURING;
+    capturedVehicle = vehicle;
+    startEpoch = epoch;
+    startTime = millis();
+    lastRiseTime = startTime;
+    sampleInterval = Charge_Config::SAMPLE_INTERVAL;
+    peakSoc = 0;
+    sampleCount = 0;
+    uploadAttempts = 0;
+    LOG_INFO_F("Charging detected on %s, capturing every %lu ms", Vehicles::LIST[vehicle].name, sampleInterval);
+}
+
+void ChargeCapture::record(const VehicleData& data, unsigned long now) {
+    if (sampleCount == Charge_Config::MAX_SAMPLES) {
+        decimate();
+    }
+
+    // Fields missing from this pass keep the previous sample's value
+    Sample sample = sampleCount > 0 ? samples[sampleCount - 1] : Sample{};
+    sample.offsetMs = now - startTime;
+    sample.soc = (uint16_t)scaled(data.stateOfCharge(), 100.0f);
+    if (data.validMask & Pids::VOLTAGE) {
+        sample.voltage = (uint16_t)scaled(data.batteryVoltage(), 10.0f);
+    }
+    if (data.validMask & Pids::TEMP) {
+        sample.temperature = (int16_t)scaled(data.batteryTemperature(), 10.0f);
+    }
+    samples[sampleCount++] = sample;
+
+    if (sample.soc > peakSoc) {
+        peakSoc = sample.soc;
+        lastRiseTime = now;
+    }
+}
+
+void ChargeCapture::decimate() {
+    // Keep the even samples, which the first one is part of
+    uint16_t kept = 0;
+    for (uint16_t i = 0; i < sampleCount; i += 2) {
+        samples[kept++] = samples[i];
+    }
+    sampleCount = kept;
+    sampleInterval *= 2;
+    LOG_INFO_F("Charge capture buffer full, now sampling every %lu ms", sampleInterval);
+}
+
+void ChargeCapture::finish(const char* reason) {
+    if (sampleCount < Charge_Config::MIN_SAMPLES) {
+        LOG_INFO_F("Charge session discarded (%s) after %u samples", reason, sampleCount);
+        clearSession();
+        return;
+    }
+    // Started by a rise that didn't go on, e.g. regen on a long descent
+    if (peakSoc - samples[0].soc < (uint16_t)scaled(Charge_Config::START_SOC_RISE, 100.0f)) {
+        LOG_INFO_F("Charge session discarded (%s), SoC gained only %.2f%%", reason,
+                   (peakSoc - samples[0].soc) / 100.0f);
+        clearSession();
+        return;
+    }
+
+    state = State::FINISHED;
+    LOG_INFO_F("Charge session ended (%s): %u samples over %lu s, %.2f%% to %.2f%%, %u bytes encoded",
+               reason, sampleCount, (unsigned long)samples[sampleCount - 1].offsetMs / 1000,
+               samples[0].soc / 100.0f, samples[sampleCount - 1].soc / 100.0f, (unsigned)encode(nullptr));
+}
+
+size_t ChargeCapture::encode(Print* out) const {
+    uint32_t epoch = (uint32_t)startEpoch;
+    const uint8_t header[] = {
+        'C', 'S', FORMAT_VERSION,
+        (uint8_t)epoch, (uint8_t)(epoch >> 8), (uint8_t)(epoch >> 16), (uint8_t)(epoch >> 24),
+        (uint8_t)sampleCount, (uint8_t)(sampleCount >> 8)
+    };
+    size_t length = writeBytes(out, header, sizeof(header));
+
+    Sample previous = {};
+    for (uint16_t i = 0; i < sampleCount; i++) {
+        const Sample& sample = samples[i];
+        length += writeVarint(out, sample.offsetMs - previous.offsetMs);
+        length += writeDelta(out, (int32_t)sample.soc - previous.soc);
+        length += writeDelta(out, (int32_t)sample.voltage - previous.voltage);
+        length += writeDelta(out, (int32_t)sample.temperature - previous.temperature);
+        previous = sample;
+    }
+    return length;
+}
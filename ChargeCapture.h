@@ -0,0 +1,98 @@
+#ifndef CHARGE_CAPTURE_H
+#define CHARGE_CAPTURE_H
+
+#include <Arduino.h>
+#include <time.h>
+#include "Config.h"
+#include "Logger.h"
+#include "OBDManager.h"
+
+// Charge curve capture. Every pass of a vehicle is fed in; SoC rising on
+// Charge_Config::START_PASSES passes without falling in between, by
+// START_SOC_RISE in all, starts a session (a single step up is regen or
+// rounding as often as not). After the first rise isConfirming() asks for
+// reads every CONFIRM_INTERVAL, so the session starts minutes into the
+// charge rather than a few poll intervals in. While a session runs the
+// sketch reads Charge_Config::PIDS every getSampleInterval() ms without
+// publishing. The session ends once SoC stops rising (or the car stops
+// answering) and is uploaded once, as one delta-encoded message.
+//
+// One session at a time, for whichever vehicle started charging first. A
+// finished session waits for its upload, unless that failed
+// MAX_UPLOAD_ATTEMPTS times and a new one starts.
+// When the buffer fills, every other sample is dropped and the interval
+// doubles, so a long session keeps its whole curve at a lower rate.
+//
+// Encoded session, little endian:
+//   "CS", version (1), start epoch (u32, 0 if the clock wasn't set),
+//   sample count (u16), then per sample as varints:
+//   ms since the previous sample, then the change in SoC (0.01 %),
+//   voltage (0.1 V) and temperature (0.1 C), zigzag encoded.
+//   The first sample's changes are from 0.
+//
+// Only called from the main loop.
+class ChargeCapture {
+public:
+    static const int NO_VEHICLE = -1;
+
+    ChargeCapture();
+
+    // A pass of a vehicle's PIDs, read at millis() now
+    void add(int vehicle, const VehicleData& data, time_t epoch);
+    // The vehicle stopped answering; ends its session
+    void stop(int vehicle);
+
+    bool isCapturing(int vehicle) const { return state == State::CAPTURING && capturedVehicle == vehicle; }
+    // SoC went up and a session could start once the rise is confirmed
+    bool isConfirming(int vehicle) const;
+    unsigned long getSampleInterval() const { return sampleInterval; }
+
+    // A finished session waiting for upload
+    bool hasSession(int vehicle) const { return state == State::FINISHED && capturedVehicle == vehicle; }
+    void clearSession();
+    void uploadFailed();
+
+    // Write the encoded session to out and return its length; with a null
+    // out only the length is computed
+    size_t encode(Print* out) const;
+
+private:
+    enum class State : uint8_t {
+        IDLE,
+        CAPTURING,
+        FINISHED
+    };
+
+    struct __attribute__((packed)) Sample {
+        uint32_t offsetMs;      // Since the start of the session
+        uint16_t soc;           // 0.01 %
+        uint16_t voltage;       // 0.1 V
+        int16_t temperature;    // 0.1 C
+    };
+
+    State state;
+    int capturedVehicle;
+    time_t startEpoch;
+    unsigned long startTime;
+    unsigned long sampleInterval;
+    unsigned long lastRiseTime;     // millis() SoC last went up
+    uint16_t peakSoc;
+    Sample samples[Charge_Config::MAX_SAMPLES];
+    uint16_t sampleCount;
+    uint8_t uploadAttempts;         // Failed uploads of the finished session
+
+    float lastSoc[Vehicles::COUNT];
+    bool hasLastSoc[Vehicles::COUNT];
+    uint8_t risingPasses[Vehicles::COUNT];  // Passes in a row with SoC up
+    float riseStartSoc[Vehicles::COUNT];    // SoC before the first of them
+    unsigned long riseTime[Vehicles::COUNT];    // millis() of the last of them
+
+    bool canStart() const;
+
+    void start(int vehicle, time_t epoch);
+    void record(const VehicleData& data, unsigned long now);
+    void finish(const char* reason);
+    void decimate();
+};
+
+#endif // CHARGE_CAPTURE_H
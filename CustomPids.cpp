@@ -0,0 +1,345 @@
+#include "CustomPids.h"
+#include <LittleFS.h>
+
+namespace {
+    char* trim(char* text) {
+        while (*text == ' ' || *text == '\t') text++;
+        char* end = text + strlen(text);
+        while (end > text && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r')) end--;
+        *end = '\0';
+        return text;
+    }
+
+    bool isHex(const char* text) {
+        if (*text == '\0') return false;
+        for (; *text != '\0'; text++) {
+            if (!isxdigit((unsigned char)*text)) return false;
+        }
+        return true;
+    }
+
+    // Topics the firmware publishes or subscribes to itself; a custom PID
+    // under one of them would overwrite its values or send it commands
+    const char* const RESERVED_TOPICS[] = {
+        MQTT::TOPIC_SOC, MQTT::TOPIC_TEMP, MQTT::TOPIC_VOLTAGE, MQTT::TOPIC_STATUS,
+        MQTT::TOPIC_LAST_UPDATE, MQTT::TOPIC_CHARGES_UPDATE, MQTT::TOPIC_KWH_CHARGED_UPDATE,
+        MQTT::TOPIC_KWH_DISCHARGED_UPDATE, MQTT::TOPIC_DIAG, MQTT::TOPIC_HEAP, MQTT::TOPIC_CMD,
+        MQTT::TOPIC_CURRENT, MQTT::TOPIC_METRICS, MQTT::TOPIC_RADIO, MQTT::TOPIC_CHARGE_SESSION,
+    };
+
+    bool isReserved(const char* topic) {
+        for (const char* reserved : RESERVED_TOPICS) {
+            if (strcmp(topic, reserved) == 0) return true;
+        }
+        return false;
+    }
+}
+
+// Formula
+
+bool Formula::compile(const char* source) {
+    codeLength = 0;
+    constantCount = 0;
+    maxByte = -1;
+    error = nullptr;
+    cursor = source;
+    depth = 0;
+    nesting = 0;
+
+    if (!parseOr()) {
+        return false;
+    }
+    while (*cursor == ' ') cursor++;
+    if (*cursor != '\0') {
+        return fail("unexpected character");
+    }
+    cursor = nullptr;
+    return true;
+}
+
+float Formula::evaluate(const uint8_t* bytes) const {
+    float stack[Custom_Config::MAX_STACK];
+    int top = -1;
+
+    for (uint8_t pc = 0; pc < codeLength; ) {
+        uint8_t op = code[pc++];
+        if (op == OP_CONST) {
+            stack[++top] = constants[code[pc++]];
+            continue;
+        }
+        if (op == OP_BYTE) {
+            stack[++top] = bytes[code[pc++]];
+            continue;
+        }
+        if (op == OP_NEG) {
+            stack[top] = -stack[top];
+            continue;
+        }
+
+        float b = stack[top--];
+        float& a = stack[top];
+        switch (op) {
+            case OP_ADD: a += b; break;
+            case OP_SUB: a -= b; break;
+            case OP_MUL: a *= b; break;
+            case OP_DIV: a /= b; break;
+            case OP_SHL: a = (float)((int32_t)a << ((int32_t)b & 31)); break;
+            case OP_SHR: a = (float)((int32_t)a >> ((int32_t)b & 31)); break;
+            case OP_AND: a = (float)((int32_t)a & (int32_t)b); break;
+            case OP_OR: a = (float)((int32_t)a | (int32_t)b); break;
+        }
+    }
+    return stack[0];
+}
+
+bool Formula::parseOr() {
+    if (!parseAnd()) return false;
+    while (accept("|")) {
+        if (!parseAnd() || !binary(OP_OR)) return false;
+    }
+    return true;
+}
+
+bool Formula::parseAnd() {
+    if (!parseShift()) return false;
+    while (accept("&")) {
+        if (!parseShift() || !binary(OP_AND)) return false;
+    }
+    return true;
+}
+
+bool Formula::parseShift() {
+    if (!parseSum()) return false;
+    while (true) {
+        Op op;
+        if (accept("<<")) op = OP_SHL;
+        else if (accept(">>")) op = OP_SHR;
+        else return true;
+        if (!parseSum() || !binary(op)) return false;
+    }
+}
+
+bool Formula::parseSum() {
+    if (!parseTerm()) return false;
+    while (true) {
+        Op op;
+        if (accept("+")) op = OP_ADD;
+        else if (accept("-")) op = OP_SUB;
+        else return true;
+        if (!parseTerm() || !binary(op)) return false;
+    }
+}
+
+bool Formula::parseTerm() {
+    if (!parseUnary()) return false;
+    while (true) {
+        Op op;
+        if (accept("*")) op = OP_MUL;
+        else if (accept("/")) op = OP_DIV;
+        else return true;
+        if (!parseUnary() || !binary(op)) return false;
+    }
+}
+
+bool Formula::parseUnary() {
+    if (accept("-")) {
+        if (++nesting > Custom_Config::MAX_NESTING) {
+            return fail("nested too deeply");
+        }
+        bool ok = parseUnary() && emit(OP_NEG);
+        nesting--;
+        return ok;
+    }
+    return parsePrimary();
+}
+
+bool Formula::parsePrimary() {
+    while (*cursor == ' ') cursor++;
+    char c = toupper(*cursor);
+
+    if (accept("(")) {
+        // Each level recurses through every precedence level, so a line of
+        // brackets from flash must not be able to exhaust the task stack
+        if (++nesting > Custom_Config::MAX_NESTING) {
+            return fail("nested too deeply");
+        }
+        if (!parseOr()) return false;
+        nesting--;
+        return accept(")") || fail("missing )");
+    }
+    if (c >= 'A' && c <= 'H') {
+        cursor++;
+        int index = c - 'A';
+        maxByte = max(maxByte, index);
+        return push(OP_BYTE, index);
+    }
+    if (isdigit((unsigned char)c) || c == '.') {
+        char* end;
+        float value = strtof(cursor, &end);
+        if (end == cursor) {
+            return fail("bad number");
+        }
+        cursor = end;
+        if (constantCount >= Custom_Config::MAX_CONSTANTS) {
+            return fail("too many constants");
+        }
+        constants[constantCount] = value;
+        return push(OP_CONST, constantCount++);
+    }
+    return fail("expected a number, A-H or (");
+}
+
+bool Formula::emit(uint8_t byte) {
+    if (codeLength >= Custom_Config::MAX_CODE) {
+        return fail("formula too long");
+    }
+    code[codeLength++] = byte;
+    return true;
+}
+
+bool Formula::push(Op op, uint8_t operand) {
+    if (++depth > Custom_Config::MAX_STACK) {
+        return fail("formula nested too deeply");
+    }
+    return emit(op) && emit(operand);
+}
+
+bool Formula::binary(Op op) {
+    depth--;
+    return emit(op);
+}
+
+bool Formula::accept(const char* token) {
+    while (*cursor == ' ') cursor++;
+    size_t length = strlen(token);
+    if (strncmp(cursor, token, length) != 0) {
+        return false;
+    }
+    cursor += length;
+    return true;
+}
+
+bool Formula::fail(const char* message) {
+    if (error == nullptr) {
+        error = message;
+    }
+    return false;
+}
+
+// CustomPids
+
+CustomPid CustomPids::pids[Custom_Config::MAX_PIDS];
+int CustomPids::pidCount = 0;
+
+int CustomPids::load(const char* path) {
+    pidCount = 0;
+    if (!LittleFS.begin(false) || !LittleFS.exists(path)) {
+        LOG_DEBUG_F("No custom PIDs (%s not found)", path);
+        return 0;
+    }
+
+    File file = LittleFS.open(path, FILE_READ);
+    if (!file) {
+        LOG_ERROR_F("Cannot open %s", path);
+        return 0;
+    }
+
+    char line[Custom_Config::LINE_SIZE];
+    int lineNumber = 0;
+    while (file.available()) {
+        size_t length = file.readBytesUntil('\n', line, sizeof(line) - 1);
+        line[length] = '\0';
+        lineNumber++;
+
+        char* text = trim(line);
+        if (*text == '\0' || *text == '#') {
+            continue;
+        }
+        if (pidCount >= Custom_Config::MAX_PIDS) {
+            LOG_WARNING_F("%s: more than %d PIDs, the rest are ignored", path, Custom_Config::MAX_PIDS);
+            break;
+        }
+        if (parseLine(text, pids[pidCount])) {
+            pidCount++;
+        } else {
+            LOG_ERROR_F("%s line %d skipped", path, lineNumber);
+        }
+    }
+    file.close();
+
+    // Stable sort by header, so PIDs on the same ECU are read back to back
+    for (int i = 1; i < pidCount; i++) {
+        CustomPid pid = pids[i];
+        int j = i;
+        for (; j > 0 && pids[j - 1].header > pid.header; j--) {
+            pids[j] = pids[j - 1];
+        }
+        pids[j] = pid;
+    }
+
+    LOG_INFO_F("Loaded %d custom PIDs from %s", pidCount, path);
+    return pidCount;
+}
+
+bool CustomPids::parseLine(char* line, CustomPid& pid) {
+    char* save = nullptr;
+    char* topic = strtok_r(line, ",", &save);
+    char* header = strtok_r(nullptr, ",", &save);
+    char* command = strtok_r(nullptr, ",", &save);
+    char* bytes = strtok_r(nullptr, ",", &save);
+    char* formula = strtok_r(nullptr, "", &save);
+    if (formula == nullptr) {
+        LOG_ERROR("Custom PID: expected topic,header,command,bytes,formula");
+        return false;
+    }
+
+    topic = trim(topic);
+    header = trim(header);
+    command = trim(command);
+    formula = trim(formula);
+
+    if (*topic == '\0' || strlen(topic) >= sizeof(pid.topic)) {
+        LOG_ERROR_F("Custom PID %s: topic empty or too long", topic);
+        return false;
+    }
+    if (strpbrk(topic, "/+#") != nullptr || isReserved(topic)) {
+        LOG_ERROR_F("Custom PID %s: topic is a built-in one or has / + #", topic);
+        return false;
+    }
+    char* end;
+    unsigned long id = strtoul(header, &end, 16);
+    if (!isHex(header) || id > 0x7FF) {
+        LOG_ERROR_F("Custom PID %s: header must be an 11-bit hex ID", topic);
+        return false;
+    }
+    size_t commandLength = strlen(command);
+    if (!isHex(command) || commandLength % 2 != 0 || commandLength >= sizeof(pid.command)) {
+        LOG_ERROR_F("Custom PID %s: command must be hex bytes, e.g. 22002B", topic);
+        return false;
+    }
+    // Only single-frame answers are decoded: 7 bytes after the length,
+    // the echoed command first. Longer answers come as ISO-TP multi-frame
+    long maxBytes = 7 - (long)commandLength / 2;
+    long count = strtol(trim(bytes), &end, 10);
+    if (*end != '\0' || count < 1 || count > maxBytes) {
+        LOG_ERROR_F("Custom PID %s: bytes must be 1 to %ld for this command", topic, maxBytes);
+        return false;
+    }
+    if (!pid.formula.compile(formula)) {
+        LOG_ERROR_F("Custom PID %s: %s in \"%s\"", topic, pid.formula.getError(), formula);
+        return false;
+    }
+    if (pid.formula.getMaxByte() >= count) {
+        LOG_ERROR_F("Custom PID %s: formula reads byte %c of %ld", topic, 'A' + pid.formula.getMaxByte(), count);
+        return false;
+    }
+
+    strcpy(pid.topic, topic);
+    strcpy(pid.command, command);
+    for (char* c = pid.command; *c != '\0'; c++) {
+        *c = toupper(*c);
+    }
+    pid.header = id;
+    pid.bytes = count;
+    return true;
+}
@@ -0,0 +1,96 @@
+#ifndef CUSTOM_PIDS_H
+#define CUSTOM_PIDS_H
+
+#include <Arduino.h>
+#include "Config.h"
+#include "Logger.h"
+
+static_assert(Custom_Config::MAX_PIDS <= 32, "Custom PID masks are 32 bit");
+
+// Decode formula compiled to stack bytecode. The source is an integer-style
+// expression over the response data bytes A..H, e.g. "(A+B*256)/100":
+//   numbers, A..H, ( ), unary -, * /, + -, << >>, &, |  (C precedence)
+// evaluated in float, with the bit operators on the integer part.
+// Compiled once, with the stack depth checked, so evaluate() needs no
+// allocation and no bounds checks.
+class Formula {
+public:
+    bool compile(const char* source);
+    float evaluate(const uint8_t* bytes) const;
+
+    // Highest data byte the formula reads, -1 if none
+    int getMaxByte() const { return maxByte; }
+    const char* getError() const { return error; }
+
+private:
+    enum Op : uint8_t {
+        OP_CONST,   // Followed by a constant index
+        OP_BYTE,    // Followed by a data byte index
+        OP_NEG,
+        OP_ADD,
+        OP_SUB,
+        OP_MUL,
+        OP_DIV,
+        OP_SHL,
+        OP_SHR,
+        OP_AND,
+        OP_OR
+    };
+
+    uint8_t code[Custom_Config::MAX_CODE];
+    uint8_t codeLength = 0;
+    float constants[Custom_Config::MAX_CONSTANTS];
+    uint8_t constantCount = 0;
+    int maxByte = -1;
+    const char* error = nullptr;
+
+    // Compiler state
+    const char* cursor = nullptr;
+    int depth = 0;
+    int nesting = 0;            // Brackets and unary minus open
+
+    bool parseOr();
+    bool parseAnd();
+    bool parseShift();
+    bool parseSum();
+    bool parseTerm();
+    bool parseUnary();
+    bool parsePrimary();
+    bool emit(uint8_t byte);
+    bool push(Op op, uint8_t operand);
+    bool binary(Op op);
+    bool accept(const char* token);
+    bool fail(const char* message);
+};
+
+// A value read from a DID the firmware doesn't know about
+struct CustomPid {
+    char topic[Custom_Config::MAX_TOPIC];       // Published as "<prefix>/<topic>"
+    uint16_t header;                            // 11-bit request ID, as in the profiles
+    char command[Custom_Config::MAX_COMMAND];   // e.g. "22002B"
+    uint8_t bytes;                              // Data bytes the answer must carry, single frame only
+    Formula formula;
+};
+
+// Extra PIDs defined in a file on LittleFS (Custom_Config::FILE_PATH), read
+// after the built-in ones in every scheduled pass. One per line:
+//   topic,header,command,bytes,formula
+//   cell_max_mv,7E7,22002B,2,A+B*256       (format example, not a known DID)
+// Blank lines and lines starting with '#' are skipped; a line that doesn't
+// parse or compile, or whose topic is one of the firmware's own, is logged
+// and skipped. Kept sorted by header so each
+// ECU is addressed once per pass.
+class CustomPids {
+public:
+    static int load(const char* path);     // Returns the number loaded
+    static int count() { return pidCount; }
+    static const CustomPid& get(int index) { return pids[index]; }
+
+private:
+    static CustomPid pids[Custom_Config::MAX_PIDS];
+    static int pidCount;
+
+    static bool parseLine(char* line, CustomPid& pid);
+};
+
+#endif // CUSTOM_PIDS_H
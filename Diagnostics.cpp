@@ -0,0 +1,167 @@
+#include "Diagnostics.h"
+#include <esp_attr.h>
+#include <esp_heap_caps.h>
+
+namespace {
+    constexpr uint32_t STORE_MAGIC = 0x5EA1D1A6;
+    constexpr uint16_t COUNTER_MAX = 0xFFFF;
+
+    struct StageStats {
+        uint16_t success;
+        uint16_t timeout;
+        uint16_t failure;
+        uint16_t buckets[Diagnostics::BUCKET_COUNT];
+    };
+
+    struct DiagStore {
+        uint32_t magic;
+        char firmware[16];
+        uint16_t stageCount;
+        uint32_t cycles;
+        uint32_t cyclesSincePublish;
+        StageStats stages[(int)Stage::COUNT];
+    };
+
+    // Kept across resets (but not power loss) for field statistics
+    RTC_NOINIT_ATTR DiagStore store;
+
+    void increment(uint16_t& counter) {
+        if (counter < COUNTER_MAX) {
+            counter++;
+        }
+    }
+}
+
+bool Diagnostics::recording = true;
+uint32_t Diagnostics::heapBaseline = 0;
+
+void Diagnostics::begin() {
+    // Start fresh on power-on or when a different firmware is running so
+    // histograms are always comparable within a single version; a build
+    // with other stages under the same version would misread the counters
+    if (store.magic != STORE_MAGIC || strncmp(store.firmware, FIRMWARE_VERSION, sizeof(store.firmware)) != 0 ||
+        store.stageCount != (uint16_t)Stage::COUNT) {
+        memset(&store, 0, sizeof(store));
+        store.magic = STORE_MAGIC;
+        strncpy(store.firmware, FIRMWARE_VERSION, sizeof(store.firmware) - 1);
+        store.stageCount = (uint16_t)Stage::COUNT;
+        LOG_INFO("Diagnostics store initialized");
+    } else {
+        LOG_INFO_F("Diagnostics restored (%lu cycles)", (unsigned long)store.cycles);
+    }
+}
+
+void Diagnostics::record(Stage stage, unsigned long startTime, StageResult result) {
+    if (!recording || stage >= Stage::COUNT) return;
+
+    uint32_t duration = millis() - startTime;
+    StageStats& stats = store.stages[(int)stage];
+
+    switch (result) {
+        case StageResult::SUCCESS: increment(stats.success); break;
+        case StageResult::TIMEOUT: increment(stats.timeout); break;
+        case StageResult::FAILURE: increment(stats.failure); break;
+    }
+    increment(stats.buckets[bucketFor(duration)]);
+
+    LOG_DEBUG_F("Stage %s took %lu ms (result %d)", stageToString(stage), (unsigned long)duration, (int)result);
+}
+
+void Diagnostics::cycleComplete() {
+    store.cycles++;
+    store.cyclesSincePublish++;
+    
+    HeapStats heap = sampleHeap();
+    if (heapBaseline == 0) {
+        heapBaseline = heap.freeHeap;
+    }
+    LOG_INFO_F("Heap: free=%lu largest=%lu min=%lu (%+ld since first cycle)",
+               (unsigned long)heap.freeHeap, (unsigned long)heap.largestFreeBlock,
+               (unsigned long)heap.minFreeHeap, (long)heap.freeHeap - (long)heapBaseline);
+}
+
+bool Diagnostics::isPublishDue() {
+    return store.cyclesSincePublish >= Diag_Config::PUBLISH_EVERY_CYCLES;
+}
+
+void Diagnostics::markPublished() {
+    store.cyclesSincePublish = 0;
+}
+
+size_t Diagnostics::format(char* buffer, size_t bufferSize) {
+    size_t len = 0;
+    if (bufferSize == 0) return 0;
+    buffer[0] = '\0';
+
+    Logger::appendf(buffer, bufferSize, len, "{\"fw\":\"%s\",\"cyc\":%lu,\"b\":[", store.firmware, (unsigned long)store.cycles);
+    for (uint8_t i = 0; i < BUCKET_COUNT - 1; i++) {
+        Logger::appendf(buffer, bufferSize, len, i == 0 ? "%lu" : ",%lu", (unsigned long)BUCKET_LIMITS[i]);
+    }
+    Logger::appendf(buffer, bufferSize, len, "]");
+
+    // Each stage: [success, timeout, failure, [bucket counts...]]
+    for (int s = 0; s < (int)Stage::COUNT; s++) {
+        const StageStats& stats = store.stages[s];
+        Logger::appendf(buffer, bufferSize, len, ",\"%s\":[%u,%u,%u,[", stageToString((Stage)s), stats.success, stats.timeout, stats.failure);
+        for (uint8_t i = 0; i < BUCKET_COUNT; i++) {
+            Logger::appendf(buffer, bufferSize, len, i == 0 ? "%u" : ",%u", stats.buckets[i]);
+        }
+        Logger::appendf(buffer, bufferSize, len, "]]");
+    }
+    Logger::appendf(buffer, bufferSize, len, "}");
+
+    // A truncated message would be published as broken JSON
+    if (len + 1 >= bufferSize) {
+        LOG_ERROR_F("Diagnostics message needs more than %u bytes, not published", (unsigned)bufferSize);
+        buffer[0] = '\0';
+        return 0;
+    }
+    return len;
+}
+
+HeapStats Diagnostics::sampleHeap() {
+    HeapStats stats;
+    stats.freeHeap = ESP.getFreeHeap();
+    stats.largestFreeBlock = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    stats.minFreeHeap = ESP.getMinFreeHeap();
+    return stats;
+}
+
+size_t Diagnostics::formatHeap(char* buffer, size_t bufferSize) {
+    HeapStats heap = sampleHeap();
+    long growth = heapBaseline == 0 ? 0 : (long)heap.freeHeap - (long)heapBaseline;
+    int written = snprintf(buffer, bufferSize, "{\"free\":%lu,\"largest\":%lu,\"min\":%lu,\"delta\":%ld}",
+                           (unsigned long)heap.freeHeap, (unsigned long)heap.largestFreeBlock,
+                           (unsigned long)heap.minFreeHeap, growth);
+    return written < 0 ? 0 : (size_t)written;
+}
+
+const char* Diagnostics::stageToString(Stage stage) {
+    switch (stage) {
+        case Stage::BLE_SCAN: return "ble_scan";
+        case Stage::BLE_CONNECT: return "ble_conn";
+        case Stage::ELM_INIT: return "elm_init";
+        case Stage::WAKE_CHECK: return "wake";
+        case Stage::PID_SOC: return "pid_soc";
+        case Stage::PID_TEMP: return "pid_temp";
+        case Stage::PID_VOLTAGE: return "pid_volt";
+        case Stage::PID_TOTAL_CHARGES: return "pid_chg";
+        case Stage::PID_KWH_CHARGED: return "pid_kwhc";
+        case Stage::PID_KWH_DISCHARGED: return "pid_kwhd";
+        case Stage::PID_CUSTOM: return "pid_custom";
+        case Stage::WIFI_CONNECT: return "wifi";
+        case Stage::NTP_SYNC: return "ntp";
+        case Stage::MQTT_CONNECT: return "mqtt_conn";
+        case Stage::MQTT_PUBLISH: return "mqtt_pub";
+        default: return "unknown";
+    }
+}
+
+uint8_t Diagnostics::bucketFor(uint32_t durationMs) {
+    for (uint8_t i = 0; i < BUCKET_COUNT - 1; i++) {
+        if (durationMs < BUCKET_LIMITS[i]) {
+            return i;
+        }
+    }
+    return BUCKET_COUNT - 1;
+}
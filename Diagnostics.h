@@ -0,0 +1,86 @@
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+
+#include <Arduino.h>
+#include "Config.h"
+#include "Logger.h"
+
+// Stages of an update cycle that are timed
+enum class Stage : uint8_t {
+    BLE_SCAN,
+    BLE_CONNECT,
+    ELM_INIT,
+    WAKE_CHECK,
+    PID_SOC,
+    PID_TEMP,
+    PID_VOLTAGE,
+    PID_TOTAL_CHARGES,
+    PID_KWH_CHARGED,
+    PID_KWH_DISCHARGED,
+    PID_CUSTOM,
+    WIFI_CONNECT,
+    NTP_SYNC,
+    MQTT_CONNECT,
+    MQTT_PUBLISH,
+    COUNT
+};
+
+enum class StageResult : uint8_t {
+    SUCCESS,
+    TIMEOUT,
+    FAILURE
+};
+
+struct HeapStats {
+    uint32_t freeHeap;
+    uint32_t largestFreeBlock;
+    uint32_t minFreeHeap;      // Lowest free heap since boot
+};
+
+// Fixed-bucket latency histograms and outcome counters per stage.
+// Statistics live in RTC memory so they survive resets and are only
+// cleared on power loss or when the firmware version changes.
+class Diagnostics {
+public:
+    // Upper bounds (ms) of the histogram buckets; the last bucket is open ended
+    static constexpr uint8_t BUCKET_COUNT = 10;
+    static constexpr uint32_t BUCKET_LIMITS[BUCKET_COUNT - 1] = {
+        50, 100, 250, 500, 1000, 2500, 5000, 10000, 20000
+    };
+
+    // format() output with every counter at 65535: the header with the
+    // bucket limits, then per stage ,"<name, 12 max>":[n,n,n,[n x BUCKET_COUNT]]
+    static constexpr size_t MAX_STAGE_NAME = 12;
+    static constexpr size_t HEADER_SIZE = 160;
+    static constexpr size_t STAGE_ENTRY_SIZE = MAX_STAGE_NAME + 12 + 6 * (3 + BUCKET_COUNT);
+    static constexpr size_t MESSAGE_SIZE = HEADER_SIZE + (size_t)Stage::COUNT * STAGE_ENTRY_SIZE;
+
+    static void begin();
+
+    // Pause recording (e.g. while benchmarks drive the real code paths)
+    static void setRecording(bool enabled) { recording = enabled; }
+
+    // Record a stage that started at startTime (millis) and has just finished
+    static void record(Stage stage, unsigned long startTime, StageResult result);
+
+    static void cycleComplete();
+    static bool isPublishDue();
+    static void markPublished();
+
+    // Write the compact JSON diagnostics message, returns its length, or 0
+    // if it didn't fit (nothing partial is ever returned)
+    static size_t format(char* buffer, size_t bufferSize);
+
+    // Heap watermarks; growth is reported relative to the end of the first cycle
+    static HeapStats sampleHeap();
+    static size_t formatHeap(char* buffer, size_t bufferSize);
+
+private:
+    static bool recording;
+    static uint32_t heapBaseline;
+
+    static const char* stageToString(Stage stage);
+    static uint8_t bucketFor(uint32_t durationMs);
+};
+
+#endif // DIAGNOSTICS_H
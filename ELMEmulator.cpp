@@ -0,0 +1,102 @@
+#include "ELMEmulator.h"
+#include "VehicleProfiles.h"
+
+namespace {
+    struct CannedResponse {
+        const char* command;
+        const char* response;
+    };
+
+    // Headers on, spaces off: "7EF" + length + "62" + DID + data bytes.
+    // Every built-in profile shares the e-Platform 3.0 DIDs
+    using Profile = BydEPlatform3Profile;
+    const CannedResponse PID_RESPONSES[] = {
+        { Profile::CMD_SOC, "7EF05621FFC401F" },                // 80.00 %
+        { Profile::CMD_TEMP, "7EF0462003241" },                 // 25 C
+        { Profile::CMD_VOLTAGE, "7EF056200089001" },            // 400 V
+        { Profile::CMD_TOTAL_CHARGES, "7EF0562000B9600" },      // 150 charges
+        { Profile::CMD_KWH_CHARGED, "7EF0562001160EA" },        // 60000 kWh
+        { Profile::CMD_KWH_DISCHARGED, "7EF0562001250C3" },     // 50000 kWh
+    };
+}
+
+ELMEmulator::ELMEmulator(unsigned long latencyMs)
+    : commandLength(0), responseLength(0), responsePosition(0), responseReadyAt(0),
+      responseLatency(latencyMs), commandCount(0) {
+    command[0] = '\0';
+    response[0] = '\0';
+}
+
+int ELMEmulator::available() {
+    if (!isReady()) return 0;
+    return responseLength - responsePosition;
+}
+
+int ELMEmulator::read() {
+    if (!isReady() || responsePosition >= responseLength) return -1;
+    return (uint8_t)response[responsePosition++];
+}
+
+int ELMEmulator::peek() {
+    if (!isReady() || responsePosition >= responseLength) return -1;
+    return (uint8_t)response[responsePosition];
+}
+
+size_t ELMEmulator::write(uint8_t c) {
+    if (c == '\r') {
+        command[commandLength] = '\0';
+        handleCommand();
+        commandLength = 0;
+        return 1;
+    }
+
+    // The ELM327 ignores spaces and case in commands
+    if (c == ' ' || c == '\n') return 1;
+    if (commandLength < COMMAND_SIZE - 1) {
+        command[commandLength++] = toupper(c);
+    }
+    return 1;
+}
+
+void ELMEmulator::flush() {
+    // Nothing buffered on the transmit side
+}
+
+void ELMEmulator::handleCommand() {
+    commandCount++;
+
+    if (strcmp(command, "ATZ") == 0 || strcmp(command, "ATI") == 0) {
+        setResponse("ELM327 v1.5");
+        return;
+    }
+    if (strcmp(command, "ATRV") == 0) {
+        setResponse("12.6V");
+        return;
+    }
+    if (strncmp(command, "AT", 2) == 0 || strncmp(command, "ST", 2) == 0) {
+        setResponse("OK");
+        return;
+    }
+
+    for (const CannedResponse& canned : PID_RESPONSES) {
+        if (strcmp(command, canned.command) == 0) {
+            setResponse(canned.response);
+            return;
+        }
+    }
+
+    setResponse("NO DATA");
+}
+
+void ELMEmulator::setResponse(const char* text) {
+    responseLength = snprintf(response, sizeof(response), "%s\r\r>", text);
+    if (responseLength >= sizeof(response)) {
+        responseLength = sizeof(response) - 1;
+    }
+    responsePosition = 0;
+    responseReadyAt = millis() + responseLatency;
+}
+
+bool ELMEmulator::isReady() const {
+    return (long)(millis() - responseReadyAt) >= 0;
+}
@@ -0,0 +1,43 @@
+#ifndef ELM_EMULATOR_H
+#define ELM_EMULATOR_H
+
+#include <Arduino.h>
+#include "Stream.h"
+#include "Config.h"
+
+// In-memory ELM327 stand-in that answers AT commands and the configured
+// PIDs with canned BYD e-Platform 3.0 responses after a configurable latency.
+// Used by the benchmark suite to drive OBDManager without a car.
+class ELMEmulator : public Stream {
+public:
+    explicit ELMEmulator(unsigned long latencyMs = 0);
+
+    void setLatency(unsigned long latencyMs) { responseLatency = latencyMs; }
+    unsigned long getCommandCount() const { return commandCount; }
+
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t write(uint8_t c) override;
+    void flush() override;
+    using Print::write;
+
+private:
+    static constexpr size_t COMMAND_SIZE = 32;
+    static constexpr size_t RESPONSE_SIZE = 64;
+
+    char command[COMMAND_SIZE];
+    size_t commandLength;
+    char response[RESPONSE_SIZE];
+    size_t responseLength;
+    size_t responsePosition;
+    unsigned long responseReadyAt;
+    unsigned long responseLatency;
+    unsigned long commandCount;
+
+    void handleCommand();
+    void setResponse(const char* text);
+    bool isReady() const;
+};
+
+#endif // ELM_EMULATOR_H
@@ -0,0 +1,372 @@
+#include "LANServer.h"
+#include <mbedtls/base64.h>
+#include <mbedtls/sha1.h>
+#include <mbedtls/version.h>
+
+namespace {
+    const char* const WEBSOCKET_GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+    const uint8_t OPCODE_TEXT = 0x1;
+    const uint8_t OPCODE_CLOSE = 0x8;
+    const uint8_t OPCODE_PING = 0x9;
+    const uint8_t OPCODE_PONG = 0xA;
+
+    bool startsWith(const char* text, const char* prefix) {
+        return strncasecmp(text, prefix, strlen(prefix)) == 0;
+    }
+}
+
+LANServer::LANServer(SampleBus& bus)
+    : bus(bus), subscriber(SampleBus::NO_SUBSCRIBER), server(Lan_Config::PORT), listening(false),
+      receiving(false) {
+    for (Socket& socket : sockets) {
+        socket.length = 0;
+    }
+}
+
+void LANServer::begin() {
+    subscriber = bus.subscribe("lan");
+}
+
+void LANServer::poll() {
+    if (WiFi.status() != WL_CONNECTED) {
+        if (listening) {
+            for (Socket& socket : sockets) {
+                socket.client.stop();
+            }
+            request.client.stop();
+            receiving = false;
+            server.end();
+            listening = false;
+            LOG_INFO("LAN server stopped");
+        }
+    } else if (!listening) {
+        server.begin();
+        listening = true;
+        LOG_INFO_F("LAN server listening on http://%s:%u/state", WiFi.localIP().toString().c_str(), Lan_Config::PORT);
+    }
+
+    // Samples are drained even with no one listening so the queue never backs up
+    VehicleSample sample;
+    char message[Lan_Config::MESSAGE_SIZE];
+    while (bus.poll(subscriber, sample)) {
+        if (listening) {
+            size_t length = formatSample(sample, message, sizeof(message));
+            broadcast(message, length);
+        }
+    }
+
+    if (!listening) {
+        return;
+    }
+
+    if (!receiving) {
+        WiFiClient client = server.available();
+        if (client) {
+            startRequest(client);
+        }
+    }
+    if (receiving) {
+        receiveRequest();
+    }
+    serviceSockets();
+}
+
+void LANServer::startRequest(WiFiClient& client) {
+    request.client = client;
+    request.started = millis();
+    request.lineLength = 0;
+    request.method[0] = '\0';
+    request.path[0] = '\0';
+    request.key[0] = '\0';
+    request.websocket = false;
+    receiving = true;
+}
+
+void LANServer::receiveRequest() {
+    // Only what has arrived is read; the rest is picked up on later loops
+    int available = request.client.available();
+    while (available-- > 0) {
+        int c = request.client.read();
+        if (c < 0) {
+            break;
+        }
+        if (c != '\n') {
+            if (request.lineLength < sizeof(request.line) - 1) {
+                request.line[request.lineLength++] = (char)c;
+            }
+            continue;
+        }
+        if (request.lineLength > 0 && request.line[request.lineLength - 1] == '\r') {
+            request.lineLength--;
+        }
+        request.line[request.lineLength] = '\0';
+        request.lineLength = 0;
+        if (!handleLine()) {
+            receiving = false;
+            handleRequest();
+            return;
+        }
+    }
+
+    if (!request.client.connected() || millis() - request.started > Lan_Config::REQUEST_TIMEOUT) {
+        LOG_DEBUG("LAN request incomplete, dropped");
+        request.client.stop();
+        receiving = false;
+    }
+}
+
+bool LANServer::handleLine() {
+    const char* line = request.line;
+
+    // Request line, e.g. "GET /state HTTP/1.1"; a blank line before it is allowed
+    if (request.method[0] == '\0') {
+        if (line[0] != '\0') {
+            sscanf(line, "%7s %31s", request.method, request.path);
+        }
+        return true;
+    }
+
+    // Headers up to the blank line; only the WebSocket ones matter
+    if (line[0] == '\0') {
+        return false;
+    }
+    if (startsWith(line, "Upgrade:") && strcasestr(line, "websocket") != nullptr) {
+        request.websocket = true;
+    } else if (startsWith(line, "Sec-WebSocket-Key:")) {
+        const char* value = line + strlen("Sec-WebSocket-Key:");
+        while (*value == ' ') value++;
+        snprintf(request.key, sizeof(request.key), "%s", value);
+    }
+    return true;
+}
+
+void LANServer::handleRequest() {
+    WiFiClient& client = request.client;
+    const char* method = request.method;
+    const char* path = request.path;
+    const char* key = request.key;
+    bool websocket = request.websocket;
+
+    LOG_DEBUG_F("LAN request: %s %s", method, path);
+
+    if (strcmp(method, "GET") != 0) {
+        sendStatus(client, "405 Method Not Allowed");
+    } else if (strcmp(path, "/state") == 0) {
+        sendState(client);
+    } else if (strcmp(path, "/stream") == 0 && websocket && key[0] != '\0') {
+        if (upgrade(client, key)) {
+            return;     // Kept open for streaming
+        }
+    } else {
+        sendStatus(client, "404 Not Found");
+    }
+    client.stop();
+}
+
+void LANServer::sendState(WiFiClient& client) {
+    client.print("HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nConnection: close\r\n\r\n[");
+
+    char message[Lan_Config::MESSAGE_SIZE];
+    VehicleSample sample;
+    bool first = true;
+    for (int i = 0; i < Vehicles::COUNT; i++) {
+        if (!bus.latest(i, sample)) {
+            continue;
+        }
+        if (!first) {
+            client.write(',');
+        }
+        size_t length = formatSample(sample, message, sizeof(message));
+        client.write((const uint8_t*)message, length);
+        first = false;
+    }
+    client.print("]\n");
+}
+
+bool LANServer::upgrade(WiFiClient& client, const char* key) {
+    int slot = -1;
+    for (int i = 0; i < Lan_Config::MAX_SOCKETS; i++) {
+        if (!sockets[i].client.connected()) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot < 0) {
+        sendStatus(client, "503 Service Unavailable");
+        return false;
+    }
+
+    // Sec-WebSocket-Accept is base64(SHA-1(key + GUID)), RFC 6455 section 4.2.2
+    char input[96];
+    int inputLength = snprintf(input, sizeof(input), "%s%s", key, WEBSOCKET_GUID);
+    uint8_t digest[20];
+#if MBEDTLS_VERSION_NUMBER >= 0x03000000
+    mbedtls_sha1((const uint8_t*)input, inputLength, digest);
+#else
+    mbedtls_sha1_ret((const uint8_t*)input, inputLength, digest);
+#endif
+    uint8_t accept[32];
+    size_t acceptLength = 0;
+    mbedtls_base64_encode(accept, sizeof(accept), &acceptLength, digest, sizeof(digest));
+
+    char response[160];
+    int length = snprintf(response, sizeof(response),
+                          "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n"
+                          "Connection: Upgrade\r\nSec-WebSocket-Accept: %.*s\r\n\r\n",
+                          (int)acceptLength, (const char*)accept);
+    client.write((const uint8_t*)response, length);
+
+    sockets[slot].client = client;
+    sockets[slot].length = 0;
+    LOG_INFO_F("LAN stream client %d connected", slot);
+    return true;
+}
+
+void LANServer::sendStatus(WiFiClient& client, const char* status) {
+    char response[96];
+    int length = snprintf(response, sizeof(response),
+                          "HTTP/1.1 %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", status);
+    client.write((const uint8_t*)response, length);
+}
+
+void LANServer::serviceSockets() {
+    for (int i = 0; i < Lan_Config::MAX_SOCKETS; i++) {
+        Socket& socket = sockets[i];
+        if (!socket.client.connected()) {
+            continue;
+        }
+
+        // Frames can arrive split across reads, so they're buffered and only
+        // handled once whole
+        int available = socket.client.available();
+        size_t space = sizeof(socket.frame) - socket.length;
+        if (available > 0 && space > 0) {
+            int read = socket.client.read(socket.frame + socket.length, min((size_t)available, space));
+            if (read > 0) {
+                socket.length += read;
+            }
+        }
+        while (handleFrame(i)) {
+        }
+    }
+}
+
+bool LANServer::handleFrame(int index) {
+    Socket& socket = sockets[index];
+    uint8_t* frame = socket.frame;
+    if (!socket.client.connected() || socket.length < 2) {
+        return false;
+    }
+
+    // Client frames are always masked; only control frames need an answer
+    uint8_t opcode = frame[0] & 0x0F;
+    bool masked = frame[1] & 0x80;
+    uint64_t length = frame[1] & 0x7F;
+    size_t extended = length == 126 ? 2 : length == 127 ? 8 : 0;
+    size_t headerLength = 2 + extended + (masked ? 4 : 0);
+    if (socket.length < headerLength) {
+        return false;
+    }
+    if (extended > 0) {
+        length = 0;
+        for (size_t b = 0; b < extended; b++) {
+            length = (length << 8) | frame[2 + b];
+        }
+    }
+
+    // Nothing but control frames is expected, so anything that can't be
+    // buffered whole ends the stream (1009, message too big)
+    if (length > sizeof(socket.frame) - headerLength) {
+        sendFrame(socket.client, OPCODE_CLOSE, "\x03\xF1", 2);
+        socket.client.stop();
+        LOG_WARNING_F("LAN stream client %d sent a %llu byte frame, closed", index, (unsigned long long)length);
+        return false;
+    }
+    size_t frameLength = headerLength + (size_t)length;
+    if (socket.length < frameLength) {
+        return false;
+    }
+
+    char* payload = (char*)frame + headerLength;
+    if (masked) {
+        const uint8_t* mask = frame + headerLength - 4;
+        for (size_t b = 0; b < length; b++) {
+            payload[b] ^= mask[b % 4];
+        }
+    }
+
+    if (opcode == OPCODE_CLOSE) {
+        sendFrame(socket.client, OPCODE_CLOSE, payload, min((size_t)length, (size_t)2));
+        socket.client.stop();
+        socket.length = 0;
+        LOG_INFO_F("LAN stream client %d closed", index);
+        return false;
+    }
+    if (opcode == OPCODE_PING) {
+        sendFrame(socket.client, OPCODE_PONG, payload, length);
+    }
+
+    socket.length -= frameLength;
+    memmove(frame, frame + frameLength, socket.length);
+    return true;
+}
+
+void LANServer::broadcast(const char* text, size_t length) {
+    for (int i = 0; i < Lan_Config::MAX_SOCKETS; i++) {
+        WiFiClient& socket = sockets[i].client;
+        if (!socket.connected()) {
+            continue;
+        }
+        if (!sendFrame(socket, OPCODE_TEXT, text, length)) {
+            socket.stop();
+            LOG_INFO_F("LAN stream client %d disconnected", i);
+        }
+    }
+}
+
+bool LANServer::sendFrame(WiFiClient& client, uint8_t opcode, const char* payload, size_t length) {
+    // Server frames are unmasked and never fragmented
+    uint8_t header[4];
+    size_t headerLength = 2;
+    header[0] = 0x80 | opcode;
+    if (length < 126) {
+        header[1] = length;
+    } else {
+        header[1] = 126;
+        header[2] = length >> 8;
+        header[3] = length & 0xFF;
+        headerLength = 4;
+    }
+
+    return client.write(header, headerLength) == headerLength &&
+           client.write((const uint8_t*)payload, length) == length;
+}
+
+size_t LANServer::formatSample(const VehicleSample& sample, char* buffer, size_t bufferSize) {
+    const VehicleData& data = sample.data;
+    size_t len = 0;
+    Logger::appendf(buffer, bufferSize, len, "{\"vehicle\":\"%s\",\"time\":%ld,\"age_ms\":%lu",
+            Vehicles::LIST[sample.vehicle].topicPrefix, (long)sample.epoch, millis() - sample.data.capturedAt);
+
+    if (data.validMask & Pids::SOC) {
+        Logger::appendf(buffer, bufferSize, len, ",\"%s\":%.2f", MQTT::TOPIC_SOC, data.stateOfCharge());
+    }
+    if (data.validMask & Pids::TEMP) {
+        Logger::appendf(buffer, bufferSize, len, ",\"%s\":%.1f", MQTT::TOPIC_TEMP, data.batteryTemperature());
+    }
+    if (data.validMask & Pids::VOLTAGE) {
+        Logger::appendf(buffer, bufferSize, len, ",\"%s\":%.2f", MQTT::TOPIC_VOLTAGE, data.batteryVoltage());
+    }
+    if (data.validMask & Pids::TOTAL_CHARGES) {
+        Logger::appendf(buffer, bufferSize, len, ",\"%s\":%.0f", MQTT::TOPIC_CHARGES_UPDATE, data.totalCharges());
+    }
+    if (data.validMask & Pids::KWH_CHARGED) {
+        Logger::appendf(buffer, bufferSize, len, ",\"%s\":%.2f", MQTT::TOPIC_KWH_CHARGED_UPDATE, data.totalKwhCharged());
+    }
+    if (data.validMask & Pids::KWH_DISCHARGED) {
+        Logger::appendf(buffer, bufferSize, len, ",\"%s\":%.2f", MQTT::TOPIC_KWH_DISCHARGED_UPDATE, data.totalKwhDischarged());
+    }
+    Logger::appendf(buffer, bufferSize, len, "}");
+    return len;
+}
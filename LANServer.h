@@ -0,0 +1,69 @@
+#ifndef LAN_SERVER_H
+#define LAN_SERVER_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include "Config.h"
+#include "Logger.h"
+#include "SampleBus.h"
+
+// Minimal HTTP server for reading the data on the local network without
+// going through the MQTT broker:
+//   GET /state   JSON array with the latest values of every vehicle
+//   GET /stream  WebSocket, one JSON text message per new sample
+// Responses are formatted into a stack buffer and written straight to the
+// socket. Requests and client frames are read as they arrive and handled
+// once complete, so a slow client never holds up the loop. Only listens
+// while WiFi is connected, so it needs the command channel
+// (Commands::ENABLED) to be reachable between updates.
+class LANServer {
+public:
+    explicit LANServer(SampleBus& bus);
+
+    void begin();   // Subscribe to the sample bus, call once from setup()
+    void poll();    // Accept and serve clients, stream new samples; call every loop
+
+    // One sample as a JSON object, returns its length
+    static size_t formatSample(const VehicleSample& sample, char* buffer, size_t bufferSize);
+
+private:
+    SampleBus& bus;
+    int subscriber;
+    WiFiServer server;
+    bool listening;
+
+    // The request being received; one at a time, others wait to be accepted
+    struct Request {
+        WiFiClient client;
+        unsigned long started;
+        char line[Lan_Config::LINE_SIZE];
+        size_t lineLength;
+        char method[8];
+        char path[32];
+        char key[32];
+        bool websocket;
+    };
+    Request request;
+    bool receiving;
+
+    struct Socket {
+        WiFiClient client;
+        uint8_t frame[Lan_Config::FRAME_SIZE];  // Bytes of the frames not yet handled
+        size_t length;
+    };
+    Socket sockets[Lan_Config::MAX_SOCKETS];
+
+    void startRequest(WiFiClient& client);
+    void receiveRequest();
+    bool handleLine();
+    void handleRequest();
+    void sendState(WiFiClient& client);
+    bool upgrade(WiFiClient& client, const char* key);
+    void sendStatus(WiFiClient& client, const char* status);
+    void serviceSockets();
+    bool handleFrame(int index);
+    void broadcast(const char* text, size_t length);
+    static bool sendFrame(WiFiClient& client, uint8_t opcode, const char* payload, size_t length);
+};
+
+#endif // LAN_SERVER_H
@@ -1,148 +1,253 @@
-#include "LEDManager.h"
-
-LEDManager::LEDManager() 
-    : initialized(false), currentBrightness(LED::BRIGHTNESS), currentStatus(LEDStatus::OFF),
-      currentColor(LED::OFF) {
-}
-
-LEDManager::~LEDManager() {
-    end();
-}
-
-void LEDManager::begin() {
-    if (!LED::ENABLED) {
-        LOG_DEBUG("LED functionality disabled in config");
-        return;
-    }
-    
-    // Initialize M5AtomS3 (this also initializes the LED)
-    // Note: AtomS3.begin() should be called in main setup, not here
-    // We just mark as initialized if LED is enabled
-    
-    initialized = true;
-    
-    // Set initial brightness
-    AtomS3.dis.setBrightness(currentBrightness);
-    
-    // Start with LED off
-    turnOff();
-    
-    LOG_DEBUG("LED Manager initialized for M5Stack AtomS3 Lite");
-    
-    // Brief startup indication - blue blink
-    blink(LED::BLUE, 2, 100);
-}
-
-void LEDManager::end() {
-    if (initialized && LED::ENABLED) {
-        turnOff();
-        initialized = false;
-        LOG_DEBUG("LED Manager deinitialized");
-    }
-}
-
-void LEDManager::setStatus(LEDStatus status) {
-    if (!LED::ENABLED || !initialized) return;
-    
-    currentStatus = status;
-    uint32_t color = getStatusColor(status);
-    setColor(color);
-    
-    LOG_DEBUG_F("LED status set to: %d (color: 0x%06X)", (int)status, color);
-}
-
-void LEDManager::setColor(uint32_t color) {
-    if (!LED::ENABLED || !initialized) return;
-    
-    currentColor = color;
-    writeColor(color);
-}
-
-void LEDManager::setBrightness(uint8_t brightness) {
-    if (!LED::ENABLED || !initialized) return;
-    
-    currentBrightness = brightness;
-    
-    // Set M5Stack display brightness (affects LED)
-    AtomS3.dis.setBrightness(brightness);
-    
-    // Reapply current color with new brightness
-    writeColor(currentColor);
-    
-    LOG_DEBUG_F("LED brightness set to: %d", brightness);
-}
-
-void LEDManager::turnOff() {
-    if (!LED::ENABLED || !initialized) return;
-    
-    setColor(LED::OFF);
-    currentStatus = LEDStatus::OFF;
-}
-
-void LEDManager::blink(uint32_t color, int count, int delay_ms) {
-    if (!LED::ENABLED || !initialized) return;
-    
-    for (int i = 0; i < count; i++) {
-        setColor(color);
-        delay(delay_ms);
-        turnOff();
-        if (i < count - 1) { // Don't delay after the last blink
-            delay(delay_ms);
-        }
-    }
-    
-    // Restore previous status color after blinking
-    setColor(getStatusColor(currentStatus));
-}
-
-void LEDManager::update() {
-    // No animations needed - just static LED colors
-    // This function can be called but does nothing now
-    // Kept for compatibility with existing code
-}
-
-void LEDManager::writeColor(uint32_t color) {
-    if (!LED::ENABLED || !initialized) return;
-    
-    // Apply overall brightness scaling
-    uint32_t finalColor = applyBrightness(color);
-    
-    // Use M5Stack AtomS3 LED control
-    AtomS3.dis.drawpix(finalColor);
-    AtomS3.update();
-    
-    LOG_DEBUG_F("LED color written: 0x%06X", finalColor);
-}
-
-uint32_t LEDManager::applyBrightness(uint32_t color) {
-    // Extract RGB components
-    uint8_t r = (color >> 16) & 0xFF;
-    uint8_t g = (color >> 8) & 0xFF;
-    uint8_t b = color & 0xFF;
-    
-    // Apply brightness factor
-    r = (r * currentBrightness) / 100;
-    g = (g * currentBrightness) / 100;
-    b = (b * currentBrightness) / 100;
-    
-    // Recombine into 24-bit color
-    return (r << 16) | (g << 8) | b;
-}
-
-uint32_t LEDManager::getStatusColor(LEDStatus status) {
-    switch (status) {
-        case LEDStatus::WAITING:
-            return LED::YELLOW;     // Yellow for waiting
-        case LEDStatus::OBD_READING:
-            return LED::GREEN;      // Green for OBD reading
-        case LEDStatus::NETWORK_OP:
-            return LED::BLUE;       // Blue for network operations
-        case LEDStatus::ERROR:
-            return LED::RED;        // Red for errors
-        case LEDStatus::SETUP:
-            return LED::PURPLE;     // Purple for setup/connecting
-        case LEDStatus::OFF:
-        default:
-            return LED::OFF;        // LED off
-    }
+#include "LEDManager.h"
+
+LEDManager::LEDManager() 
+    : initialized(false), currentBrightness(LED::BRIGHTNESS), currentStatus(LEDStatus::OFF),
+      currentColor(LED::OFF), writtenColor(0xFFFFFFFF), animation(LEDAnimation::NONE),
+      animationColor(LED::OFF), animationCount(0), animationStepMs(0), animationStart(0),
+      queuedAnimation(LEDAnimation::NONE), queuedColor(LED::OFF), queuedCount(0), queuedStepMs(0) {
+}
+
+LEDManager::~LEDManager() {
+    end();
+}
+
+void LEDManager::begin() {
+    if (!LED::ENABLED) {
+        LOG_DEBUG("LED functionality disabled in config");
+        return;
+    }
+    
+    // Initialize M5AtomS3 (this also initializes the LED)
+    // Note: AtomS3.begin() should be called in main setup, not here
+    // We just mark as initialized if LED is enabled
+    
+    initialized = true;
+    
+    // The LED may have been written by someone else since end(), so the
+    // first write has to go out even if it matches the last one
+    writtenColor = 0xFFFFFFFF;
+    
+    // Set initial brightness
+    AtomS3.dis.setBrightness(currentBrightness);
+    
+    // Start with LED off
+    turnOff();
+    
+    LOG_DEBUG("LED Manager initialized for M5Stack AtomS3 Lite");
+}
+
+void LEDManager::end() {
+    if (initialized && LED::ENABLED) {
+        animation = LEDAnimation::NONE;
+        queuedAnimation = LEDAnimation::NONE;
+        turnOff();
+        initialized = false;
+        LOG_DEBUG("LED Manager deinitialized");
+    }
+}
+
+void LEDManager::setStatus(LEDStatus status) {
+    if (!LED::ENABLED || !initialized) return;
+    
+    currentStatus = status;
+    uint32_t color = getStatusColor(status);
+    setColor(color);
+    
+    LOG_DEBUG_F("LED status set to: %d (color: 0x%06X)", (int)status, color);
+}
+
+void LEDManager::setColor(uint32_t color) {
+    if (!LED::ENABLED || !initialized) return;
+    
+    // A new color ends a repeating animation; finite ones finish first
+    if (color != currentColor) {
+        if (isRepeating()) {
+            animation = LEDAnimation::NONE;
+        }
+        queuedAnimation = LEDAnimation::NONE;
+    }
+    currentColor = color;
+    if (animation == LEDAnimation::NONE) {
+        writeColor(color);
+    }
+}
+
+void LEDManager::setBrightness(uint8_t brightness) {
+    if (!LED::ENABLED || !initialized) return;
+    
+    currentBrightness = brightness;
+    
+    // Set M5Stack display brightness (affects LED)
+    AtomS3.dis.setBrightness(brightness);
+    
+    // Reapply current color with new brightness
+    if (animation == LEDAnimation::NONE) {
+        writeColor(currentColor);
+    }
+    
+    LOG_DEBUG_F("LED brightness set to: %d", brightness);
+}
+
+void LEDManager::turnOff() {
+    if (!LED::ENABLED || !initialized) return;
+    
+    setColor(LED::OFF);
+    currentStatus = LEDStatus::OFF;
+}
+
+void LEDManager::blink(uint32_t color, int count, int delay_ms) {
+    startAnimation(LEDAnimation::BLINK, color, count, delay_ms);
+}
+
+void LEDManager::pulse(uint32_t color, int count, int period_ms) {
+    startAnimation(LEDAnimation::PULSE, color, count, period_ms);
+}
+
+void LEDManager::showCode(uint32_t color, int code) {
+    startAnimation(LEDAnimation::CODE, color, code, LED::CODE_FLASH_MS);
+}
+
+void LEDManager::stopAnimation() {
+    queuedAnimation = LEDAnimation::NONE;
+    if (animation == LEDAnimation::NONE) return;
+    
+    animation = LEDAnimation::NONE;
+    writeColor(currentColor);
+}
+
+void LEDManager::finishAnimation() {
+    if (queuedAnimation != LEDAnimation::NONE) {
+        LEDAnimation type = queuedAnimation;
+        queuedAnimation = LEDAnimation::NONE;
+        startAnimation(type, queuedColor, queuedCount, queuedStepMs);
+        return;
+    }
+    stopAnimation();
+}
+
+void LEDManager::startAnimation(LEDAnimation type, uint32_t color, int count, unsigned long stepMs) {
+    if (!LED::ENABLED || !initialized || stepMs == 0) return;
+    if (count <= 0 && type != LEDAnimation::PULSE) return;
+    
+    if (isRepeating(type, count) && animation != LEDAnimation::NONE && !isRepeating()) {
+        queuedAnimation = type;
+        queuedColor = color;
+        queuedCount = count;
+        queuedStepMs = stepMs;
+        return;
+    }
+    
+    queuedAnimation = LEDAnimation::NONE;
+    animation = type;
+    animationColor = color;
+    animationCount = count;
+    animationStepMs = stepMs;
+    animationStart = millis();
+    update();
+}
+
+bool LEDManager::isRepeating(LEDAnimation type, int count) {
+    return type == LEDAnimation::CODE || (type == LEDAnimation::PULSE && count == 0);
+}
+
+void LEDManager::update() {
+    if (!LED::ENABLED || !initialized || animation == LEDAnimation::NONE) return;
+    
+    // Each frame is worked out from the time since the start, so a late
+    // call just skips ahead instead of stretching the animation
+    unsigned long elapsed = millis() - animationStart;
+    uint32_t color = currentColor;
+    
+    switch (animation) {
+        case LEDAnimation::BLINK: {
+            // Steps alternate color and off, without a trailing off step
+            unsigned long step = elapsed / animationStepMs;
+            if (step >= (unsigned long)animationCount * 2 - 1) {
+                finishAnimation();
+                return;
+            }
+            color = (step % 2 == 0) ? animationColor : LED::OFF;
+            break;
+        }
+        case LEDAnimation::PULSE: {
+            unsigned long period = elapsed / animationStepMs;
+            if (animationCount > 0 && period >= (unsigned long)animationCount) {
+                finishAnimation();
+                return;
+            }
+            // Triangle wave: up for the first half of the period, down for the second
+            unsigned long phase = (elapsed % animationStepMs) * 510 / animationStepMs;
+            uint8_t level = phase <= 255 ? phase : 510 - phase;
+            color = scaleColor(animationColor, level);
+            break;
+        }
+        case LEDAnimation::CODE: {
+            unsigned long flashes = (unsigned long)animationCount * 2 * animationStepMs;
+            unsigned long phase = elapsed % (flashes + LED::CODE_PAUSE_MS);
+            bool lit = phase < flashes && (phase / animationStepMs) % 2 == 0;
+            color = lit ? animationColor : LED::OFF;
+            break;
+        }
+        case LEDAnimation::NONE:
+            break;
+    }
+    
+    writeColor(color);
+}
+
+void LEDManager::writeColor(uint32_t color) {
+    if (!LED::ENABLED || !initialized) return;
+    
+    // Apply overall brightness scaling
+    uint32_t finalColor = applyBrightness(color);
+    
+    // Each write is an LED transaction; skip it when nothing changes
+    if (finalColor == writtenColor) return;
+    writtenColor = finalColor;
+    
+    // Use M5Stack AtomS3 LED control
+    AtomS3.dis.drawpix(finalColor);
+    AtomS3.update();
+    
+    LOG_DEBUG_F("LED color written: 0x%06X", finalColor);
+}
+
+uint32_t LEDManager::applyBrightness(uint32_t color) {
+    // Extract RGB components
+    uint8_t r = (color >> 16) & 0xFF;
+    uint8_t g = (color >> 8) & 0xFF;
+    uint8_t b = color & 0xFF;
+    
+    // Apply brightness factor
+    r = (r * currentBrightness) / 100;
+    g = (g * currentBrightness) / 100;
+    b = (b * currentBrightness) / 100;
+    
+    // Recombine into 24-bit color
+    return (r << 16) | (g << 8) | b;
+}
+
+uint32_t LEDManager::scaleColor(uint32_t color, uint8_t level) {
+    uint8_t r = (((color >> 16) & 0xFF) * level) / 255;
+    uint8_t g = (((color >> 8) & 0xFF) * level) / 255;
+    uint8_t b = ((color & 0xFF) * level) / 255;
+    return (r << 16) | (g << 8) | b;
+}
+
+uint32_t LEDManager::getStatusColor(LEDStatus status) {
+    switch (status) {
+        case LEDStatus::WAITING:
+            return LED::YELLOW;     // Yellow for waiting
+        case LEDStatus::OBD_READING:
+            return LED::GREEN;      // Green for OBD reading
+        case LEDStatus::NETWORK_OP:
+            return LED::BLUE;       // Blue for network operations
+        case LEDStatus::ERROR:
+            return LED::RED;        // Red for errors
+        case LEDStatus::SETUP:
+            return LED::PURPLE;     // Purple for setup/connecting
+        case LEDStatus::OFF:
+        default:
+            return LED::OFF;        // LED off
+    }
 }
\ No newline at end of file
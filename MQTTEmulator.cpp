@@ -0,0 +1,185 @@
+#include "MQTTEmulator.h"
+
+namespace {
+    // Control packet types, MQTT 3.1.1 section 2.2.1
+    const uint8_t CONNECT = 1;
+    const uint8_t PUBLISH = 3;
+    const uint8_t SUBSCRIBE = 8;
+    const uint8_t PINGREQ = 12;
+    const uint8_t DISCONNECT = 14;
+}
+
+MQTTEmulator::MQTTEmulator(unsigned long ackDelayMs)
+    : open(false), ackDelay(ackDelayMs), dropCountdown(0), rxState(RxState::TYPE), packetType(0),
+      remaining(0), lengthShift(0), bodyLength(0), responseLength(0), responsePosition(0),
+      responseReadyAt(0), publishCount(0), payloadBytes(0) {
+    lastTopic[0] = '\0';
+}
+
+int MQTTEmulator::connect(IPAddress, uint16_t) {
+    open = true;
+    rxState = RxState::TYPE;
+    responseLength = 0;
+    responsePosition = 0;
+    return 1;
+}
+
+int MQTTEmulator::connect(const char*, uint16_t) {
+    return connect(IPAddress(), 0);
+}
+
+size_t MQTTEmulator::write(uint8_t c) {
+    if (!open) return 0;
+
+    switch (rxState) {
+        case RxState::TYPE:
+            packetType = c;
+            remaining = 0;
+            lengthShift = 0;
+            rxState = RxState::LENGTH;
+            break;
+
+        case RxState::LENGTH:
+            remaining |= (uint32_t)(c & 0x7F) << lengthShift;
+            lengthShift += 7;
+            if (!(c & 0x80)) {
+                bodyLength = 0;
+                if (remaining == 0) {
+                    handlePacket();
+                } else {
+                    rxState = RxState::BODY;
+                }
+            }
+            break;
+
+        case RxState::BODY:
+            // Only the start is kept, payloads are just counted
+            if (bodyLength < BODY_SIZE) {
+                body[bodyLength] = c;
+            }
+            if (++bodyLength == remaining) {
+                handlePacket();
+            }
+            break;
+    }
+    return 1;
+}
+
+size_t MQTTEmulator::write(const uint8_t* buffer, size_t size) {
+    size_t written = 0;
+    while (written < size && write(buffer[written]) == 1) {
+        written++;
+    }
+    return written;
+}
+
+int MQTTEmulator::available() {
+    if (!isReady()) return 0;
+    return responseLength - responsePosition;
+}
+
+int MQTTEmulator::read() {
+    if (!isReady() || responsePosition >= responseLength) return -1;
+    return response[responsePosition++];
+}
+
+int MQTTEmulator::read(uint8_t* buffer, size_t size) {
+    size_t count = 0;
+    int c;
+    while (count < size && (c = read()) >= 0) {
+        buffer[count++] = c;
+    }
+    return count;
+}
+
+int MQTTEmulator::peek() {
+    if (!isReady() || responsePosition >= responseLength) return -1;
+    return response[responsePosition];
+}
+
+void MQTTEmulator::flush() {
+    // Nothing buffered on the transmit side
+}
+
+void MQTTEmulator::stop() {
+    open = false;
+    responseLength = 0;
+    responsePosition = 0;
+}
+
+void MQTTEmulator::handlePacket() {
+    rxState = RxState::TYPE;
+
+    switch (packetType >> 4) {
+        case CONNECT: {
+            const uint8_t connack[] = { 0x20, 0x02, 0x00, 0x00 };   // Accepted, no session
+            respond(connack, sizeof(connack), 0);
+            break;
+        }
+        case PUBLISH:
+            handlePublish();
+            break;
+        case SUBSCRIBE: {
+            // Granted the QoS asked for by the (single) topic filter
+            uint8_t qos = bodyLength <= BODY_SIZE ? body[bodyLength - 1] & 0x03 : 0;
+            const uint8_t suback[] = { 0x90, 0x03, body[0], body[1], qos };
+            respond(suback, sizeof(suback), 0);
+            break;
+        }
+        case PINGREQ: {
+            const uint8_t pingresp[] = { 0xD0, 0x00 };
+            respond(pingresp, sizeof(pingresp), 0);
+            break;
+        }
+        case DISCONNECT:
+            open = false;
+            break;
+    }
+}
+
+void MQTTEmulator::handlePublish() {
+    uint8_t qos = (packetType >> 1) & 0x03;
+    size_t topicLength = (body[0] << 8) | body[1];
+    size_t idLength = qos > 0 ? 2 : 0;
+    if (2 + topicLength + idLength > BODY_SIZE || 2 + topicLength + idLength > remaining) {
+        return;     // Topic longer than the emulator keeps, not counted
+    }
+
+    size_t kept = topicLength < TOPIC_SIZE - 1 ? topicLength : TOPIC_SIZE - 1;
+    memcpy(lastTopic, body + 2, kept);
+    lastTopic[kept] = '\0';
+    publishCount++;
+    payloadBytes += remaining - 2 - topicLength - idLength;
+
+    if (dropCountdown > 0 && --dropCountdown == 0) {
+        stop();
+        return;
+    }
+    if (qos == 1) {
+        const uint8_t puback[] = { 0x40, 0x02, body[2 + topicLength], body[3 + topicLength] };
+        respond(puback, sizeof(puback), ackDelay);
+    }
+}
+
+void MQTTEmulator::respond(const uint8_t* bytes, size_t length, unsigned long delayMs) {
+    unsigned long readyAt = millis() + delayMs;
+    if (responsePosition == responseLength) {
+        // Everything was read, start the buffer over
+        responseLength = 0;
+        responsePosition = 0;
+        responseReadyAt = readyAt;
+    } else if ((long)(readyAt - responseReadyAt) > 0) {
+        // Answers arrive in order, a held back PUBACK holds back the rest
+        responseReadyAt = readyAt;
+    }
+    if (responseLength + length > RESPONSE_SIZE) {
+        return;     // The client stopped reading
+    }
+
+    memcpy(response + responseLength, bytes, length);
+    responseLength += length;
+}
+
+bool MQTTEmulator::isReady() const {
+    return (long)(millis() - responseReadyAt) >= 0;
+}
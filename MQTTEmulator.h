@@ -0,0 +1,81 @@
+#ifndef MQTT_EMULATOR_H
+#define MQTT_EMULATOR_H
+
+#include <Arduino.h>
+#include <Client.h>
+#include "Config.h"
+
+// In-memory MQTT 3.1.1 broker stand-in, used as the network client of an
+// MQTTNetworkManager so the publish path can run without WiFi or a broker.
+// It accepts CONNECT, PUBLISH (QoS 0/1), SUBSCRIBE, PINGREQ and DISCONNECT,
+// records what was published and answers like a broker would. PUBACKs can
+// be held back to model a slow broker, and the connection can be made to
+// drop after a number of publishes. Used by the benchmark suite.
+class MQTTEmulator : public Client {
+public:
+    explicit MQTTEmulator(unsigned long ackDelayMs = 0);
+
+    void setAckDelay(unsigned long ackDelayMs) { ackDelay = ackDelayMs; }
+    // Close the connection on the n-th publish from now (before its PUBACK), 0 never
+    void dropAfter(uint32_t publishes) { dropCountdown = publishes; }
+
+    uint32_t getPublishCount() const { return publishCount; }
+    uint32_t getPayloadBytes() const { return payloadBytes; }
+    const char* getLastTopic() const { return lastTopic; }
+
+    int connect(IPAddress ip, uint16_t port) override;
+    int connect(const char* host, uint16_t port) override;
+    // Timeout variants, pure virtual in some core versions
+    int connect(IPAddress ip, uint16_t port, int32_t) { return connect(ip, port); }
+    int connect(const char* host, uint16_t port, int32_t) { return connect(host, port); }
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* buffer, size_t size) override;
+    int available() override;
+    int read() override;
+    int read(uint8_t* buffer, size_t size) override;
+    int peek() override;
+    void flush() override;
+    void stop() override;
+    uint8_t connected() override { return open; }
+    operator bool() override { return open; }
+
+private:
+    static constexpr size_t BODY_SIZE = 96;         // Packet bytes kept: topic and packet ID
+    static constexpr size_t RESPONSE_SIZE = 128;
+    static constexpr size_t TOPIC_SIZE = MQTT::MAX_TOPIC_LENGTH;
+
+    enum class RxState : uint8_t {
+        TYPE,
+        LENGTH,
+        BODY
+    };
+
+    bool open;
+    unsigned long ackDelay;
+    uint32_t dropCountdown;
+
+    // Incoming packet being parsed
+    RxState rxState;
+    uint8_t packetType;
+    uint32_t remaining;
+    uint8_t lengthShift;
+    uint32_t bodyLength;
+    uint8_t body[BODY_SIZE];
+
+    // Answers waiting to be read by the client
+    uint8_t response[RESPONSE_SIZE];
+    size_t responseLength;
+    size_t responsePosition;
+    unsigned long responseReadyAt;
+
+    uint32_t publishCount;
+    uint32_t payloadBytes;
+    char lastTopic[TOPIC_SIZE];
+
+    void handlePacket();
+    void handlePublish();
+    void respond(const uint8_t* bytes, size_t length, unsigned long delayMs);
+    bool isReady() const;
+};
+
+#endif // MQTT_EMULATOR_H
@@ -0,0 +1,162 @@
+#include "MetricsEngine.h"
+#include <esp_attr.h>
+
+namespace {
+    constexpr uint32_t STORE_MAGIC = 0x5EA1E7C5;
+    constexpr uint16_t STORE_VERSION = 1;
+
+    struct VehicleState {
+        uint8_t lastMask;           // Pids bits of the last* values that are set
+        uint32_t lastSocTime;       // Epoch s of lastSoc, 0 if unknown
+        float lastSoc;
+        float lastCharged;
+        float lastDischarged;
+
+        // Charge session in progress, started at the last SoC low point
+        bool charging;
+        float sessionSoc;
+        float sessionCharged;
+
+        float capacityKwh;          // Learned capacity, 0 until the first session
+        uint16_t sessions;
+    };
+
+    struct MetricsStore {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t vehicleCount;
+        VehicleState vehicles[Vehicles::COUNT];
+    };
+
+    // Kept across resets and deep sleep (but not power loss)
+    RTC_NOINIT_ATTR MetricsStore store;
+
+    void updateCapacity(VehicleState& state, float soc, float charged) {
+        float span = soc - state.sessionSoc;
+        float energy = charged - state.sessionCharged;
+        if (span < Metrics_Config::MIN_CAPACITY_SOC_SPAN || energy <= 0.0f) {
+            return;
+        }
+
+        float estimate = energy * 100.0f / span;
+        if (state.sessions == 0) {
+            state.capacityKwh = estimate;
+        } else {
+            state.capacityKwh += Metrics_Config::CAPACITY_GAIN * (estimate - state.capacityKwh);
+        }
+        if (state.sessions < 0xFFFF) {
+            state.sessions++;
+        }
+        LOG_INFO_F("Charge session: %.1f kWh for %.1f%% SoC, capacity estimate %.1f kWh",
+                   energy, span, state.capacityKwh);
+    }
+}
+
+void MetricsEngine::begin() {
+    if (store.magic != STORE_MAGIC || store.version != STORE_VERSION || store.vehicleCount != Vehicles::COUNT) {
+        memset(&store, 0, sizeof(store));
+        store.magic = STORE_MAGIC;
+        store.version = STORE_VERSION;
+        store.vehicleCount = Vehicles::COUNT;
+        LOG_INFO("Metrics store initialized");
+    } else {
+        LOG_INFO("Metrics restored");
+    }
+}
+
+void MetricsEngine::update(int vehicle, const VehicleData& data, time_t now,
+                           float nominalCapacityKwh, DerivedMetrics& metrics) {
+    metrics.validMask = 0;
+    if (vehicle < 0 || vehicle >= Vehicles::COUNT) return;
+
+    VehicleState& state = store.vehicles[vehicle];
+    uint8_t fresh = data.validMask;
+
+    // Lifetime ratios straight from the counters
+    if ((fresh & Pids::KWH_CHARGED) && (fresh & Pids::KWH_DISCHARGED) && data.totalKwhCharged() > 0.0f) {
+        metrics.efficiency = data.totalKwhDischarged() * 100.0f / data.totalKwhCharged();
+        metrics.validMask |= DerivedMetrics::EFFICIENCY;
+    }
+    if ((fresh & Pids::KWH_CHARGED) && (fresh & Pids::TOTAL_CHARGES) && data.totalCharges() > 0.0f) {
+        metrics.kwhPerCharge = data.totalKwhCharged() / data.totalCharges();
+        metrics.validMask |= DerivedMetrics::KWH_PER_CHARGE;
+    }
+
+    // Energy since the previous sample. A counter going backwards means the
+    // BMS was reset or a different car answered, so no delta this time
+    if ((fresh & Pids::KWH_CHARGED) && (fresh & Pids::KWH_DISCHARGED) &&
+        (state.lastMask & Pids::KWH_CHARGED) && (state.lastMask & Pids::KWH_DISCHARGED) &&
+        data.totalKwhCharged() >= state.lastCharged && data.totalKwhDischarged() >= state.lastDischarged) {
+        metrics.chargedDeltaKwh = data.totalKwhCharged() - state.lastCharged;
+        metrics.dischargedDeltaKwh = data.totalKwhDischarged() - state.lastDischarged;
+        metrics.validMask |= DerivedMetrics::ENERGY_DELTA;
+    }
+
+    if ((fresh & Pids::SOC) && (state.lastMask & Pids::SOC)) {
+        float socDelta = data.stateOfCharge() - state.lastSoc;
+
+        // Average power over the gap, using the learned capacity once known
+        long elapsed = (now > 0 && state.lastSocTime > 0) ? (long)(now - state.lastSocTime) : 0;
+        if (elapsed > 0 && (unsigned long)elapsed <= Metrics_Config::MAX_SAMPLE_GAP) {
+            float capacity = state.sessions > 0 ? state.capacityKwh : nominalCapacityKwh;
+            metrics.chargePowerKw = socDelta / 100.0f * capacity * 3600.0f / elapsed;
+            metrics.validMask |= DerivedMetrics::CHARGE_POWER;
+        }
+
+        // Charge sessions run from the last SoC low point until SoC stops rising
+        if ((fresh & Pids::KWH_CHARGED) && (state.lastMask & Pids::KWH_CHARGED)) {
+            if (socDelta > 0.0f && !state.charging) {
+                state.charging = true;
+                state.sessionSoc = state.lastSoc;
+                state.sessionCharged = state.lastCharged;
+            } else if (socDelta <= 0.0f && state.charging) {
+                // SoC rose on every sample of the session, so the previous one
+                // is its peak; this one may already be after a drop
+                state.charging = false;
+                updateCapacity(state, state.lastSoc, state.lastCharged);
+            }
+        }
+    }
+
+    if (state.sessions > 0 && nominalCapacityKwh > 0.0f) {
+        metrics.stateOfHealth = state.capacityKwh * 100.0f / nominalCapacityKwh;
+        metrics.validMask |= DerivedMetrics::STATE_OF_HEALTH;
+    }
+
+    // Keep the fields of this sample for the next one
+    if (fresh & Pids::SOC) {
+        state.lastSoc = data.stateOfCharge();
+        state.lastSocTime = (uint32_t)now;
+    }
+    if (fresh & Pids::KWH_CHARGED) {
+        state.lastCharged = data.totalKwhCharged();
+    }
+    if (fresh & Pids::KWH_DISCHARGED) {
+        state.lastDischarged = data.totalKwhDischarged();
+    }
+    state.lastMask |= fresh & (Pids::SOC | Pids::KWH_CHARGED | Pids::KWH_DISCHARGED);
+}
+
+size_t MetricsEngine::format(const DerivedMetrics& metrics, char* buffer, size_t bufferSize) {
+    size_t len = 0;
+    char separator = '{';
+    auto field = [&](uint8_t bit, const char* name, float value) {
+        if (metrics.validMask & bit) {
+            Logger::appendf(buffer, bufferSize, len, "%c\"%s\":%.2f", separator, name, value);
+            separator = ',';
+        }
+    };
+
+    field(DerivedMetrics::EFFICIENCY, "efficiency", metrics.efficiency);
+    field(DerivedMetrics::KWH_PER_CHARGE, "kwh_per_charge", metrics.kwhPerCharge);
+    field(DerivedMetrics::ENERGY_DELTA, "kwh_charged_delta", metrics.chargedDeltaKwh);
+    field(DerivedMetrics::ENERGY_DELTA, "kwh_discharged_delta", metrics.dischargedDeltaKwh);
+    field(DerivedMetrics::CHARGE_POWER, "power_kw", metrics.chargePowerKw);
+    field(DerivedMetrics::STATE_OF_HEALTH, "soh", metrics.stateOfHealth);
+
+    if (separator == '{') {
+        Logger::appendf(buffer, bufferSize, len, "{");
+    }
+    Logger::appendf(buffer, bufferSize, len, "}");
+    return len;
+}
@@ -0,0 +1,48 @@
+#ifndef METRICS_ENGINE_H
+#define METRICS_ENGINE_H
+
+#include <Arduino.h>
+#include <time.h>
+#include "Config.h"
+#include "Logger.h"
+#include "OBDManager.h"
+
+// Values derived from the raw PIDs, valid where the matching bit is set
+struct DerivedMetrics {
+    static constexpr uint8_t EFFICIENCY = 1 << 0;
+    static constexpr uint8_t KWH_PER_CHARGE = 1 << 1;
+    static constexpr uint8_t ENERGY_DELTA = 1 << 2;
+    static constexpr uint8_t CHARGE_POWER = 1 << 3;
+    static constexpr uint8_t STATE_OF_HEALTH = 1 << 4;
+
+    float efficiency = 0.0;         // Lifetime kWh discharged / kWh charged, %
+    float kwhPerCharge = 0.0;       // Lifetime kWh charged / charge count
+    float chargedDeltaKwh = 0.0;    // Since the previous sample
+    float dischargedDeltaKwh = 0.0;
+    float chargePowerKw = 0.0;      // From the SoC change, negative while discharging
+    float stateOfHealth = 0.0;      // Learned capacity / nominal capacity, %
+    uint8_t validMask = 0;
+};
+
+// Updates the derived metrics from each new sample in constant time, keeping
+// only the previous sample and a running capacity estimate per vehicle.
+//
+// Capacity is learned from charge sessions: kWh charged divided by the SoC
+// gained, once a session has added at least MIN_CAPACITY_SOC_SPAN. This
+// includes charging losses, so state of health is a rough trend, not a
+// measurement. The state lives in RTC memory and survives resets and deep
+// sleep; it is cleared on power loss or when the store layout changes.
+class MetricsEngine {
+public:
+    static void begin();
+
+    // data.validMask marks the fields read in this sample; now is the epoch
+    // time, 0 if the clock isn't set (rate based metrics are then skipped)
+    static void update(int vehicle, const VehicleData& data, time_t now,
+                       float nominalCapacityKwh, DerivedMetrics& metrics);
+
+    // Write the compact JSON metrics message, returns its length
+    static size_t format(const DerivedMetrics& metrics, char* buffer, size_t bufferSize);
+};
+
+#endif // METRICS_ENGINE_H
@@ -0,0 +1,32 @@
+#include "OBDTransport.h"
+#include "BLEClientSerial.h"
+#include "TCPClientSerial.h"
+#include "SPPClientSerial.h"
+
+void OBDTransport::markTimeout() {
+    // An unframed link can't tell answers apart, so wait out the late one
+    // here; the adapter ends every answer, NO DATA included, with '>'.
+    // The wait restarts while bytes keep coming
+    unsigned long lastByte = millis();
+    while (millis() - lastByte < OBD::RESYNC_WAIT) {
+        while (available() > 0) {
+            if (read() == '>') {
+                return;
+            }
+            lastByte = millis();
+        }
+        delay(Adaptive_Config::RESPONSE_POLL_MS);
+    }
+}
+
+OBDTransport* OBDTransport::create(Transport transport) {
+    switch (transport) {
+        case Transport::TCP:
+            return new TCPClientSerial();
+        case Transport::SPP:
+            return new SPPClientSerial();
+        case Transport::BLE:
+        default:
+            return new BLEClientSerial();
+    }
+}
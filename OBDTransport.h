@@ -0,0 +1,43 @@
+#ifndef OBD_TRANSPORT_H
+#define OBD_TRANSPORT_H
+
+#include <Arduino.h>
+#include "Stream.h"
+#include "Config.h"
+
+// Link to an ELM327 adapter. OBDManager hands the Stream side to ELMduino;
+// the rest finds the adapter, opens the link and closes it again. What
+// name and address mean is up to the transport (see VehicleConfig).
+class OBDTransport : public Stream {
+public:
+    virtual ~OBDTransport() {}
+
+    virtual const char* getName() const = 0;   // For logs
+
+    // Looks for the adapter, false if it isn't there
+    virtual bool begin(const char* name, const char* address) = 0;
+    virtual bool connect(unsigned long timeout_ms) = 0;
+    virtual bool isConnected(void) = 0;
+    virtual void end(void) = 0;
+
+    // While open, WiFi is on the adapter's own network and can't reach the
+    // broker, so the link must be ended before publishing
+    virtual bool takesWiFi(void) const { return false; }
+
+    // Links that assemble whole responses themselves (BLE notifications)
+    // count them here, so ELMduino is only handed complete ones. Others
+    // are read as the bytes arrive
+    virtual bool isFramed(void) const { return false; }
+    virtual int framesAvailable(void) { return 0; }
+    virtual void setRawMode(bool) {}           // Unframed output (monitor mode)
+
+    // The host gave up waiting for the last command's answer. Whatever is
+    // left of that answer must not be taken for the next command's. By
+    // default the rest of it is read and dropped, up to its prompt
+    virtual void markTimeout(void);
+
+    // The transport for a vehicle, allocated once and kept by its OBDManager
+    static OBDTransport* create(Transport transport);
+};
+
+#endif // OBD_TRANSPORT_H
@@ -0,0 +1,100 @@
+#include "RadioStats.h"
+
+namespace {
+    constexpr float MS_PER_HOUR = 3600000.0f;
+}
+
+RadioStats::Totals RadioStats::cycle = {};
+RadioStats::Totals RadioStats::day = {};
+float RadioStats::previousDayMah = -1.0f;
+unsigned long RadioStats::onSince[(int)Radio::COUNT] = {};
+uint8_t RadioStats::links[(int)Radio::COUNT] = {};
+bool RadioStats::recording = true;
+
+void RadioStats::radioOn(Radio radio) {
+    int index = (int)radio;
+    if (links[index]++ == 0) {
+        onSince[index] = millis();
+    }
+}
+
+void RadioStats::radioOff(Radio radio) {
+    int index = (int)radio;
+    if (links[index] > 0 && --links[index] == 0) {
+        cycle.onMs[index] += millis() - onSince[index];
+    }
+}
+
+void RadioStats::addScan(unsigned long durationMs) {
+    if (!recording) {
+        return;
+    }
+    cycle.scanMs += durationMs;
+    cycle.onMs[(int)Radio::BLE] += durationMs;
+}
+
+void RadioStats::accumulate(unsigned long now) {
+    // Links that are still up count towards the period being closed
+    for (int i = 0; i < (int)Radio::COUNT; i++) {
+        if (links[i] > 0) {
+            cycle.onMs[i] += now - onSince[i];
+            onSince[i] = now;
+        }
+    }
+}
+
+void RadioStats::addTotals(Totals& into, const Totals& from) {
+    for (int i = 0; i < (int)Radio::COUNT; i++) {
+        into.onMs[i] += from.onMs[i];
+        into.tx[i] += from.tx[i];
+    }
+    into.scanMs += from.scanMs;
+}
+
+float RadioStats::estimateMah(const Totals& totals, unsigned long now) {
+    uint32_t bleConnectedMs = totals.onMs[(int)Radio::BLE] - totals.scanMs;
+    float mAms = Power_Config::BASE_MA * (now - totals.startTime) +
+                 Power_Config::BLE_SCAN_MA * totals.scanMs +
+                 Power_Config::BLE_CONNECTED_MA * bleConnectedMs +
+                 Power_Config::WIFI_MA * totals.onMs[(int)Radio::WIFI];
+    return mAms / MS_PER_HOUR;
+}
+
+void RadioStats::formatTotals(const char* name, const Totals& totals, unsigned long now,
+                              char* buffer, size_t bufferSize, size_t& len) {
+    Logger::appendf(buffer, bufferSize, len,
+            "\"%s\":{\"s\":%lu,\"ble_ms\":%lu,\"scan_ms\":%lu,\"ble_tx\":%lu,\"wifi_ms\":%lu,\"wifi_tx\":%lu,\"mah\":%.2f}",
+            name, (now - totals.startTime) / 1000,
+            (unsigned long)totals.onMs[(int)Radio::BLE], (unsigned long)totals.scanMs,
+            (unsigned long)totals.tx[(int)Radio::BLE], (unsigned long)totals.onMs[(int)Radio::WIFI],
+            (unsigned long)totals.tx[(int)Radio::WIFI], estimateMah(totals, now));
+}
+
+size_t RadioStats::formatCycle(char* buffer, size_t bufferSize) {
+    unsigned long now = millis();
+    accumulate(now);
+    addTotals(day, cycle);
+
+    size_t len = 0;
+    Logger::appendf(buffer, bufferSize, len, "{");
+    formatTotals("cycle", cycle, now, buffer, bufferSize, len);
+    Logger::appendf(buffer, bufferSize, len, ",");
+    formatTotals("day", day, now, buffer, bufferSize, len);
+    if (previousDayMah >= 0.0f) {
+        Logger::appendf(buffer, bufferSize, len, ",\"prev_day_mah\":%.1f", previousDayMah);
+    }
+    Logger::appendf(buffer, bufferSize, len, "}");
+
+    LOG_INFO_F("Radio this cycle: BLE %lu ms (scan %lu ms), WiFi %lu ms, ~%.2f mAh",
+               (unsigned long)cycle.onMs[(int)Radio::BLE], (unsigned long)cycle.scanMs,
+               (unsigned long)cycle.onMs[(int)Radio::WIFI], estimateMah(cycle, now));
+
+    if (now - day.startTime >= Power_Config::DAY_MS) {
+        previousDayMah = estimateMah(day, now);
+        day = {};
+        day.startTime = now;
+    }
+    cycle = {};
+    cycle.startTime = now;
+    return len;
+}
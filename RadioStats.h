@@ -0,0 +1,96 @@
+#ifndef RADIO_STATS_H
+#define RADIO_STATS_H
+
+#include <Arduino.h>
+#include "Config.h"
+#include "Logger.h"
+
+enum class Radio : uint8_t {
+    BLE,
+    WIFI,
+    COUNT
+};
+
+// Radio-on time, BLE scan time and transmit counts per update cycle and per
+// day, with an estimated charge drawn from the supply. The current figures
+// in Power_Config are datasheet-level estimates; calibrate them against a
+// USB power meter before trusting the mAh values in absolute terms.
+//
+// Only called from the main loop.
+class RadioStats {
+public:
+    // A radio link came up / went down. Links are counted per radio, so
+    // the on time ends only when the last one goes down (SPP and BLE share
+    // one radio, as do a TCP adapter and MQTT). Each on needs exactly one
+    // off; RadioLink keeps them paired
+    static void radioOn(Radio radio);
+    static void radioOff(Radio radio);
+
+    // A completed BLE scan, counted as BLE on time
+    static void addScan(unsigned long durationMs);
+
+    // One transmission: a GATT write or an MQTT publish
+    static void countTx(Radio radio) {
+        if (recording) {
+            cycle.tx[(int)radio]++;
+        }
+    }
+
+    // Pause transmit and scan counting (e.g. while benchmarks publish to an
+    // emulated broker); on time still follows the real links
+    static void setRecording(bool enabled) { recording = enabled; }
+
+    // Write the JSON message for the cycle so far and start a new cycle,
+    // returns its length
+    static size_t formatCycle(char* buffer, size_t bufferSize);
+
+private:
+    struct Totals {
+        unsigned long startTime;                // millis() at the start of the period
+        uint32_t onMs[(int)Radio::COUNT];
+        uint32_t scanMs;
+        uint32_t tx[(int)Radio::COUNT];
+    };
+
+    static Totals cycle;
+    static Totals day;
+    static float previousDayMah;                // Last complete day, < 0 until there is one
+    static unsigned long onSince[(int)Radio::COUNT];
+    static uint8_t links[(int)Radio::COUNT];  // Links currently up
+    static bool recording;
+
+    static void accumulate(unsigned long now);
+    static void addTotals(Totals& into, const Totals& from);
+    static float estimateMah(const Totals& totals, unsigned long now);
+    static void formatTotals(const char* name, const Totals& totals, unsigned long now,
+                             char* buffer, size_t bufferSize, size_t& len);
+};
+
+// One link's hold on a radio. Repeated acquire() or release() calls from
+// the same link are ignored, so a link can release on every path that may
+// end it without closing the radio under another link
+class RadioLink {
+public:
+    explicit RadioLink(Radio radio) : radio(radio), held(false) {}
+    ~RadioLink() { release(); }
+
+    void acquire() {
+        if (!held) {
+            held = true;
+            RadioStats::radioOn(radio);
+        }
+    }
+
+    void release() {
+        if (held) {
+            held = false;
+            RadioStats::radioOff(radio);
+        }
+    }
+
+private:
+    Radio radio;
+    bool held;
+};
+
+#endif // RADIO_STATS_H
@@ -0,0 +1,123 @@
+#include "SPPClientSerial.h"
+#include "RadioStats.h"
+#include "Logger.h"
+
+SPPClientSerial::SPPClientSerial()
+    : hasAddress(false), started(false), radioLink(Radio::BLE) {
+    deviceName[0] = '\0';
+    memset(deviceAddress, 0, sizeof(deviceAddress));
+}
+
+SPPClientSerial::~SPPClientSerial() {
+    end();
+}
+
+bool SPPClientSerial::begin(const char* name, const char* address) {
+#if SPP_SUPPORTED
+    snprintf(deviceName, sizeof(deviceName), "%s", name ? name : "");
+    unsigned int mac[6];
+    hasAddress = address != nullptr &&
+                 sscanf(address, "%x:%x:%x:%x:%x:%x", &mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5]) == 6;
+    for (int i = 0; i < 6; i++) {
+        deviceAddress[i] = hasAddress ? (uint8_t)mac[i] : 0;
+    }
+
+    if (!started) {
+        // Master mode, the adapter is the one advertising
+        if (!serial.begin("SealOBD", true)) {
+            LOG_ERROR("Classic Bluetooth failed to start");
+            return false;
+        }
+        started = true;
+    }
+    return true;
+#else
+    (void)name;
+    (void)address;
+    LOG_ERROR("SPP transport selected, but this chip has no classic Bluetooth");
+    return false;
+#endif
+}
+
+bool SPPClientSerial::connect(unsigned long) {
+#if SPP_SUPPORTED
+    // BluetoothSerial waits on its own fixed connection timeout and takes
+    // none from the caller; a search by name also runs an inquiry first,
+    // so prefer setting the address
+    radioLink.acquire();    // Same radio as BLE
+    bool ok = hasAddress ? serial.connect(deviceAddress) : serial.connect(String(deviceName));
+    if (!ok) {
+        radioLink.release();
+    }
+    return ok;
+#else
+    return false;
+#endif
+}
+
+bool SPPClientSerial::isConnected() {
+#if SPP_SUPPORTED
+    return started && serial.connected(0);
+#else
+    return false;
+#endif
+}
+
+void SPPClientSerial::end() {
+#if SPP_SUPPORTED
+    if (started) {
+        serial.disconnect();
+    }
+    radioLink.release();
+#endif
+}
+
+int SPPClientSerial::available() {
+#if SPP_SUPPORTED
+    return serial.available();
+#else
+    return 0;
+#endif
+}
+
+int SPPClientSerial::read() {
+#if SPP_SUPPORTED
+    return serial.read();
+#else
+    return -1;
+#endif
+}
+
+int SPPClientSerial::peek() {
+#if SPP_SUPPORTED
+    return serial.peek();
+#else
+    return -1;
+#endif
+}
+
+size_t SPPClientSerial::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t SPPClientSerial::write(const uint8_t* buffer, size_t size) {
+#if SPP_SUPPORTED
+    size_t written = serial.write(buffer, size);
+    if (written > 0) {
+        RadioStats::countTx(Radio::BLE);
+    }
+    return written;
+#else
+    (void)buffer;
+    (void)size;
+    return 0;
+#endif
+}
+
+void SPPClientSerial::flush() {
+#if SPP_SUPPORTED
+    while (serial.available() > 0) {
+        serial.read();
+    }
+#endif
+}
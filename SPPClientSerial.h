@@ -0,0 +1,52 @@
+#ifndef SPP_CLIENT_SERIAL_H
+#define SPP_CLIENT_SERIAL_H
+
+#include <Arduino.h>
+#include "OBDTransport.h"
+#include "RadioStats.h"
+
+// Classic Bluetooth needs the original ESP32; the ESP32-S3 radio is BLE only
+#if defined(CONFIG_BT_CLASSIC_ENABLED)
+#define SPP_SUPPORTED 1
+#include <BluetoothSerial.h>
+#else
+#define SPP_SUPPORTED 0
+#endif
+
+// ELM327 over the classic Bluetooth serial port profile, for adapters such
+// as the OBDLink MX+. Like TCP it is a plain byte stream with no framing.
+// The address is the adapter's MAC; without one it is found by name. On
+// chips without classic Bluetooth begin() always fails.
+class SPPClientSerial : public OBDTransport {
+public:
+    SPPClientSerial();
+    ~SPPClientSerial();
+
+    const char* getName() const override { return "SPP"; }
+
+    bool begin(const char* name, const char* address) override;
+    bool connect(unsigned long timeout_ms) override;
+    bool isConnected(void) override;
+    void end(void) override;
+
+    int available(void) override;
+    int read(void) override;
+    int peek(void) override;
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* buffer, size_t size) override;
+    void flush(void) override;     // Drops unread input, as BLEClientSerial does
+
+private:
+    static constexpr size_t NAME_SIZE = 32;
+
+    char deviceName[NAME_SIZE];
+    uint8_t deviceAddress[6];
+    bool hasAddress;
+    bool started;
+    RadioLink radioLink;
+#if SPP_SUPPORTED
+    BluetoothSerial serial;
+#endif
+};
+
+#endif // SPP_CLIENT_SERIAL_H
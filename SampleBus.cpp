@@ -0,0 +1,61 @@
+#include "SampleBus.h"
+
+int SampleBus::subscribe(const char* name) {
+    if (subscriberCount >= Bus_Config::MAX_SUBSCRIBERS) {
+        LOG_ERROR_F("No free sample bus queue for %s", name);
+        return NO_SUBSCRIBER;
+    }
+
+    subscribers[subscriberCount].name = name;
+    LOG_DEBUG_F("Sample bus subscriber %d: %s", subscriberCount, name);
+    return subscriberCount++;
+}
+
+bool SampleBus::poll(int subscriber, VehicleSample& sample) {
+    if (subscriber < 0 || subscriber >= subscriberCount) {
+        return false;
+    }
+    return subscribers[subscriber].queue.pop(sample);
+}
+
+uint32_t SampleBus::getDropped(int subscriber) const {
+    if (subscriber < 0 || subscriber >= subscriberCount) {
+        return 0;
+    }
+    return subscribers[subscriber].dropped;
+}
+
+void SampleBus::publish(const VehicleSample& sample) {
+    if (sample.vehicle >= Vehicles::COUNT) {
+        return;
+    }
+
+    // Fold the fields of this pass into the vehicle's latest values
+    VehicleSample& latest = merged[sample.vehicle];
+    const VehicleData& data = sample.data;
+    for (int i = 0; i < Pids::COUNT; i++) {
+        if (data.validMask & (1 << i)) {
+            latest.data.raw[i] = data.raw[i];
+        }
+    }
+    latest.data.validMask |= data.validMask;
+    latest.data.capturedAt = data.capturedAt;
+    latest.vehicle = sample.vehicle;
+    latest.epoch = sample.epoch;
+    latestSamples[sample.vehicle].write(latest);
+
+    for (int i = 0; i < subscriberCount; i++) {
+        Subscriber& subscriber = subscribers[i];
+        if (!subscriber.queue.push(sample)) {
+            subscriber.dropped++;
+            LOG_WARNING_F("Sample bus: %s is behind, sample dropped", subscriber.name);
+        }
+    }
+}
+
+bool SampleBus::latest(int vehicle, VehicleSample& sample) const {
+    if (vehicle < 0 || vehicle >= Vehicles::COUNT) {
+        return false;
+    }
+    return latestSamples[vehicle].read(sample) > 0;
+}
@@ -0,0 +1,129 @@
+#ifndef SAMPLE_BUS_H
+#define SAMPLE_BUS_H
+
+#include <Arduino.h>
+#include <atomic>
+#include <time.h>
+#include "Config.h"
+#include "Logger.h"
+#include "OBDManager.h"
+
+// One pass over a vehicle's PIDs; data.validMask marks the fields read
+// and data.capturedAt is the millis() of the last one
+struct VehicleSample {
+    uint8_t vehicle = 0;            // Index into Vehicles::LIST
+    time_t epoch = 0;               // Wall clock time, 0 if the clock isn't set
+    VehicleData data;
+};
+
+// Single-producer single-consumer ring. push() and pop() may run on
+// different tasks/cores without locking; Size must be a power of two.
+template <typename T, size_t Size>
+class SpscQueue {
+    static_assert(Size >= 2 && (Size & (Size - 1)) == 0, "Size must be a power of two");
+
+public:
+    SpscQueue() : head(0), tail(0) {}
+
+    bool push(const T& item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) >= Size) {
+            return false;   // Full, the consumer is behind
+        }
+        items[h & (Size - 1)] = item;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = items[t & (Size - 1)];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t size() const {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+private:
+    T items[Size];
+    std::atomic<size_t> head;   // Written by the producer only
+    std::atomic<size_t> tail;   // Written by the consumer only
+};
+
+// Latest value with a sequence lock: one writer never waits, readers retry
+// until they copy a value that wasn't being written at the same time, so
+// a read is never torn. T must be trivially copyable.
+template <typename T>
+class Seqlock {
+public:
+    Seqlock() : sequence(0), value() {}
+
+    void write(const T& newValue) {
+        uint32_t s = sequence.load(std::memory_order_relaxed);
+        sequence.store(s + 1, std::memory_order_relaxed);   // Odd while writing
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(&value, &newValue, sizeof(T));
+        sequence.store(s + 2, std::memory_order_release);
+    }
+
+    // Returns the number of writes so far, 0 if nothing was written yet
+    uint32_t read(T& out) const {
+        uint32_t before, after;
+        do {
+            before = sequence.load(std::memory_order_acquire);
+            if (before & 1) {
+                continue;
+            }
+            memcpy(&out, &value, sizeof(T));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = sequence.load(std::memory_order_relaxed);
+        } while ((before & 1) || before != after);
+        return before / 2;
+    }
+
+private:
+    std::atomic<uint32_t> sequence;
+    T value;
+};
+
+// Publish/subscribe bus for vehicle samples. The OBD side publishes each
+// pass; every subscriber has its own queue and drains it on its own
+// schedule, and the latest value of every field is kept per vehicle for
+// consumers that only want a snapshot. A slow subscriber loses samples
+// (counted), it never blocks the producer or the other subscribers.
+//
+// publish() must only be called from one task.
+class SampleBus {
+public:
+    static const int NO_SUBSCRIBER = -1;
+
+    // Returns a subscriber id, NO_SUBSCRIBER if all queues are taken
+    int subscribe(const char* name);
+    bool poll(int subscriber, VehicleSample& sample);
+    uint32_t getDropped(int subscriber) const;
+
+    void publish(const VehicleSample& sample);
+
+    // Latest value of each field for a vehicle, validMask covering every
+    // field read so far; false if nothing was published for it yet
+    bool latest(int vehicle, VehicleSample& sample) const;
+
+private:
+    struct Subscriber {
+        const char* name = nullptr;
+        SpscQueue<VehicleSample, Bus_Config::QUEUE_DEPTH> queue;
+        uint32_t dropped = 0;
+    };
+
+    Subscriber subscribers[Bus_Config::MAX_SUBSCRIBERS];
+    int subscriberCount = 0;
+    Seqlock<VehicleSample> latestSamples[Vehicles::COUNT];
+    VehicleSample merged[Vehicles::COUNT];  // Producer's copy of the latest values
+};
+
+#endif // SAMPLE_BUS_H
@@ -0,0 +1,126 @@
+#include "TCPClientSerial.h"
+#include "Diagnostics.h"
+#include "RadioStats.h"
+#include "Logger.h"
+
+TCPClientSerial::TCPClientSerial()
+    : port(OBD::TCP_PORT), joinedAdapter(false), radioLink(Radio::WIFI) {
+    ssid[0] = '\0';
+    host[0] = '\0';
+}
+
+TCPClientSerial::~TCPClientSerial() {
+    end();
+}
+
+bool TCPClientSerial::begin(const char* name, const char* address) {
+    snprintf(ssid, sizeof(ssid), "%s", name ? name : "");
+
+    // "host[:port]", either part falling back to the defaults
+    const char* colon = address ? strchr(address, ':') : nullptr;
+    size_t hostLength = address ? (colon ? (size_t)(colon - address) : strlen(address)) : 0;
+    if (hostLength == 0) {
+        snprintf(host, sizeof(host), "%s", OBD::TCP_HOST);
+    } else {
+        snprintf(host, sizeof(host), "%.*s", (int)hostLength, address);
+    }
+    port = colon ? (uint16_t)strtoul(colon + 1, nullptr, 10) : OBD::TCP_PORT;
+    if (port == 0) {
+        port = OBD::TCP_PORT;
+    }
+
+    return joinNetwork();
+}
+
+bool TCPClientSerial::joinNetwork() {
+    const char* network = ssid[0] != '\0' ? ssid : WiFi_Config::SSID;
+    // Held until end(), even on a network MQTT already brought up
+    radioLink.acquire();
+    if (WiFi.status() == WL_CONNECTED && WiFi.SSID() == network) {
+        joinedAdapter = ssid[0] != '\0';
+        return true;
+    }
+
+    if (WiFi.status() == WL_CONNECTED) {
+        LOG_WARNING_F("Leaving WiFi %s for the adapter's network, MQTT and commands pause until it is read",
+                      WiFi.SSID().c_str());
+    }
+    LOG_INFO_F("Joining WiFi %s for the OBD adapter...", network);
+    WiFi.mode(WIFI_STA);
+    if (ssid[0] != '\0') {
+        WiFi.begin(ssid, OBD::ADAPTER_WIFI_PASSWORD);
+    } else {
+        WiFi.begin(WiFi_Config::SSID, WiFi_Config::PASSWORD);
+    }
+
+    unsigned long startTime = millis();
+    while (WiFi.status() != WL_CONNECTED) {
+        if (millis() - startTime > Timeouts::ADAPTER_WIFI_JOIN) {
+            LOG_ERROR_F("WiFi %s not reachable", network);
+            Diagnostics::record(Stage::WIFI_CONNECT, startTime, StageResult::TIMEOUT);
+            WiFi.disconnect(true);
+            WiFi.mode(WIFI_OFF);
+            radioLink.release();
+            return false;
+        }
+        delay(100);
+    }
+    Diagnostics::record(Stage::WIFI_CONNECT, startTime, StageResult::SUCCESS);
+    joinedAdapter = ssid[0] != '\0';
+    return true;
+}
+
+bool TCPClientSerial::connect(unsigned long timeout_ms) {
+    LOG_INFO_F("Connecting to %s:%u...", host, port);
+    if (!client.connect(host, port, (int32_t)timeout_ms)) {
+        return false;
+    }
+    client.setNoDelay(true);
+    return true;
+}
+
+bool TCPClientSerial::isConnected() {
+    return client.connected();
+}
+
+void TCPClientSerial::end() {
+    client.stop();
+
+    // Back off the adapter's network so publishing can rejoin the home one
+    if (joinedAdapter) {
+        WiFi.disconnect(true);
+        WiFi.mode(WIFI_OFF);
+        joinedAdapter = false;
+    }
+    radioLink.release();
+}
+
+int TCPClientSerial::available() {
+    return client.available();
+}
+
+int TCPClientSerial::read() {
+    return client.read();
+}
+
+int TCPClientSerial::peek() {
+    return client.peek();
+}
+
+size_t TCPClientSerial::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t TCPClientSerial::write(const uint8_t* buffer, size_t size) {
+    size_t written = client.write(buffer, size);
+    if (written > 0) {
+        RadioStats::countTx(Radio::WIFI);
+    }
+    return written;
+}
+
+void TCPClientSerial::flush() {
+    while (client.available() > 0) {
+        client.read();
+    }
+}
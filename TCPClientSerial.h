@@ -0,0 +1,52 @@
+#ifndef TCP_CLIENT_SERIAL_H
+#define TCP_CLIENT_SERIAL_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include "OBDTransport.h"
+#include "RadioStats.h"
+
+// ELM327 over a TCP socket, for WiFi adapters. Responses arrive as a plain
+// byte stream, usually in one segment, so there is no framing and no
+// per-byte write delay as over BLE; Nagle is turned off so each command
+// goes out at once.
+//
+// begin() joins the network the adapter is on: its own access point when
+// a name (SSID) is given, otherwise the WiFi network in WiFi_Config. An
+// adapter access point is left again in end(), which hands the radio back
+// to MQTTNetworkManager for publishing.
+class TCPClientSerial : public OBDTransport {
+public:
+    TCPClientSerial();
+    ~TCPClientSerial();
+
+    const char* getName() const override { return "TCP"; }
+
+    bool begin(const char* name, const char* address) override;
+    bool connect(unsigned long timeout_ms) override;
+    bool isConnected(void) override;
+    void end(void) override;
+    bool takesWiFi(void) const override { return joinedAdapter; }
+
+    int available(void) override;
+    int read(void) override;
+    int peek(void) override;
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* buffer, size_t size) override;
+    void flush(void) override;     // Drops unread input, as BLEClientSerial does
+
+private:
+    static constexpr size_t SSID_SIZE = 33;
+    static constexpr size_t HOST_SIZE = 40;
+
+    WiFiClient client;
+    char ssid[SSID_SIZE];          // Adapter access point, empty for the home network
+    char host[HOST_SIZE];
+    uint16_t port;
+    bool joinedAdapter;            // WiFi is on the adapter's access point
+    RadioLink radioLink;
+
+    bool joinNetwork(void);
+};
+
+#endif // TCP_CLIENT_SERIAL_H
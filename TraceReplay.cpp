@@ -0,0 +1,129 @@
+#include "TraceReplay.h"
+
+TraceReplay::TraceReplay(float speed) 
+    : hasPending(false), speed(speed), commandLength(0), anchorTraceMs(0), anchorMillis(0),
+      commandCount(0), mismatches(0), notifications(0) {
+    command[0] = '\0';
+}
+
+TraceReplay::~TraceReplay() {
+    close();
+}
+
+bool TraceReplay::open(const char* path) {
+    if (!reader.open(path)) {
+        return false;
+    }
+    
+    serial.flush();
+    commandLength = 0;
+    advance();
+    
+    // Anything recorded before the first write (connect, unsolicited
+    // adapter output) is delivered straight away
+    anchorTraceMs = hasPending ? pending.timeMs : 0;
+    anchorMillis = millis();
+    return true;
+}
+
+void TraceReplay::close() {
+    reader.close();
+    hasPending = false;
+}
+
+void TraceReplay::advance() {
+    hasPending = reader.next(pending);
+}
+
+void TraceReplay::pump() {
+    // Deliver recorded notifications that are due; a recorded write stops
+    // delivery until the host sends its next command
+    while (hasPending && pending.event != TraceEvent::WRITE) {
+        if (pending.event == TraceEvent::NOTIFY) {
+            if (speed > 0.0f) {
+                unsigned long dueAt = anchorMillis + (unsigned long)((pending.timeMs - anchorTraceMs) / speed);
+                if ((long)(millis() - dueAt) < 0) {
+                    return;
+                }
+            }
+            serial.ingest(pending.data, pending.length);
+            notifications++;
+        }
+        advance();
+    }
+}
+
+int TraceReplay::available() {
+    pump();
+    return serial.available();
+}
+
+int TraceReplay::read() {
+    pump();
+    return serial.read();
+}
+
+int TraceReplay::peek() {
+    pump();
+    return serial.peek();
+}
+
+size_t TraceReplay::write(uint8_t c) {
+    if (c == '\r') {
+        command[commandLength] = '\0';
+        handleCommand();
+        commandLength = 0;
+        return 1;
+    }
+    
+    if (commandLength < COMMAND_SIZE - 1) {
+        command[commandLength++] = c;
+    }
+    return 1;
+}
+
+void TraceReplay::flush() {
+    // Nothing buffered on the transmit side
+}
+
+void TraceReplay::handleCommand() {
+    commandCount++;
+    
+    // Notifications the host didn't wait for are delivered now, as they
+    // would have been sitting in the receive buffer
+    while (hasPending && pending.event != TraceEvent::WRITE) {
+        if (pending.event == TraceEvent::NOTIFY) {
+            serial.ingest(pending.data, pending.length);
+            notifications++;
+        }
+        advance();
+    }
+    
+    // Frames that follow belong to this command
+    serial.markRequest();
+    
+    // Collect the recorded command, which may span several writes
+    char recorded[COMMAND_SIZE];
+    size_t recordedLength = 0;
+    bool complete = false;
+    while (hasPending && pending.event == TraceEvent::WRITE && !complete) {
+        for (uint8_t i = 0; i < pending.length; i++) {
+            if (pending.data[i] == '\r') {
+                complete = true;
+                break;
+            }
+            if (recordedLength < COMMAND_SIZE - 1) {
+                recorded[recordedLength++] = (char)pending.data[i];
+            }
+        }
+        anchorTraceMs = pending.timeMs;
+        advance();
+    }
+    recorded[recordedLength] = '\0';
+    anchorMillis = millis();
+    
+    if (strcmp(recorded, command) != 0) {
+        mismatches++;
+        LOG_DEBUG_F("Replay mismatch: sent %s, recorded %s", command, recorded);
+    }
+}
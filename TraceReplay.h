@@ -0,0 +1,59 @@
+#ifndef TRACE_REPLAY_H
+#define TRACE_REPLAY_H
+
+#include <Arduino.h>
+#include "Stream.h"
+#include "BLETrace.h"
+#include "BLEClientSerial.h"
+
+// Replays a recorded BLE trace as the adapter side of an ELM327 stream.
+// Each command the host sends is matched against the next recorded write,
+// then the notifications that followed it in the recording are fed through
+// BLEClientSerial's receive path at their original spacing divided by
+// 'speed' (0 delivers them immediately). Commands that differ from the
+// recording are counted as mismatches but still answered from the trace.
+class TraceReplay : public Stream {
+public:
+    explicit TraceReplay(float speed = 1.0f);
+    ~TraceReplay();
+    
+    bool open(const char* path);
+    void close();
+    
+    // True once every recorded record has been delivered
+    bool isFinished() const { return !hasPending; }
+    unsigned long getCommandCount() const { return commandCount; }
+    unsigned long getMismatches() const { return mismatches; }
+    unsigned long getNotifications() const { return notifications; }
+    
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t write(uint8_t c) override;
+    void flush() override;
+    using Print::write;
+    
+private:
+    static constexpr size_t COMMAND_SIZE = 32;
+    
+    TraceReader reader;
+    TraceRecord pending;
+    bool hasPending;
+    BLEClientSerial serial;     // Receive path under test
+    float speed;
+    
+    char command[COMMAND_SIZE];
+    size_t commandLength;
+    uint32_t anchorTraceMs;     // Trace time of the recorded write being answered
+    unsigned long anchorMillis; // When the host sent the matching command
+    
+    unsigned long commandCount;
+    unsigned long mismatches;
+    unsigned long notifications;
+    
+    void advance();
+    void pump();
+    void handleCommand();
+};
+
+#endif // TRACE_REPLAY_H
@@ -0,0 +1,90 @@
+#ifndef VEHICLE_PROFILES_H
+#define VEHICLE_PROFILES_H
+
+#include <Arduino.h>
+#include "Config.h"
+
+// Compile-time vehicle profiles. Each profile is a policy type giving the
+// OBD protocol, the ECU each DID is requested from, the DIDs read and how
+// each response is decoded. Each vehicle in Vehicles::LIST names its model,
+// and OBDManager::create() gives it the BasicOBDManager of that profile, so
+// the commands are constants and the decoders inline into the reads.
+//
+// Decoders take the first two data bytes after the DID (A, B). Headers are
+// 11-bit request IDs; the ECU answers on the ID + 8.
+// A profile provides:
+//   NAME, MODEL, PROTOCOL, DATA_OFFSET
+//   CMD_SOC, CMD_TEMP, CMD_VOLTAGE, CMD_TOTAL_CHARGES, CMD_KWH_CHARGED, CMD_KWH_DISCHARGED
+//   HEADER_SOC, HEADER_TEMP, HEADER_VOLTAGE, HEADER_TOTAL_CHARGES, HEADER_KWH_CHARGED, HEADER_KWH_DISCHARGED
+//   decodeSoc, decodeTemp, decodeVoltage, decodeTotalCharges, decodeKwhCharged, decodeKwhDischarged
+
+// BYD e-Platform 3.0. Every DID read so far is on the battery management
+// system; values from other ECUs only need their header set to that ECU
+struct BydEPlatform3Profile {
+    static constexpr const char* PROTOCOL = "ATSP6";    // ISO 15765-4 CAN (11 bit ID, 500 kbaud)
+    static constexpr uint16_t ECU_BMS = 0x7E7;          // Answers on 7EF
+
+    // Headers on, spaces off: "7EF" + length + "62" + DID, then the data
+    static constexpr uint8_t DATA_OFFSET = 11;
+
+    static constexpr const char* CMD_SOC = "221FFC";
+    static constexpr const char* CMD_TEMP = "220032";
+    static constexpr const char* CMD_VOLTAGE = "220008";
+    static constexpr const char* CMD_TOTAL_CHARGES = "22000B";
+    static constexpr const char* CMD_KWH_CHARGED = "220011";
+    static constexpr const char* CMD_KWH_DISCHARGED = "220012";
+
+    static constexpr uint16_t HEADER_SOC = ECU_BMS;
+    static constexpr uint16_t HEADER_TEMP = ECU_BMS;
+    static constexpr uint16_t HEADER_VOLTAGE = ECU_BMS;
+    static constexpr uint16_t HEADER_TOTAL_CHARGES = ECU_BMS;
+    static constexpr uint16_t HEADER_KWH_CHARGED = ECU_BMS;
+    static constexpr uint16_t HEADER_KWH_DISCHARGED = ECU_BMS;
+
+    static float decodeSoc(int A, int B) { return float(A + B * 256) / 100.0f; }
+    static float decodeTemp(int A, int) { return float(A) - 40.0f; }
+    static float decodeVoltage(int A, int B) { return float(A + B * 256); }
+    static float decodeTotalCharges(int A, int B) { return float(A + B * 256); }
+    static float decodeKwhCharged(int A, int B) { return float(A + B * 256); }
+    static float decodeKwhDischarged(int A, int B) { return float(A + B * 256); }
+};
+
+struct SealProfile : BydEPlatform3Profile {
+    static constexpr const char* NAME = "BYD Seal";
+    static constexpr VehicleModel MODEL = VehicleModel::SEAL;
+};
+
+// Same BMS as the Seal. The DIDs are assumed to match and have not been
+// checked against a car; override whatever turns out to differ here
+struct Atto3Profile : BydEPlatform3Profile {
+    static constexpr const char* NAME = "BYD Atto 3";
+    static constexpr VehicleModel MODEL = VehicleModel::ATTO3;
+};
+
+// Calls f with a value of the profile type for model. The one list of the
+// profiles built into the firmware: a new one (e.g. the Dolphin) gets a
+// VehicleModel value and a case here
+template <typename F>
+auto visitProfile(VehicleModel model, F&& f) {
+    switch (model) {
+        case VehicleModel::ATTO3: return f(Atto3Profile{});
+        case VehicleModel::SEAL:
+        default: return f(SealProfile{});
+    }
+}
+
+// The profile's decoder for a Pids bit
+template <typename Profile>
+float decodePid(uint8_t pid, int A, int B) {
+    switch (pid) {
+        case Pids::SOC: return Profile::decodeSoc(A, B);
+        case Pids::TEMP: return Profile::decodeTemp(A, B);
+        case Pids::VOLTAGE: return Profile::decodeVoltage(A, B);
+        case Pids::TOTAL_CHARGES: return Profile::decodeTotalCharges(A, B);
+        case Pids::KWH_CHARGED: return Profile::decodeKwhCharged(A, B);
+        case Pids::KWH_DISCHARGED: return Profile::decodeKwhDischarged(A, B);
+        default: return 0.0f;
+    }
+}
+
+#endif // VEHICLE_PROFILES_H
@@ -3,11 +3,30 @@
 
 #include "arduino_secrets.h"
 
+// Firmware version (reported in logs and diagnostics)
+#define FIRMWARE_VERSION "2.0.0"
+
 // Debug Configuration
 #define DEBUG_ENABLED true
 #define DEBUG_PORT Serial
 #define DEBUG_BAUD_RATE 115200
 
+// Benchmark Configuration
+// When enabled the benchmark suite runs once at startup and prints one JSON
+// result per line to the debug port (see Benchmark.h)
+#define BENCHMARK_ENABLED false
+
+// BLE Trace Configuration
+// When enabled every GATT notification and write is recorded with its
+// timestamp into a binary trace (see BLETrace.h) that the benchmark suite
+// can replay through the receive path
+#define BLE_TRACE_ENABLED false
+
+// LAN Server Configuration
+// When enabled the latest values are served on the local network over
+// HTTP (/state) and a WebSocket stream (/stream), see LANServer.h
+#define LAN_SERVER_ENABLED false
+
 // LED Configuration (for devices with RGB LEDs like M5Stack AtomS3 Lite)
 // Set ENABLE_LED to false if your device doesn't have an RGB LED
 #define LED_ENABLED true
@@ -18,9 +37,22 @@
 namespace Timeouts {
     constexpr unsigned long ELM_CONNECTION = 30000;
     constexpr unsigned long ELM_INIT = 15000;
-    constexpr unsigned long ELM_COMMAND = 10000;
+    constexpr unsigned long ELM_COMMAND = 10000;     // Per-PID limit until its latency is learned
+    constexpr unsigned long ELM_COMMAND_MIN = 300;   // Floor for learned PID timeouts
     constexpr unsigned long NTP_SYNC = 10000;
     constexpr unsigned long BLE_CONNECTION = 15000;
+    constexpr unsigned long BLE_SCAN = 5000;   // Upper bound, the scan stops on the first match
+    constexpr unsigned long TCP_CONNECTION = 5000;
+    constexpr unsigned long ADAPTER_WIFI_JOIN = 15000;  // Joining a WiFi adapter's access point
+}
+
+// Asleep Check (see OBDManager::checkAwake)
+// With the car on, the DC-DC converter holds the 12 V system well above a
+// resting battery; below AWAKE_VOLTAGE one short request decides
+namespace Sleep_Config {
+    const float AWAKE_VOLTAGE = 13.5;           // V at the OBD port
+    const unsigned long PROBE_TIMEOUT = 1000;   // ms for ATRV and the probe request
+    const unsigned long POLL_INTERVAL = 300000; // A sleeping car is checked again after this, no backoff
 }
 
 // Update Intervals (ms)
@@ -37,20 +69,121 @@ namespace MQTT {
     const char* const USER = SECRET_MQTT_USER;
     const char* const PASS = SECRET_MQTT_PASS;
     
+    // Device-wide topics are published under DEVICE_PREFIX, vehicle topics
+    // under the vehicle's own prefix (see Vehicles below) as "<prefix>/<topic>"
+    const char* const DEVICE_PREFIX = "bydseal";
+    const size_t MAX_TOPIC_LENGTH = 64;
+    
     // Topics
-    const char* const TOPIC_SOC = "bydseal/soc";
-    const char* const TOPIC_TEMP = "bydseal/battery_temp";
-    const char* const TOPIC_VOLTAGE = "bydseal/battery_voltage";
-    const char* const TOPIC_STATUS = "bydseal/status";
-    const char* const TOPIC_LAST_UPDATE = "bydseal/last_update";
-    const char* const TOPIC_CHARGES_UPDATE = "bydseal/total_charges";
-    const char* const TOPIC_KWH_CHARGED_UPDATE = "bydseal/kwh_charged";
-    const char* const TOPIC_KWH_DISCHARGED_UPDATE = "bydseal/kwh_discharged";
+    const char* const TOPIC_SOC = "soc";
+    const char* const TOPIC_TEMP = "battery_temp";
+    const char* const TOPIC_VOLTAGE = "battery_voltage";
+    const char* const TOPIC_STATUS = "status";
+    const char* const TOPIC_LAST_UPDATE = "last_update";
+    const char* const TOPIC_CHARGES_UPDATE = "total_charges";
+    const char* const TOPIC_KWH_CHARGED_UPDATE = "kwh_charged";
+    const char* const TOPIC_KWH_DISCHARGED_UPDATE = "kwh_discharged";
+    const char* const TOPIC_DIAG = "diag";
+    const char* const TOPIC_HEAP = "heap";
+    const char* const TOPIC_CMD = "cmd";
+    const char* const TOPIC_CURRENT = "battery_current";    // Monitor mode only
+    const char* const TOPIC_METRICS = "metrics";
+    const char* const TOPIC_RADIO = "radio";
+    const char* const TOPIC_CHARGE_SESSION = "charge_session";  // Binary, see ChargeCapture.h
     
     const bool RETAIN = true;
     const int QOS = 1;
 }
 
+// MQTT Command Channel
+// Commands sent to "<prefix>/cmd" (plain text, see readme):
+//   read [soc,battery_temp,...]   read now, all PIDs if none are listed
+//   interval <seconds>            change the update interval, 0 restores the default
+//   burst <seconds> <duration>    read every <seconds> for <duration> seconds, "burst stop" ends it
+//   monitor <duration>            passively monitor broadcast frames, "monitor stop" ends it
+// Commands can only arrive while connected, so with the channel enabled WiFi
+// and MQTT stay up during the wait cycle.
+namespace Commands {
+    const bool ENABLED = true;
+    const size_t MAX_LENGTH = 96;
+    const int QUEUE_SIZE = 4;
+    const unsigned long MIN_INTERVAL = 10000;           // Shortest accepted update interval (ms)
+    const unsigned long MAX_INTERVAL = 86400000;        // Longer update intervals are capped at a day (ms)
+    const unsigned long MIN_BURST_INTERVAL = 1000;      // Shortest burst read period (ms)
+    const unsigned long MAX_BURST_DURATION = 600000;    // Bursts end after at most 10 minutes
+}
+
+// Adaptive PID Timeouts (see AdaptiveTimeout.h)
+namespace Adaptive_Config {
+    const uint16_t MIN_SAMPLES = 3;           // Responses needed before the learned timeout is used
+    const float MEAN_GAIN = 0.125f;           // EWMA gains, as in TCP's RTO estimator
+    const float DEVIATION_GAIN = 0.25f;
+    const float DEVIATIONS = 4.0f;            // Limit = mean + DEVIATIONS * deviation
+    const uint8_t MAX_BACKOFF = 4;            // Timeouts double the limit, up to 16x
+    const unsigned long HOST_MARGIN = 200;    // Host waits this much past the adapter's ATST
+    const unsigned long RESPONSE_POLL_MS = 5; // Receive polling period while waiting for a response
+    
+    // ATST is programmed in 4 ms units; never below ATST_MIN, default from INIT_COMMANDS
+    const unsigned long ATST_UNIT_MS = 4;
+    const uint8_t ATST_MIN = 0x19;            // 100 ms
+    const uint8_t ATST_DEFAULT = 0x96;        // 600 ms
+}
+
+// BLE Trace Configuration
+namespace Trace_Config {
+    enum class Sink : uint8_t {
+        FLASH,      // Appended to FILE_PATH on LittleFS
+        SERIAL_HEX  // Printed to the debug port as "#TRACE <hex>" lines
+    };
+    
+    const Sink SINK = Sink::FLASH;
+    const char* const FILE_PATH = "/ble.trace";
+    const size_t MAX_FILE_SIZE = 262144;     // Recording stops once the file reaches this
+    const size_t BUFFER_SIZE = 4096;         // Per half of the double buffer
+    const bool CLEAR_ON_BOOT = false;        // Start a new trace every boot instead of appending
+}
+
+// Diagnostics Configuration
+namespace Diag_Config {
+    const unsigned long PUBLISH_EVERY_CYCLES = 12;  // ~1 hour at the normal update interval
+}
+
+// Power Estimate (see RadioStats.h)
+// Average supply current at 5 V by activity, in line with the figures in
+// the readme; measure the device and adjust before relying on the mAh values
+namespace Power_Config {
+    const float BASE_MA = 20.0;             // Radios idle (always counted)
+    const float BLE_SCAN_MA = 80.0;         // Extra while scanning (window == interval)
+    const float BLE_CONNECTED_MA = 60.0;    // Extra while connected to the adapter
+    const float WIFI_MA = 80.0;             // Extra while associated
+    const unsigned long DAY_MS = 86400000;
+    const size_t MESSAGE_SIZE = 320;
+}
+
+// Sample Bus (see SampleBus.h)
+namespace Bus_Config {
+    const size_t QUEUE_DEPTH = 8;           // Samples per subscriber, power of two
+    const int MAX_SUBSCRIBERS = 4;
+}
+
+// LAN Server (see LANServer.h)
+namespace Lan_Config {
+    const uint16_t PORT = 80;
+    const int MAX_SOCKETS = 2;                  // WebSocket stream clients
+    const unsigned long REQUEST_TIMEOUT = 500;  // ms to receive a request's headers
+    const size_t LINE_SIZE = 128;               // Longer header lines are cut, only a few are read
+    const size_t FRAME_SIZE = 160;              // Largest client frame; control frames carry 125 bytes at most
+    const size_t MESSAGE_SIZE = 256;
+}
+
+// Derived metrics (see MetricsEngine.h)
+namespace Metrics_Config {
+    const unsigned long MAX_SAMPLE_GAP = 3600;  // s, no charge power across longer gaps
+    const float MIN_CAPACITY_SOC_SPAN = 20.0;   // % charged in one session to estimate capacity
+    const float CAPACITY_GAIN = 0.25;           // Weight of each new capacity estimate
+    const size_t MESSAGE_SIZE = 192;
+}
+
 // WiFi Configuration
 namespace WiFi_Config {
     const char* const SSID = SECRET_SSID;
@@ -63,39 +196,180 @@ namespace NTP {
     const char* const SERVER2 = "time.nist.gov";
     const char* const SERVER3 = "time.google.com";
     const char* const TIMEZONE = "AEST-10AEDT,M10.1.0,M4.1.0/3";
-    const int MAX_RETRY = 15;
+    const int MAX_RETRY = 15;                              // Seconds to wait for the very first sync
+    const unsigned long RESYNC_TIMEOUT = 5000;             // Background resync must answer within (ms)
+    
+    // Resync only when the clock's expected error exceeds MAX_ERROR_MS
+    const unsigned long MAX_ERROR_MS = 1000;
+    const unsigned long MAX_SYNC_AGE = 86400000;           // Resync at least daily (ms)
+    const unsigned long SYNC_ACCURACY_MS = 100;            // Error right after a sync
+    const float DEFAULT_DRIFT_PPM = 50.0f;                 // Assumed until measured
+    const unsigned long MIN_DRIFT_INTERVAL = 600000;       // Shortest span used to measure drift (ms)
 }
 
 // OBD Configuration
+// Link to the OBD adapter (see OBDTransport.h), chosen per vehicle
+enum class Transport : uint8_t {
+    BLE,    // BLE serial service, e.g. OBDLink CX
+    TCP,    // ELM327 over WiFi, e.g. OBDLink MX WiFi or a WiFi dongle
+    SPP     // Classic Bluetooth serial, e.g. OBDLink MX+; not on the ESP32-S3
+};
+
 namespace OBD {
     const char* const DEVICE_NAME = "OBDLink CX";
+    const char* const DEVICE_ADDRESS = "";  // Optional adapter MAC, e.g. "00:04:3e:12:34:56"
+    constexpr Transport TRANSPORT = Transport::BLE;     // Default for vehicles that don't set one
+    
+    // WiFi adapters: TCP port when the address doesn't give one, and the
+    // password of the adapter's access point (most are open)
+    const char* const TCP_HOST = "192.168.0.10";
+    const uint16_t TCP_PORT = 35000;
+    const char* const ADAPTER_WIFI_PASSWORD = "";
+    
+    // BLE scan duty cycle (window / interval is the fraction of time spent listening)
+    const uint16_t SCAN_INTERVAL_MS = 100;
+    const uint16_t SCAN_WINDOW_MS = 100;
+    const bool SCAN_ACTIVE = true;          // Request scan responses, needed to see the device name
     const int MAX_BT_TIMEOUTS = 2;
+    const unsigned long RESYNC_WAIT = 250;  // After the host gives up, time left for the answer to finish
     
-    // OBD Commands
-    const char* const CMD_SOC = "221FFC";
-    const char* const CMD_TEMP = "220032";
-    const char* const CMD_VOLTAGE = "220008";
-    const char* const CMD_TOTALCHARGES = "22000B"; // A + B*256 - 22000B
-    const char* const CMD_TOTALKWHCHARGE = "220011";
-    const char* const CMD_TOTALKWHDISCHARGE = "220012";
-
-    // ELM327 Initialization Commands
+    // ELM327 Initialization Commands, followed by the profile's protocol.
+    // The ECU header is set per PID as the reads need it
     inline const char* INIT_COMMANDS[] = {
         "ATZ",      // Reset
         "ATD",      // Set defaults
         "ATD0",     // Set defaults (no echo)
         "ATH1",     // Headers on
-        "ATSP6",    // Set protocol to ISO 15765-4 CAN (11 bit ID, 500 kbaud)
         "ATE0",     // Echo off
         "ATM0",     // Memory off
         "ATS0",     // Spaces off
         "ATAT1",    // Adaptive timing on
         "ATAL",     // Allow long messages
         "STCSEGT1", // Custom timing
-        "ATST96",   // Set timeout
-        "ATSH7E7"   // Set header
+        "ATST96"    // Set timeout
+    };
+    const int INIT_COMMANDS_COUNT = 11;
+}
+
+// Passive Monitor Configuration (STN adapters such as the OBDLink CX)
+// Instead of polling PIDs, the adapter is told to pass only the BMS
+// broadcast IDs below (STFAP) and stream them (STM); no requests are sent,
+// so no ECU is woken and there is no round trip per value.
+enum class MonitorField : uint8_t {
+    SOC,
+    VOLTAGE,
+    CURRENT,
+    COUNT
+};
+
+namespace Monitor_Config {
+    struct Signal {
+        uint16_t canId;         // 11-bit broadcast ID
+        uint8_t startByte;      // First data byte of the value
+        uint8_t length;         // 1 or 2 bytes
+        bool bigEndian;
+        bool isSigned;
+        float scale;            // value = raw * scale + offset
+        float offset;
+        MonitorField field;
     };
-    const int INIT_COMMANDS_COUNT = 13;
+    
+    // The Seal's BMS broadcast layouts are not documented, so none ship and
+    // the monitor command is refused until some are added: capture the bus
+    // with "STMA", find the frames carrying each value and replace the two
+    // lines below with a table like
+    //   inline const Signal SEAL_SIGNALS[] = {
+    //       { 0x123, 0, 2, false, false, 0.01f, 0.0f, MonitorField::SOC },
+    //   };
+    //   inline const Signal* const SIGNALS = SEAL_SIGNALS;
+    //   constexpr int SIGNAL_COUNT = sizeof(SEAL_SIGNALS) / sizeof(SEAL_SIGNALS[0]);
+    // Decoded values are published to the same topics as the polled ones.
+    inline const Signal* const SIGNALS = nullptr;
+    constexpr int SIGNAL_COUNT = 0;
+    
+    const unsigned long PUBLISH_INTERVAL = 5000;     // Latest values are published this often (ms)
+    const unsigned long MAX_DURATION = 3600000;      // A monitor session ends after at most 1 hour
+    const unsigned long STOP_TIMEOUT = 2000;         // Wait for the prompt after interrupting STM
+    const size_t MAX_LINE = 32;                      // "ID" + 8 data bytes in hex, with room to spare
+}
+
+// PID selection masks, used to read only some values on demand
+namespace Pids {
+    constexpr uint8_t SOC = 1 << 0;
+    constexpr uint8_t TEMP = 1 << 1;
+    constexpr uint8_t VOLTAGE = 1 << 2;
+    constexpr uint8_t TOTAL_CHARGES = 1 << 3;
+    constexpr uint8_t KWH_CHARGED = 1 << 4;
+    constexpr uint8_t KWH_DISCHARGED = 1 << 5;
+    constexpr uint8_t ALL = 0x3F;
+    constexpr int COUNT = 6;
+    
+    // Position of a PID's bit, used to index per-PID arrays
+    constexpr int indexOf(uint8_t pid) { return __builtin_ctz(pid); }
+}
+
+// Custom PIDs loaded at boot (see CustomPids.h)
+namespace Custom_Config {
+    const char* const FILE_PATH = "/pids.csv";
+    constexpr int MAX_PIDS = 16;                // At most 32, read masks are 32 bit
+    constexpr size_t MAX_TOPIC = 24;
+    constexpr size_t MAX_COMMAND = 12;
+    constexpr size_t LINE_SIZE = 128;
+    constexpr int MAX_CODE = 48;                // Bytecode bytes per formula
+    constexpr int MAX_CONSTANTS = 8;            // Numbers per formula
+    constexpr int MAX_STACK = 8;                // Evaluation stack depth
+    constexpr int MAX_NESTING = 8;              // Brackets and unary minus, bounds the parser's recursion
+}
+
+// Charge curve capture (see ChargeCapture.h)
+namespace Charge_Config {
+    constexpr uint8_t PIDS = Pids::SOC | Pids::VOLTAGE | Pids::TEMP;
+    const unsigned long SAMPLE_INTERVAL = 1000;     // ms between reads while charging, doubles as the buffer fills
+    const uint8_t START_PASSES = 2;                 // Reads with SoC up on the one before, none lower...
+    const float START_SOC_RISE = 0.5;               // ...and at least this much gained over them (%) start a session
+    const unsigned long CONFIRM_INTERVAL = 30000;   // ms between reads after the first rise, until a session starts
+    const unsigned long CONFIRM_WINDOW = 300000;    // A rise not followed by another within this (ms) is dropped
+    const unsigned long END_IDLE = 600000;          // Session ends after SoC stays flat this long (ms)
+    const uint16_t MAX_SAMPLES = 2048;              // 10 bytes each
+    const uint16_t MIN_SAMPLES = 10;                // Shorter sessions are dropped, as are those gaining less than START_SOC_RISE
+    const uint8_t MAX_UPLOAD_ATTEMPTS = 5;          // Failed uploads after which a new session may replace the old one
+}
+
+// Vehicle Configuration
+// One entry per car, each with its own OBD adapter. All vehicles share the
+// radios and are polled one after another; a car that can't be reached
+// is retried on its own schedule without holding up the others.
+//
+// deviceName and deviceAddress depend on the transport:
+//   BLE, SPP  Bluetooth name, and MAC (empty to match by service/name)
+//   TCP       SSID of the adapter's access point (empty if the adapter is
+//             on the WiFi network above), and "host[:port]" (empty for
+//             OBD::TCP_HOST and OBD::TCP_PORT)
+// Car model, selecting the compile-time profile (protocol, ECU headers,
+// DIDs and decoders) its reads use, see VehicleProfiles.h
+enum class VehicleModel : uint8_t {
+    SEAL,
+    ATTO3
+};
+
+struct VehicleConfig {
+    const char* name;           // Used in logs
+    const char* deviceName;
+    const char* deviceAddress;
+    const char* topicPrefix;    // MQTT prefix for this car's topics
+    float capacityKwh;          // Nominal usable pack capacity, for derived metrics
+    VehicleModel model = VehicleModel::SEAL;
+    Transport transport = OBD::TRANSPORT;
+};
+
+namespace Vehicles {
+    inline const VehicleConfig LIST[] = {
+        { "Seal", OBD::DEVICE_NAME, OBD::DEVICE_ADDRESS, MQTT::DEVICE_PREFIX, 82.5f },
+        // { "Seal 2", "OBDLink CX", "00:04:3e:12:34:56", "bydseal2", 61.4f },
+        // { "Atto 3", "OBDII", "", "bydatto3", 60.5f, VehicleModel::ATTO3 },
+        // { "Seal 3", "WiFi_OBDII", "192.168.0.10:35000", "bydseal3", 82.5f, VehicleModel::SEAL, Transport::TCP },
+    };
+    constexpr int COUNT = sizeof(LIST) / sizeof(LIST[0]);
 }
 
 // Application States
@@ -107,16 +381,50 @@ enum class AppState {
     OBD_CHARGE_TIMES,
     OBD_TOTAL_CHARGED_KWH,
     OBD_TOTAL_DISCHARGED_KWH,
+    OBD_READ_CUSTOM,
     WIFI_CONNECT,
     NTP_SYNC,
     MQTT_CONNECT,
     MQTT_PUBLISH,
-    WAIT_CYCLE
+    WAIT_CYCLE,
+    OBD_MONITOR
 };
 
+// Failure classes, each retried with its own backoff policy
+enum class FailureType : uint8_t {
+    NOT_FOUND,      // Adapter not advertising, car most likely away
+    CONNECT,        // BLE connect or ELM327 init failed
+    NO_RESPONSE,    // Adapter up but the ECU is silent, car asleep
+    PARTIAL,        // Some PIDs failed, the rest were read
+    NETWORK,        // WiFi or MQTT unavailable
+    COUNT
+};
+
+// Retry Backoff (see Backoff.h)
+// Delay after the n-th consecutive failure is drawn uniformly from
+// [base, min(cap, base * 2^(n-1))]
+namespace Backoff_Config {
+    struct Policy {
+        unsigned long baseMs;
+        unsigned long capMs;
+    };
+    
+    // Indexed by FailureType
+    inline const Policy POLICIES[] = {
+        { Intervals::ERROR_RETRY, 1800000 },       // NOT_FOUND: up to 30 minutes
+        { 30000, 600000 },                         // CONNECT: up to 10 minutes
+        { Intervals::ERROR_RETRY, 1800000 },       // NO_RESPONSE: up to 30 minutes
+        { 30000, Intervals::NORMAL_UPDATE },       // PARTIAL: never later than a normal update
+        { 15000, 600000 },                         // NETWORK: up to 10 minutes
+    };
+}
+
 // Error Messages
 namespace ErrorMessages {
     const char* const BLE_TIMEOUT = "ELM_BLE_CONNECTION_TIMEOUT";
+    const char* const BLE_NOT_FOUND = "ELM_BLE_NOT_FOUND";
+    const char* const ADAPTER_TIMEOUT = "ELM_ADAPTER_CONNECTION_TIMEOUT";  // TCP and SPP links
+    const char* const ADAPTER_NOT_FOUND = "ELM_ADAPTER_NOT_FOUND";
     const char* const INIT_TIMEOUT = "ELM_INIT_TIMEOUT";
     const char* const SOC_TIMEOUT = "SOC_READ_TIMEOUT";
     const char* const TEMP_TIMEOUT = "TEMP_READ_TIMEOUT";
@@ -127,7 +435,11 @@ namespace ErrorMessages {
     const char* const TIMES_CHARGED_FAILED = "TIMES_CHARGED_READ_FAILED";
     const char* const TOTAL_KWH_CHARGED_FAILED = "TOTAL_KWH_CHARGED_FAILED";
     const char* const TOTAL_KWH_DISCHARGED_FAILED = "TOTAL_KWH_DISCHARGED_FAILED";
+    const char* const MONITOR_FAILED = "MONITOR_START_FAILED";
+    const char* const CUSTOM_TIMEOUT = "CUSTOM_PID_TIMEOUT";
+    const char* const CUSTOM_FAILED = "CUSTOM_PID_FAILED";
     const char* const NO_CAR = "No Car Connection";
+    const char* const CAR_ASLEEP = "CAR_ASLEEP";
     const char* const CONNECTED = "CONNECTED";
     const char* const TIME_NOT_SYNCED = "TIME_NOT_SYNCED";
 }
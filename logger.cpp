@@ -118,4 +118,15 @@ void Logger::errorf(const char* format, ...) {
     vsnprintf(buffer, sizeof(buffer), format, args);
     va_end(args);
     log(LogLevel::ERROR, buffer);
-}
\ No newline at end of file
+}
+
+void Logger::appendf(char* buffer, size_t bufferSize, size_t& len, const char* format, ...) {
+    if (len + 1 >= bufferSize) return;
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(buffer + len, bufferSize - len, format, args);
+    va_end(args);
+    if (written > 0) {
+        len += (size_t)written < bufferSize - len ? (size_t)written : bufferSize - len - 1;
+    }
+}
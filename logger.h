@@ -15,6 +15,7 @@ class Logger {
 public:
     static void begin(unsigned long baudRate = DEBUG_BAUD_RATE);
     static void setLevel(LogLevel level);
+    static LogLevel getLevel() { return currentLevel; }
     
     static void debug(const char* message);
     static void debug(const String& message);
@@ -31,6 +32,10 @@ public:
     static void error(const char* message);
     static void error(const String& message);
     static void errorf(const char* format, ...);
+
+    // printf onto the end of a message being built in buffer, advancing len;
+    // output past the end is cut off, leaving len at bufferSize - 1
+    static void appendf(char* buffer, size_t bufferSize, size_t& len, const char* format, ...);
     
 private:
     static LogLevel currentLevel;
@@ -1,17 +1,65 @@
 #include "MQTTNetworkManager.h"
 
-MQTTNetworkManager::MQTTNetworkManager() : mqttClient(wifiClient) {
+namespace {
+    // PID names accepted by "read", the same as their topic names
+    struct PidName {
+        const char* name;
+        uint8_t mask;
+    };
+    
+    const PidName PID_NAMES[] = {
+        { MQTT::TOPIC_SOC, Pids::SOC },
+        { MQTT::TOPIC_TEMP, Pids::TEMP },
+        { MQTT::TOPIC_VOLTAGE, Pids::VOLTAGE },
+        { MQTT::TOPIC_CHARGES_UPDATE, Pids::TOTAL_CHARGES },
+        { MQTT::TOPIC_KWH_CHARGED_UPDATE, Pids::KWH_CHARGED },
+        { MQTT::TOPIC_KWH_DISCHARGED_UPDATE, Pids::KWH_DISCHARGED },
+    };
+    
+    // A whole number of seconds, capped at maxMs before converting so a
+    // large value can't wrap. Anything else is refused rather than read as 0
+    bool parseSeconds(const char* text, unsigned long maxMs, unsigned long& ms) {
+        if (!isdigit((unsigned char)text[0])) {
+            return false;
+        }
+        char* end = nullptr;
+        unsigned long seconds = strtoul(text, &end, 10);
+        if (*end != '\0') {
+            return false;
+        }
+        ms = min(seconds, maxMs / 1000UL) * 1000UL;
+        return true;
+    }
+}
+
+MQTTNetworkManager::MQTTNetworkManager() 
+    : mqttClient(wifiClient), topicPrefix(MQTT::DEVICE_PREFIX), viaWiFi(true), radioLink(Radio::WIFI),
+      commandHead(0), commandCount(0) {
+}
+
+MQTTNetworkManager::MQTTNetworkManager(Client& client) 
+    : mqttClient(client), topicPrefix(MQTT::DEVICE_PREFIX), viaWiFi(false), radioLink(Radio::WIFI),
+      commandHead(0), commandCount(0) {
 }
 
 MQTTNetworkManager::~MQTTNetworkManager() {
     disconnectMQTT();
-    disconnectWiFi();
+    if (viaWiFi) {
+        disconnectWiFi();
+    }
 }
 
 bool MQTTNetworkManager::connectWiFi() {
+    // Held until disconnectWiFi(), even on a connection already up
+    radioLink.acquire();
     if (isWiFiConnected()) {
-        LOG_DEBUG("WiFi already connected");
-        return true;
+        if (WiFi.SSID() == WiFi_Config::SSID) {
+            LOG_DEBUG("WiFi already connected");
+            return true;
+        }
+        // Still on another network, e.g. a WiFi OBD adapter's
+        LOG_WARNING_F("WiFi on %s instead of %s, reconnecting", WiFi.SSID().c_str(), WiFi_Config::SSID);
+        WiFi.disconnect(true);
     }
     
     LOG_INFO("Connecting to WiFi...");
@@ -22,12 +70,14 @@ bool MQTTNetworkManager::connectWiFi() {
     while (WiFi.status() != WL_CONNECTED) {
         if (millis() - startTime > 30000) {
             LOG_ERROR("WiFi connection timeout");
+            Diagnostics::record(Stage::WIFI_CONNECT, startTime, StageResult::TIMEOUT);
             return false;
         }
         delay(500);
         Serial.print(".");
     }
     Serial.println();
+    Diagnostics::record(Stage::WIFI_CONNECT, startTime, StageResult::SUCCESS);
     
     LOG_INFO_F("WiFi connected. IP: %s", WiFi.localIP().toString().c_str());
     return true;
@@ -39,7 +89,12 @@ void MQTTNetworkManager::disconnectWiFi() {
         WiFi.disconnect(true);
         WiFi.mode(WIFI_OFF);
         LOG_INFO("WiFi disconnected");
+    } else if (WiFi.getMode() != WIFI_OFF) {
+        // A failed connection leaves the station still trying
+        WiFi.disconnect(true);
+        WiFi.mode(WIFI_OFF);
     }
+    radioLink.release();
 }
 
 bool MQTTNetworkManager::connectMQTT() {
@@ -48,7 +103,7 @@ bool MQTTNetworkManager::connectMQTT() {
         return true;
     }
     
-    if (!isWiFiConnected()) {
+    if (viaWiFi && !isWiFiConnected()) {
         LOG_ERROR("Cannot connect MQTT - WiFi not connected");
         return false;
     }
@@ -56,11 +111,15 @@ bool MQTTNetworkManager::connectMQTT() {
     LOG_INFO("Connecting to MQTT broker...");
     mqttClient.setUsernamePassword(MQTT::USER, MQTT::PASS);
     
+    unsigned long startTime = millis();
     if (!mqttClient.connect(MQTT::BROKER, MQTT::PORT)) {
         LOG_ERROR_F("MQTT connection failed! Error code = %d", mqttClient.connectError());
+        Diagnostics::record(Stage::MQTT_CONNECT, startTime,
+                            mqttClient.connectError() == MQTT_CONNECTION_TIMEOUT ? StageResult::TIMEOUT : StageResult::FAILURE);
         return false;
     }
     
+    Diagnostics::record(Stage::MQTT_CONNECT, startTime, StageResult::SUCCESS);
     LOG_INFO("Connected to MQTT broker");
     return true;
 }
@@ -74,36 +133,202 @@ void MQTTNetworkManager::disconnectMQTT() {
 }
 
 void MQTTNetworkManager::pollMQTT() {
-    if (isMQTTConnected()) {
-        mqttClient.poll();
+    if (!isMQTTConnected()) {
+        return;
+    }
+    
+    // parseMessage() polls the client and returns the size of the next
+    // incoming message, 0 once there are none left
+    while (mqttClient.parseMessage() > 0) {
+        handleMessage();
     }
 }
 
-bool MQTTNetworkManager::publishFloat(const char* topic, float value, bool retain) {
+bool MQTTNetworkManager::subscribeCommands(const char* prefix) {
     if (!isMQTTConnected()) {
-        LOG_ERROR("Cannot publish - MQTT not connected");
         return false;
     }
     
-    mqttClient.beginMessage(topic, retain, MQTT::QOS);
-    mqttClient.print(value);
-    mqttClient.endMessage();
+    char topic[MQTT::MAX_TOPIC_LENGTH];
+    snprintf(topic, sizeof(topic), "%s/%s", prefix, MQTT::TOPIC_CMD);
+    if (!mqttClient.subscribe(topic, MQTT::QOS)) {
+        LOG_ERROR_F("Subscribe to %s failed", topic);
+        return false;
+    }
+    
+    LOG_INFO_F("Listening for commands on %s", topic);
+    return true;
+}
+
+bool MQTTNetworkManager::takeCommand(Command& command) {
+    if (commandCount == 0) {
+        return false;
+    }
     
-    LOG_INFO_F("Published to %s: %.2f", topic, value);
+    command = commandQueue[commandHead];
+    commandHead = (commandHead + 1) % Commands::QUEUE_SIZE;
+    commandCount--;
     return true;
 }
 
+void MQTTNetworkManager::handleMessage() {
+    String topic = mqttClient.messageTopic();
+    
+    char text[Commands::MAX_LENGTH];
+    size_t length = 0;
+    while (mqttClient.available()) {
+        int c = mqttClient.read();
+        if (length < sizeof(text) - 1) {
+            text[length++] = (char)c;
+        }
+    }
+    text[length] = '\0';
+    
+    // Only "<prefix>/cmd" topics are subscribed
+    int suffix = topic.lastIndexOf('/');
+    if (suffix <= 0 || topic.substring(suffix + 1) != MQTT::TOPIC_CMD) {
+        LOG_WARNING_F("Ignoring message on %s", topic.c_str());
+        return;
+    }
+    
+    LOG_INFO_F("Command received on %s: %s", topic.c_str(), text);
+    
+    if (commandCount >= Commands::QUEUE_SIZE) {
+        LOG_WARNING("Command queue full, dropping command");
+        return;
+    }
+    
+    Command& command = commandQueue[(commandHead + commandCount) % Commands::QUEUE_SIZE];
+    if (!parseCommand(text, command)) {
+        LOG_WARNING("Unknown command, ignoring");
+        return;
+    }
+    
+    snprintf(command.prefix, sizeof(command.prefix), "%.*s", suffix, topic.c_str());
+    commandCount++;
+}
+
+bool MQTTNetworkManager::parseCommand(char* text, Command& command) {
+    command.pids = 0;
+    command.intervalMs = 0;
+    command.durationMs = 0;
+    
+    char* context = nullptr;
+    char* verb = strtok_r(text, " \t\r\n", &context);
+    if (verb == nullptr) {
+        return false;
+    }
+    
+    if (strcmp(verb, "read") == 0) {
+        command.type = CommandType::READ;
+        
+        char* list = strtok_r(nullptr, " \t\r\n", &context);
+        if (list == nullptr) {
+            command.pids = Pids::ALL;
+            return true;
+        }
+        
+        char* listContext = nullptr;
+        for (char* name = strtok_r(list, ",", &listContext); name != nullptr;
+             name = strtok_r(nullptr, ",", &listContext)) {
+            bool known = false;
+            for (const PidName& pid : PID_NAMES) {
+                if (strcmp(name, pid.name) == 0) {
+                    command.pids |= pid.mask;
+                    known = true;
+                }
+            }
+            if (!known) {
+                LOG_WARNING_F("Unknown PID name: %s", name);
+            }
+        }
+        return command.pids != 0;
+    }
+    
+    if (strcmp(verb, "interval") == 0) {
+        char* seconds = strtok_r(nullptr, " \t\r\n", &context);
+        // 0 restores the default
+        if (seconds == nullptr || !parseSeconds(seconds, Commands::MAX_INTERVAL, command.intervalMs)) {
+            return false;
+        }
+        command.type = CommandType::SET_INTERVAL;
+        return true;
+    }
+    
+    if (strcmp(verb, "monitor") == 0) {
+        char* duration = strtok_r(nullptr, " \t\r\n", &context);
+        command.type = CommandType::MONITOR;
+        if (duration == nullptr) {
+            command.durationMs = Monitor_Config::MAX_DURATION;
+        } else if (strcmp(duration, "stop") != 0) {
+            // 0 would mean stop
+            if (!parseSeconds(duration, Monitor_Config::MAX_DURATION, command.durationMs) ||
+                command.durationMs == 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    if (strcmp(verb, "burst") == 0) {
+        char* seconds = strtok_r(nullptr, " \t\r\n", &context);
+        if (seconds == nullptr) {
+            return false;
+        }
+        command.type = CommandType::BURST;
+        if (strcmp(seconds, "stop") == 0) {
+            return true;
+        }
+        
+        // An interval of 0 would mean stop, a duration of 0 an empty burst
+        char* duration = strtok_r(nullptr, " \t\r\n", &context);
+        command.durationMs = Commands::MAX_BURST_DURATION;
+        if (!parseSeconds(seconds, Commands::MAX_BURST_DURATION, command.intervalMs) || command.intervalMs == 0) {
+            return false;
+        }
+        if (duration != nullptr &&
+            (!parseSeconds(duration, Commands::MAX_BURST_DURATION, command.durationMs) || command.durationMs == 0)) {
+            return false;
+        }
+        return true;
+    }
+    
+    return false;
+}
+
+bool MQTTNetworkManager::publishFloat(const char* topic, float value, bool retain) {
+    char message[16];
+    snprintf(message, sizeof(message), "%.2f", value);
+    return publish(topicPrefix, topic, message, retain);
+}
+
 bool MQTTNetworkManager::publishString(const char* topic, const char* message, bool retain) {
+    return publish(topicPrefix, topic, message, retain);
+}
+
+bool MQTTNetworkManager::publish(const char* prefix, const char* topic, const char* message, bool retain) {
     if (!isMQTTConnected()) {
         LOG_ERROR("Cannot publish - MQTT not connected");
         return false;
     }
     
-    mqttClient.beginMessage(topic, retain, MQTT::QOS);
+    char fullTopic[MQTT::MAX_TOPIC_LENGTH];
+    snprintf(fullTopic, sizeof(fullTopic), "%s/%s", prefix, topic);
+    
+    // Pass the size up front so long messages are streamed rather than
+    // truncated to the client's transmit buffer
+    unsigned long startTime = millis();
+    mqttClient.beginMessage(fullTopic, strlen(message), retain, MQTT::QOS);
     mqttClient.print(message);
-    mqttClient.endMessage();
+    if (!mqttClient.endMessage()) {
+        LOG_ERROR_F("Publish to %s failed", fullTopic);
+        Diagnostics::record(Stage::MQTT_PUBLISH, startTime, StageResult::FAILURE);
+        return false;
+    }
+    Diagnostics::record(Stage::MQTT_PUBLISH, startTime, StageResult::SUCCESS);
+    RadioStats::countTx(Radio::WIFI);
     
-    LOG_INFO_F("Published to %s: %s", topic, message);
+    LOG_INFO_F("Published to %s: %s", fullTopic, message);
     return true;
 }
 
@@ -113,4 +338,63 @@ bool MQTTNetworkManager::publishStatus(const char* status) {
 
 bool MQTTNetworkManager::publishLastUpdate(const char* timestamp) {
     return publishString(MQTT::TOPIC_LAST_UPDATE, timestamp, MQTT::RETAIN);
+}
+
+bool MQTTNetworkManager::publishDiagnostics() {
+    char message[Diagnostics::MESSAGE_SIZE];
+    if (Diagnostics::format(message, sizeof(message)) == 0) {
+        return false;
+    }
+    
+    if (!publish(MQTT::DEVICE_PREFIX, MQTT::TOPIC_DIAG, message, MQTT::RETAIN)) {
+        return false;
+    }
+    
+    Diagnostics::markPublished();
+    return true;
+}
+
+bool MQTTNetworkManager::publishHeap() {
+    char message[96];
+    Diagnostics::formatHeap(message, sizeof(message));
+    return publish(MQTT::DEVICE_PREFIX, MQTT::TOPIC_HEAP, message, MQTT::RETAIN);
+}
+
+bool MQTTNetworkManager::publishRadioStats() {
+    char message[Power_Config::MESSAGE_SIZE];
+    RadioStats::formatCycle(message, sizeof(message));
+    return publish(MQTT::DEVICE_PREFIX, MQTT::TOPIC_RADIO, message, MQTT::RETAIN);
+}
+
+bool MQTTNetworkManager::publishChargeSession(const ChargeCapture& capture) {
+    if (!isMQTTConnected()) {
+        LOG_ERROR("Cannot publish - MQTT not connected");
+        return false;
+    }
+    
+    char fullTopic[MQTT::MAX_TOPIC_LENGTH];
+    snprintf(fullTopic, sizeof(fullTopic), "%s/%s", topicPrefix, MQTT::TOPIC_CHARGE_SESSION);
+    
+    // Encoded twice, once for the length and once straight into the client,
+    // so the session needs no buffer of its own
+    size_t length = capture.encode(nullptr);
+    unsigned long startTime = millis();
+    mqttClient.beginMessage(fullTopic, length, MQTT::RETAIN, MQTT::QOS);
+    capture.encode(&mqttClient);
+    if (!mqttClient.endMessage()) {
+        LOG_ERROR_F("Publish to %s failed", fullTopic);
+        Diagnostics::record(Stage::MQTT_PUBLISH, startTime, StageResult::FAILURE);
+        return false;
+    }
+    Diagnostics::record(Stage::MQTT_PUBLISH, startTime, StageResult::SUCCESS);
+    RadioStats::countTx(Radio::WIFI);
+    
+    LOG_INFO_F("Published charge session to %s (%u bytes)", fullTopic, (unsigned)length);
+    return true;
+}
+
+bool MQTTNetworkManager::publishMetrics(const DerivedMetrics& metrics) {
+    char message[Metrics_Config::MESSAGE_SIZE];
+    MetricsEngine::format(metrics, message, sizeof(message));
+    return publish(topicPrefix, MQTT::TOPIC_METRICS, message, MQTT::RETAIN);
 }
\ No newline at end of file
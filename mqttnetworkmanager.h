@@ -5,10 +5,32 @@
 #include <ArduinoMqttClient.h>
 #include "Config.h"
 #include "Logger.h"
+#include "Diagnostics.h"
+#include "MetricsEngine.h"
+#include "RadioStats.h"
+#include "ChargeCapture.h"
+
+enum class CommandType : uint8_t {
+    READ,           // Read the PIDs in pids now
+    SET_INTERVAL,   // Change the update interval, 0 restores the default
+    BURST,          // Read every intervalMs for durationMs, interval 0 stops
+    MONITOR         // Passively monitor for durationMs, 0 stops
+};
+
+struct Command {
+    CommandType type;
+    uint8_t pids;
+    unsigned long intervalMs;
+    unsigned long durationMs;
+    char prefix[MQTT::MAX_TOPIC_LENGTH];    // Topic prefix the command arrived on
+};
 
 class MQTTNetworkManager {
 public:
     MQTTNetworkManager();
+    // Talk MQTT over client instead of WiFi, e.g. an MQTTEmulator; WiFi is
+    // neither needed nor touched
+    explicit MQTTNetworkManager(Client& client);
     ~MQTTNetworkManager();
     
     // WiFi Management
@@ -22,15 +44,39 @@ public:
     bool isMQTTConnected() { return mqttClient.connected(); }
     void pollMQTT();
     
+    // Command channel: subscribe to "<prefix>/cmd", commands received while
+    // polling are queued until taken
+    bool subscribeCommands(const char* prefix);
+    bool takeCommand(Command& command);
+    
+    // Topics are published as "<prefix>/<topic>"; the prefix selects the vehicle
+    void setTopicPrefix(const char* prefix) { topicPrefix = prefix; }
+    
     // Publishing Methods
     bool publishFloat(const char* topic, float value, bool retain = true);
     bool publishString(const char* topic, const char* message, bool retain = true);
     bool publishStatus(const char* status);
     bool publishLastUpdate(const char* timestamp);
+    bool publishDiagnostics();
+    bool publishHeap();
+    bool publishMetrics(const DerivedMetrics& metrics);
+    bool publishRadioStats();
+    bool publishChargeSession(const ChargeCapture& capture);
     
 private:
     WiFiClient wifiClient;
     MqttClient mqttClient;
+    const char* topicPrefix;
+    bool viaWiFi;
+    RadioLink radioLink;
+    
+    Command commandQueue[Commands::QUEUE_SIZE];
+    int commandHead;
+    int commandCount;
+    
+    void handleMessage();
+    static bool parseCommand(char* text, Command& command);
+    bool publish(const char* prefix, const char* topic, const char* message, bool retain);
 };
 
 #endif // MQTT_NETWORK_MANAGER_H
\ No newline at end of file
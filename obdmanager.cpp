@@ -1,305 +1,705 @@
 #include "OBDManager.h"
+#include "BLETrace.h"
 
-OBDManager::OBDManager() 
-    : connected(false), consecutiveTimeouts(0), carConnectionLost(false) {
+OBDManager* OBDManager::create(const VehicleConfig& vehicle) {
+    return visitProfile(vehicle.model, [&](auto profile) -> OBDManager* {
+        return new BasicOBDManager<decltype(profile)>(vehicle);
+    });
 }
 
-OBDManager::~OBDManager() {
+template <typename Profile>
+BasicOBDManager<Profile>::BasicOBDManager() 
+    : BasicOBDManager(Vehicles::LIST[0]) {
+}
+
+template <typename Profile>
+BasicOBDManager<Profile>::BasicOBDManager(const VehicleConfig& vehicle) 
+    : vehicle(&vehicle), transport(OBDTransport::create(vehicle.transport)), connected(false), consecutiveTimeouts(0), carConnectionLost(false),
+      connectError(ErrorMessages::BLE_TIMEOUT), elmStarted(false),
+      adapterTimeout(Adaptive_Config::ATST_DEFAULT), currentHeader(0), headerSwitches(0),
+      adapterVoltage(0.0f), monitoring(false), monitorLength(0) {
+}
+
+template <typename Profile>
+BasicOBDManager<Profile>::~BasicOBDManager() {
     if (connected) {
         disconnect();
     }
+    delete transport;
 }
 
-bool OBDManager::connect() {
-    LOG_INFO("Starting OBD connection...");
-    
-    // Initialize BLE
-    bleSerial.begin(const_cast<char*>(OBD::DEVICE_NAME));
+template <typename Profile>
+bool BasicOBDManager<Profile>::connect() {
+    LOG_INFO_F("Starting OBD connection to %s...", vehicle->name);
+    
+    bool ble = vehicle->transport == Transport::BLE;
+    // SPP takes no timeout, BluetoothSerial has its own
+    unsigned long timeout = vehicle->transport == Transport::TCP ? Timeouts::TCP_CONNECTION :
+                            Timeouts::BLE_CONNECTION;
+    
+    // Find the adapter
+    if (!transport->begin(vehicle->deviceName, vehicle->deviceAddress)) {
+        LOG_ERROR("OBD adapter not found");
+        connectError = ble ? ErrorMessages::BLE_NOT_FOUND : ErrorMessages::ADAPTER_NOT_FOUND;
+        return false;
+    }
     
     // Connect with timeout
-    LOG_INFO("Attempting BLE connection...");
-    if (!bleSerial.connect(Timeouts::BLE_CONNECTION)) {
-        LOG_ERROR("BLE connection failed or timed out");
-        handleTimeout(ErrorMessages::BLE_TIMEOUT);
+    LOG_INFO_F("Attempting %s connection...", transport->getName());
+    if (!transport->connect(timeout)) {
+        LOG_ERROR_F("%s connection failed or timed out", transport->getName());
+        connectError = ble ? ErrorMessages::BLE_TIMEOUT : ErrorMessages::ADAPTER_TIMEOUT;
+        handleTimeout(connectError);
+        transport->end();
         return false;
     }
     
-    LOG_INFO("BLE connected, initializing ELM327...");
+    LOG_INFO_F("%s connected, initializing ELM327...", transport->getName());
     
     // Initialize ELM327
-    if (!initializeELM327()) {
+    if (!initializeELM327(*transport)) {
         LOG_ERROR("ELM327 initialization failed");
+        connectError = ErrorMessages::INIT_TIMEOUT;
         handleTimeout(ErrorMessages::INIT_TIMEOUT);
+        transport->end();
         return false;
     }
     
+    // The adapter answers again; whether the car does is up to the PID reads
     connected = true;
+    resetTimeoutCounter();
     LOG_INFO("OBD connection established successfully");
     return true;
 }
 
-bool OBDManager::initializeELM327() {
+template <typename Profile>
+bool BasicOBDManager<Profile>::attachStream(Stream& stream) {
+    LOG_INFO("Attaching ELM327 stream...");
+    
+    if (!initializeELM327(stream)) {
+        LOG_ERROR("ELM327 initialization failed");
+        handleTimeout(ErrorMessages::INIT_TIMEOUT);
+        return false;
+    }
+    
+    connected = true;
+    resetTimeoutCounter();
+    return true;
+}
+
+template <typename Profile>
+bool BasicOBDManager<Profile>::initializeELM327(Stream& stream) {
     unsigned long startTime = millis();
     
-    while (!elm327.begin(bleSerial, true, 2000)) {
+    while (!beginELM327(stream)) {
         if (millis() - startTime > Timeouts::ELM_INIT) {
+            Diagnostics::record(Stage::ELM_INIT, startTime, StageResult::TIMEOUT);
             return false;
         }
         LOG_DEBUG("Waiting for ELM327 initialization...");
         delay(1000);
     }
     
-    LOG_INFO("ELM327 connected, sending initialization commands...");
+    LOG_INFO_F("ELM327 connected, initializing for %s...", Profile::NAME);
     
-    // Send initialization commands
+    // Send initialization commands, then select the profile's bus. The
+    // reset clears the header, the first PID read sets the one it needs
     for (int i = 0; i < OBD::INIT_COMMANDS_COUNT; i++) {
         LOG_DEBUG_F("Sending: %s", OBD::INIT_COMMANDS[i]);
         elm327.sendCommand_Blocking(OBD::INIT_COMMANDS[i]);
         delay(100);
     }
+    elm327.sendCommand_Blocking(Profile::PROTOCOL);
+    currentHeader = 0;
+    
+    // INIT_COMMANDS reset ATST to its default, replace it with the learned value
+    adapterTimeout = Adaptive_Config::ATST_DEFAULT;
+    calibrateAdapterTimeout();
     
     LOG_INFO("ELM327 initialization complete");
+    Diagnostics::record(Stage::ELM_INIT, startTime, StageResult::SUCCESS);
     return true;
 }
 
-void OBDManager::disconnect() {
+template <typename Profile>
+void BasicOBDManager<Profile>::calibrateAdapterTimeout() {
+    // The adapter waits ATST for the ECU before answering NO DATA. Use the
+    // slowest learned PID limit so every PID still gets its answer; the
+    // limit includes the link round trip, which keeps this on the safe side
+    unsigned long limitMs = 0;
+    for (const AdaptiveTimeout& pid : pidTimeouts) {
+        if (!pid.isTrained()) {
+            return;
+        }
+        limitMs = max(limitMs, pid.getLimitMs());
+    }
+    // Custom PIDs too once they have answered, or slow ones get NO DATA
+    if (CustomPids::count() > 0 && customTimeout.isTrained()) {
+        limitMs = max(limitMs, customTimeout.getLimitMs());
+    }
+    
+    unsigned long units = (limitMs + Adaptive_Config::ATST_UNIT_MS - 1) / Adaptive_Config::ATST_UNIT_MS;
+    uint8_t value = units < Adaptive_Config::ATST_MIN ? Adaptive_Config::ATST_MIN : 
+                    units > 0xFF ? 0xFF : (uint8_t)units;
+    if (value == adapterTimeout) {
+        return;
+    }
+    
+    char command[8];
+    snprintf(command, sizeof(command), "ATST%02X", value);
+    elm327.sendCommand_Blocking(command);
+    adapterTimeout = value;
+    LOG_INFO_F("Adapter timeout set to %s (%lu ms)", command, value * Adaptive_Config::ATST_UNIT_MS);
+}
+
+template <typename Profile>
+bool BasicOBDManager<Profile>::beginELM327(Stream& stream) {
+    // ELM327::begin() mallocs a new payload buffer on every call, so only
+    // the first attempt goes through it and later ones rerun the init sequence
+    if (!elmStarted) {
+        elmStarted = true;
+        return elm327.begin(stream, true, 2000);
+    }
+    
+    elm327.elm_port = &stream;
+    return elm327.initializeELM();
+}
+
+template <typename Profile>
+void BasicOBDManager<Profile>::disconnect() {
+    if (monitoring) {
+        stopMonitor();
+    }
+    
     if (connected) {
         LOG_INFO("Disconnecting OBD...");
         elm327.sendCommand_Blocking("ATZ");
-        bleSerial.end();
+        transport->end();
         connected = false;
+        BLETrace::flush();
         LOG_INFO("OBD disconnected");
     }
 }
 
-bool OBDManager::readStateOfCharge(float& soc) {
-    if (!connected) return false;
-    
-    LOG_DEBUG("Reading State of Charge...");
-    
-    elm327.sendCommand(OBD::CMD_SOC);
+template <typename Profile>
+CarState BasicOBDManager<Profile>::checkAwake() {
     unsigned long startTime = millis();
+    uint16_t previousTimeout = elm327.timeout_ms;
+    elm327.timeout_ms = Sleep_Config::PROBE_TIMEOUT;
     
-    while (elm327.nb_rx_state == ELM_GETTING_MSG) {
-        if (millis() - startTime > Timeouts::ELM_COMMAND) {
-            LOG_ERROR("SoC read timeout");
-            handleTimeout(ErrorMessages::SOC_TIMEOUT);
-            return false;
+    // The adapter measures the OBD port's 12 V pin itself, no ECU involved
+    adapterVoltage = 0.0f;
+    if (elm327.sendCommand_Blocking("ATRV") == ELM_SUCCESS) {
+        adapterVoltage = atof(elm327.payload);
+    }
+    bool awake = adapterVoltage >= Sleep_Config::AWAKE_VOLTAGE;
+    if (awake) {
+        LOG_INFO_F("Car awake (%.1f V)", adapterVoltage);
+    } else if (selectHeader(Profile::HEADER_SOC)) {
+        // Low voltage only means the DC-DC converter is off; the BMS may still
+        // be up (e.g. charging), so ask it once without the usual retries
+        elm327.sendCommand(Profile::CMD_SOC);
+        awake = waitForResponse(millis(), Sleep_Config::PROBE_TIMEOUT) == ELM_SUCCESS;
+        if (awake) {
+            LOG_INFO_F("Car awake (%.1f V, ECU answered)", adapterVoltage);
         }
-        elm327.get_response();
-        delay(50);
     }
     
-    if (elm327.nb_rx_state == ELM_SUCCESS) {
-        int A = (charToInt(elm327.payload[11]) << 4) | charToInt(elm327.payload[12]);
-        int B = (charToInt(elm327.payload[13]) << 4) | charToInt(elm327.payload[14]);
-        soc = float(A + B * 256) / 100.0;
-        
-        LOG_INFO_F("State of Charge: %.2f%%", soc);
-        resetTimeoutCounter();
-        return true;
+    // The PID reads set their own limits, but anything else sent with the
+    // blocking calls expects the usual one
+    elm327.timeout_ms = previousTimeout;
+    
+    if (!awake) {
+        LOG_INFO_F("Car asleep (%.1f V, no answer)", adapterVoltage);
+    }
+    Diagnostics::record(Stage::WAKE_CHECK, startTime, awake ? StageResult::SUCCESS : StageResult::TIMEOUT);
+    return awake ? CarState::AWAKE : CarState::ASLEEP;
+}
+
+template <typename Profile>
+bool BasicOBDManager<Profile>::readStateOfCharge(VehicleData& data) {
+    if (!queryPID(Profile::HEADER_SOC, Profile::CMD_SOC, Stage::PID_SOC, "SoC",
+                  ErrorMessages::SOC_TIMEOUT, ErrorMessages::SOC_FAILED)) {
+        return false;
     }
     
-    LOG_ERROR("SoC read failed");
-    elm327.printError();
-    handleTimeout(ErrorMessages::SOC_FAILED);
-    return false;
+    store(data, Pids::SOC);
+    
+    LOG_INFO_F("State of Charge: %.2f%%", data.stateOfCharge());
+    return true;
 }
 
-bool OBDManager::readBatteryTemperature(float& temp) {
-    if (!connected) return false;
+template <typename Profile>
+bool BasicOBDManager<Profile>::readBatteryTemperature(VehicleData& data) {
+    if (!queryPID(Profile::HEADER_TEMP, Profile::CMD_TEMP, Stage::PID_TEMP, "Temperature",
+                  ErrorMessages::TEMP_TIMEOUT, ErrorMessages::TEMP_FAILED)) {
+        return false;
+    }
     
-    LOG_DEBUG("Reading Battery Temperature...");
+    store(data, Pids::TEMP);
     
-    elm327.sendCommand(OBD::CMD_TEMP);
-    unsigned long startTime = millis();
+    LOG_INFO_F("Battery Temperature: %.1f°C", data.batteryTemperature());
+    return true;
+}
+
+template <typename Profile>
+bool BasicOBDManager<Profile>::readBatteryVoltage(VehicleData& data) {
+    if (!queryPID(Profile::HEADER_VOLTAGE, Profile::CMD_VOLTAGE, Stage::PID_VOLTAGE, "Voltage",
+                  ErrorMessages::VOLTAGE_TIMEOUT, ErrorMessages::VOLTAGE_FAILED)) {
+        return false;
+    }
     
-    while (elm327.nb_rx_state == ELM_GETTING_MSG) {
-        if (millis() - startTime > Timeouts::ELM_COMMAND) {
-            LOG_ERROR("Temperature read timeout");
-            handleTimeout(ErrorMessages::TEMP_TIMEOUT);
-            return false;
-        }
-        elm327.get_response();
-        delay(50);
+    store(data, Pids::VOLTAGE);
+    
+    LOG_INFO_F("Battery Voltage: %.2fV", data.batteryVoltage());
+    return true;
+}
+
+template <typename Profile>
+bool BasicOBDManager<Profile>::readTotalCharges(VehicleData& data) {
+    if (!queryPID(Profile::HEADER_TOTAL_CHARGES, Profile::CMD_TOTAL_CHARGES, Stage::PID_TOTAL_CHARGES, "Total charges",
+                  ErrorMessages::TIMES_CHARGED_FAILED, ErrorMessages::TIMES_CHARGED_FAILED)) {
+        return false;
     }
     
-    if (elm327.nb_rx_state == ELM_SUCCESS) {
-        int A = (charToInt(elm327.payload[11]) << 4) | charToInt(elm327.payload[12]);
-        temp = float(A) - 40.0;
-        
-        LOG_INFO_F("Battery Temperature: %.1f°C", temp);
-        return true;
+    store(data, Pids::TOTAL_CHARGES);
+    
+    LOG_INFO_F("Total Charges: %.0f", data.totalCharges());
+    return true;
+}
+
+template <typename Profile>
+bool BasicOBDManager<Profile>::readTotalKwhCharged(VehicleData& data) {
+    if (!queryPID(Profile::HEADER_KWH_CHARGED, Profile::CMD_KWH_CHARGED, Stage::PID_KWH_CHARGED, "Total kWh charged",
+                  ErrorMessages::TOTAL_KWH_CHARGED_FAILED, ErrorMessages::TOTAL_KWH_CHARGED_FAILED)) {
+        return false;
     }
     
-    LOG_ERROR("Temperature read failed");
-    elm327.printError();
-    handleTimeout(ErrorMessages::TEMP_FAILED);
-    return false;
+    store(data, Pids::KWH_CHARGED);
+    
+    LOG_INFO_F("Total kWh Charged: %.2f kWh", data.totalKwhCharged());
+    return true;
 }
 
-bool OBDManager::readBatteryVoltage(float& voltage) {
-    if (!connected) return false;
+template <typename Profile>
+bool BasicOBDManager<Profile>::readTotalKwhDischarged(VehicleData& data) {
+    if (!queryPID(Profile::HEADER_KWH_DISCHARGED, Profile::CMD_KWH_DISCHARGED, Stage::PID_KWH_DISCHARGED, "Total kWh discharged",
+                  ErrorMessages::TOTAL_KWH_DISCHARGED_FAILED, ErrorMessages::TOTAL_KWH_DISCHARGED_FAILED)) {
+        return false;
+    }
     
-    LOG_DEBUG("Reading Battery Voltage...");
+    store(data, Pids::KWH_DISCHARGED);
     
-    elm327.sendCommand(OBD::CMD_VOLTAGE);
-    unsigned long startTime = millis();
+    LOG_INFO_F("Total kWh Discharged: %.2f kWh", data.totalKwhDischarged());
+    return true;
+}
+
+template <typename Profile>
+bool BasicOBDManager<Profile>::selectHeader(uint16_t header) {
+    if (header == currentHeader) {
+        return true;
+    }
     
-    while (elm327.nb_rx_state == ELM_GETTING_MSG) {
-        if (millis() - startTime > Timeouts::ELM_COMMAND) {
-            LOG_ERROR("Voltage read timeout");
-            handleTimeout(ErrorMessages::VOLTAGE_TIMEOUT);
-            return false;
+    // Send to the ECU and only accept its answer (request ID + 8), so other
+    // ECUs answering on the bus can't be mistaken for it
+    char command[12];
+    snprintf(command, sizeof(command), "ATSH%03X", header);
+    if (elm327.sendCommand_Blocking(command) != ELM_SUCCESS) {
+        LOG_ERROR_F("Setting header %03X failed", header);
+        elm327.printError();
+        currentHeader = 0;
+        return false;
+    }
+    snprintf(command, sizeof(command), "ATCRA%03X", header + 8);
+    if (elm327.sendCommand_Blocking(command) != ELM_SUCCESS) {
+        LOG_ERROR_F("Setting receive filter %03X failed", header + 8);
+        elm327.printError();
+        currentHeader = 0;
+        return false;
+    }
+    
+    currentHeader = header;
+    headerSwitches++;
+    LOG_DEBUG_F("ECU header set to %03X", header);
+    return true;
+}
+
+template <typename Profile>
+bool BasicOBDManager<Profile>::readCustomPids(float values[Custom_Config::MAX_PIDS], uint32_t& readMask) {
+    readMask = 0;
+    
+    // The group on the header already set, then the rest, which the loader
+    // sorted by header
+    uint16_t first = currentHeader;
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < CustomPids::count() && !carConnectionLost; i++) {
+            const CustomPid& pid = CustomPids::get(i);
+            if ((pid.header == first) != (pass == 0)) {
+                continue;
+            }
+            if (readCustomPid(pid, values[i])) {
+                readMask |= 1UL << i;
+            }
         }
-        elm327.get_response();
-        delay(50);
+    }
+    return readMask != 0;
+}
+
+template <typename Profile>
+bool BasicOBDManager<Profile>::readCustomPid(const CustomPid& pid, float& value) {
+    if (!queryPID(pid.header, pid.command, Stage::PID_CUSTOM, pid.topic,
+                  ErrorMessages::CUSTOM_TIMEOUT, ErrorMessages::CUSTOM_FAILED)) {
+        return false;
     }
     
-    if (elm327.nb_rx_state == ELM_SUCCESS) {
-        int A = (charToInt(elm327.payload[11]) << 4) | charToInt(elm327.payload[12]);
-        int B = (charToInt(elm327.payload[13]) << 4) | charToInt(elm327.payload[14]);
-        voltage = float(A + B * 256);
-        
-        LOG_INFO_F("Battery Voltage: %.2fV", voltage);
-        return true;
+    // Headers on, spaces off: ID (3) + length (2) + the echoed command with
+    // its service + 0x40, then the data
+    size_t offset = 5 + strlen(pid.command);
+    if (strlen(elm327.payload) < offset + pid.bytes * 2) {
+        LOG_ERROR_F("%s: answer too short for %u data bytes", pid.topic, pid.bytes);
+        return false;
+    }
+    const char* data = elm327.payload + offset;
+    uint8_t bytes[8];
+    for (uint8_t i = 0; i < pid.bytes; i++) {
+        bytes[i] = (charToInt(data[i * 2]) << 4) | charToInt(data[i * 2 + 1]);
     }
     
-    LOG_ERROR("Voltage read failed");
-    elm327.printError();
-    handleTimeout(ErrorMessages::VOLTAGE_FAILED);
-    return false;
+    value = pid.formula.evaluate(bytes);
+    if (!isfinite(value)) {
+        LOG_ERROR_F("%s: formula gave no number", pid.topic);
+        return false;
+    }
+    LOG_INFO_F("%s: %.2f", pid.topic, value);
+    return true;
 }
 
-bool OBDManager::readTotalCharges(float& charges) {
+template <typename Profile>
+bool BasicOBDManager<Profile>::queryPID(uint16_t header, const char* command, Stage stage, const char* name,
+                          const char* timeoutError, const char* failError) {
     if (!connected) return false;
     
-    LOG_DEBUG("Reading total charges...");
+    // A custom PID failing says more about pids.csv than about the car, so
+    // it only shows in the diagnostics and never marks the car as lost
+    bool custom = stage == Stage::PID_CUSTOM;
+    auto fail = [&](const char* error) {
+        if (!custom) {
+            handleTimeout(error);
+        }
+    };
+    
+    if (!selectHeader(header)) {
+        Diagnostics::record(stage, millis(), StageResult::FAILURE);
+        fail(failError);
+        return false;
+    }
+    
+    AdaptiveTimeout& latency = stage == Stage::PID_CUSTOM ? customTimeout : pidTimeouts[(int)stage - (int)Stage::PID_SOC];
+    unsigned long timeout = latency.getTimeoutMs();
+    LOG_DEBUG_F("Reading %s (timeout %lu ms)...", name, timeout);
     
-    elm327.sendCommand(OBD::CMD_TOTALCHARGES);
+    // ELMduino checks its own timeout inside get_response()
+    elm327.timeout_ms = timeout;
+    elm327.sendCommand(command);
     unsigned long startTime = millis();
     
-    while (elm327.nb_rx_state == ELM_GETTING_MSG) {
-        if (millis() - startTime > Timeouts::ELM_COMMAND) {
-            LOG_ERROR("Total charges read timeout");
-            handleTimeout(ErrorMessages::TIMES_CHARGED_FAILED);
-            return false;
-        }
-        elm327.get_response();
-        delay(50);
+    if (waitForResponse(startTime, timeout) == ELM_GETTING_MSG) {
+        LOG_ERROR_F("%s read timeout", name);
+        Diagnostics::record(stage, startTime, StageResult::TIMEOUT);
+        latency.addTimeout();
+        fail(timeoutError);
+        return false;
     }
     
     if (elm327.nb_rx_state == ELM_SUCCESS) {
-        int A = (charToInt(elm327.payload[11]) << 4) | charToInt(elm327.payload[12]);
-        int B = (charToInt(elm327.payload[13]) << 4) | charToInt(elm327.payload[14]);
-        charges = float(A + B * 256);
-        
-        LOG_INFO_F("Total Charges: %.0f", charges);
-        resetTimeoutCounter();
+        latency.addSample(millis() - startTime);
+        Diagnostics::record(stage, startTime, StageResult::SUCCESS);
+        if (!custom) {
+            resetTimeoutCounter();
+        }
         return true;
     }
     
-    LOG_ERROR("Total charges read failed");
+    LOG_ERROR_F("%s read failed", name);
     elm327.printError();
-    handleTimeout(ErrorMessages::TIMES_CHARGED_FAILED);
+    Diagnostics::record(stage, startTime,
+                        elm327.nb_rx_state == ELM_TIMEOUT ? StageResult::TIMEOUT : StageResult::FAILURE);
+    
+    // NO DATA can mean ATST cut the ECU off, so loosen it like a timeout
+    if (elm327.nb_rx_state == ELM_TIMEOUT || elm327.nb_rx_state == ELM_NO_DATA) {
+        latency.addTimeout();
+    }
+    fail(failError);
     return false;
 }
 
-bool OBDManager::readTotalKwhCharged(float& kwh) {
-    if (!connected) return false;
-    
-    LOG_DEBUG("Reading total kWh charged...");
-    
-    elm327.sendCommand(OBD::CMD_TOTALKWHCHARGE);
-    unsigned long startTime = millis();
+template <typename Profile>
+int8_t BasicOBDManager<Profile>::waitForResponse(unsigned long startTime, unsigned long timeout) {
+    // Returns ELMduino's receive state, still ELM_GETTING_MSG if the host
+    // gave up first. On a framed link, ELMduino is only handed a response
+    // once the whole frame is in
+    bool framed = elm327.elm_port == transport && transport->isFramed();
     
     while (elm327.nb_rx_state == ELM_GETTING_MSG) {
-        if (millis() - startTime > Timeouts::ELM_COMMAND) {
-            LOG_ERROR("Total kWh charged read timeout");
-            handleTimeout(ErrorMessages::TOTAL_KWH_CHARGED_FAILED);
-            return false;
+        if (millis() - startTime > timeout) {
+            if (elm327.elm_port == transport) {
+                transport->markTimeout();
+            }
+            return ELM_GETTING_MSG;
+        }
+        if (!framed || transport->framesAvailable() > 0) {
+            elm327.get_response();
+        }
+        if (elm327.nb_rx_state == ELM_GETTING_MSG) {
+            delay(Adaptive_Config::RESPONSE_POLL_MS);
         }
-        elm327.get_response();
-        delay(50);
     }
-    
-    if (elm327.nb_rx_state == ELM_SUCCESS) {
-        int A = (charToInt(elm327.payload[11]) << 4) | charToInt(elm327.payload[12]);
-        int B = (charToInt(elm327.payload[13]) << 4) | charToInt(elm327.payload[14]);
-        kwh = float(A + B * 256);
-        
-        LOG_INFO_F("Total kWh Charged: %.2f kWh", kwh);
-        return true;
+    return elm327.nb_rx_state;
+}
+
+template <typename Profile>
+int BasicOBDManager<Profile>::responseByte(int index) {
+    // Bytes past the end of a shorter response read as 0
+    const char* data = elm327.payload + Profile::DATA_OFFSET + index * 2;
+    if (data[0] == '\0' || data[1] == '\0') {
+        return 0;
+    }
+    return (charToInt(data[0]) << 4) | charToInt(data[1]);
+}
+
+template <typename Profile>
+uint16_t BasicOBDManager<Profile>::responseWord() {
+    // A + B*256, as the profile decoders take it
+    return responseByte(0) | (responseByte(1) << 8);
+}
+
+template <typename Profile>
+void BasicOBDManager<Profile>::store(VehicleData& data, uint8_t pid) {
+    data.model = Profile::MODEL;
+    data.set(pid, responseWord());
+}
+
+template <typename Profile>
+uint16_t BasicOBDManager<Profile>::headerOf(uint8_t pid) {
+    switch (pid) {
+        case Pids::SOC: return Profile::HEADER_SOC;
+        case Pids::TEMP: return Profile::HEADER_TEMP;
+        case Pids::VOLTAGE: return Profile::HEADER_VOLTAGE;
+        case Pids::TOTAL_CHARGES: return Profile::HEADER_TOTAL_CHARGES;
+        case Pids::KWH_CHARGED: return Profile::HEADER_KWH_CHARGED;
+        case Pids::KWH_DISCHARGED: return Profile::HEADER_KWH_DISCHARGED;
+        default: return 0;
+    }
+}
+
+template <typename Profile>
+int BasicOBDManager<Profile>::planReads(uint8_t mask, uint8_t order[Pids::COUNT]) const {
+    // Drain the group on the current header, then switch to the header of
+    // the first PID left. One switch per header not already set, the fewest
+    // possible; within a group the Pids order is kept
+    int count = 0;
+    uint8_t remaining = mask & Pids::ALL;
+    uint16_t header = currentHeader;
+    while (remaining != 0) {
+        for (int i = 0; i < Pids::COUNT; i++) {
+            uint8_t pid = 1 << i;
+            if ((remaining & pid) && headerOf(pid) == header) {
+                order[count++] = pid;
+                remaining &= ~pid;
+            }
+        }
+        if (remaining != 0) {
+            header = headerOf(1 << Pids::indexOf(remaining));
+        }
+    }
+    return count;
+}
+
+template <typename Profile>
+bool BasicOBDManager<Profile>::readAllData(VehicleData& data) {
+    data.validMask = 0;
+    
+    uint8_t order[Pids::COUNT];
+    int count = planReads(Pids::ALL, order);
+    
+    // Keep going past a failed PID so the others still get read, but stop
+    // once the car stops answering altogether
+    for (int i = 0; i < count && !carConnectionLost; i++) {
+        switch (order[i]) {
+            case Pids::SOC: readStateOfCharge(data); break;
+            case Pids::TEMP: readBatteryTemperature(data); break;
+            case Pids::VOLTAGE: readBatteryVoltage(data); break;
+            case Pids::TOTAL_CHARGES: readTotalCharges(data); break;
+            case Pids::KWH_CHARGED: readTotalKwhCharged(data); break;
+            case Pids::KWH_DISCHARGED: readTotalKwhDischarged(data); break;
+        }
     }
     
-    LOG_ERROR("Total kWh charged read failed");
-    elm327.printError();
-    handleTimeout(ErrorMessages::TOTAL_KWH_CHARGED_FAILED);
-    return false;
+    return data.validMask != 0;
 }
 
-bool OBDManager::readTotalKwhDischarged(float& kwh) {
-    if (!connected) return false;
+template <typename Profile>
+bool BasicOBDManager<Profile>::startMonitor() {
+    if (!connected || monitoring) {
+        return monitoring;
+    }
     
-    LOG_DEBUG("Reading total kWh discharged...");
+    LOG_INFO("Starting passive monitor...");
     
-    elm327.sendCommand(OBD::CMD_TOTALKWHDISCHARGE);
-    unsigned long startTime = millis();
+    // Raw frames (no ISO-TP formatting), only the configured IDs. ATAR drops
+    // the receive filter of the last ECU header, the next read sets it again
+    currentHeader = 0;
+    if (!sendMonitorSetup("ATCAF0") || !sendMonitorSetup("ATAR") || !sendMonitorSetup("STFCP")) {
+        return false;
+    }
     
-    while (elm327.nb_rx_state == ELM_GETTING_MSG) {
-        if (millis() - startTime > Timeouts::ELM_COMMAND) {
-            LOG_ERROR("Total kWh discharged read timeout");
-            handleTimeout(ErrorMessages::TOTAL_KWH_DISCHARGED_FAILED);
+    if (Monitor_Config::SIGNAL_COUNT == 0) {
+        LOG_ERROR("No broadcast signals in Monitor_Config::SIGNALS, monitor not started");
+        return false;
+    }
+    for (int i = 0; i < Monitor_Config::SIGNAL_COUNT; i++) {
+        uint16_t id = Monitor_Config::SIGNALS[i].canId;
+        bool duplicate = false;
+        for (int j = 0; j < i; j++) {
+            duplicate = duplicate || Monitor_Config::SIGNALS[j].canId == id;
+        }
+        if (duplicate) {
+            continue;
+        }
+        
+        char command[20];
+        snprintf(command, sizeof(command), "STFAP %03X,7FF", id);
+        if (!sendMonitorSetup(command)) {
             return false;
         }
-        elm327.get_response();
-        delay(50);
     }
     
-    if (elm327.nb_rx_state == ELM_SUCCESS) {
-        int A = (charToInt(elm327.payload[11]) << 4) | charToInt(elm327.payload[12]);
-        int B = (charToInt(elm327.payload[13]) << 4) | charToInt(elm327.payload[14]);
-        kwh = float(A + B * 256);
-        
-        LOG_INFO_F("Total kWh Discharged: %.2f kWh", kwh);
-        return true;
+    // STM streams until interrupted, so it is written directly rather than
+    // through ELMduino, which would wait for a prompt. Its output has no
+    // prompt to frame on either, so a framed link passes it raw
+    transport->setRawMode(true);
+    elm327.elm_port->print("STM\r");
+    monitoring = true;
+    monitorLength = 0;
+    LOG_INFO_F("Monitoring %d signals", Monitor_Config::SIGNAL_COUNT);
+    return true;
+}
+
+template <typename Profile>
+bool BasicOBDManager<Profile>::sendMonitorSetup(const char* command) {
+    if (elm327.sendCommand_Blocking(command) != ELM_SUCCESS) {
+        LOG_ERROR_F("Monitor setup command %s failed, adapter may not be an STN device", command);
+        elm327.printError();
+        return false;
     }
-    
-    LOG_ERROR("Total kWh discharged read failed");
-    elm327.printError();
-    handleTimeout(ErrorMessages::TOTAL_KWH_DISCHARGED_FAILED);
-    return false;
+    return true;
 }
 
-bool OBDManager::readAllData(VehicleData& data) {
-    data.isValid = false;
-    
-    if (!readStateOfCharge(data.stateOfCharge)) {
+template <typename Profile>
+bool BasicOBDManager<Profile>::pollMonitor(MonitorData& data) {
+    if (!monitoring) {
         return false;
     }
     
-    if (!readBatteryTemperature(data.batteryTemperature)) {
-        return false;
+    Stream* port = elm327.elm_port;
+    bool updated = false;
+    
+    while (port->available()) {
+        char c = (char)port->read();
+        
+        if (c == '\r' || c == '\n') {
+            if (monitorLength > 0) {
+                monitorLine[monitorLength] = '\0';
+                updated |= decodeMonitorLine(data);
+                monitorLength = 0;
+            }
+        } else if (c == '>') {
+            // The adapter left monitor mode (e.g. BUFFER FULL), restart it
+            LOG_WARNING("Monitor stopped by the adapter, restarting");
+            monitorLength = 0;
+            port->print("STM\r");
+        } else if (c != ' ' && monitorLength < sizeof(monitorLine) - 1) {
+            monitorLine[monitorLength++] = c;
+        }
     }
     
-    if (!readBatteryVoltage(data.batteryVoltage)) {
+    return updated;
+}
+
+template <typename Profile>
+bool BasicOBDManager<Profile>::decodeMonitorLine(MonitorData& data) {
+    // "<ID:3 hex><data bytes:2 hex each>", e.g. "4451A2B0000"
+    if (monitorLength < 5 || (monitorLength - 3) % 2 != 0) {
         return false;
     }
     
-    if (!readTotalCharges(data.totalCharges)) {
+    uint16_t id = (charToInt(monitorLine[0]) << 8) | (charToInt(monitorLine[1]) << 4) | charToInt(monitorLine[2]);
+    uint8_t bytes[8];
+    size_t count = (monitorLength - 3) / 2;
+    if (count > sizeof(bytes)) {
         return false;
     }
+    for (size_t i = 0; i < count; i++) {
+        bytes[i] = (charToInt(monitorLine[3 + i * 2]) << 4) | charToInt(monitorLine[4 + i * 2]);
+    }
     
-    if (!readTotalKwhCharged(data.totalKwhCharged)) {
-        return false;
+    bool matched = false;
+    for (int i = 0; i < Monitor_Config::SIGNAL_COUNT; i++) {
+        const Monitor_Config::Signal& signal = Monitor_Config::SIGNALS[i];
+        if (signal.canId != id || signal.startByte + signal.length > count) {
+            continue;
+        }
+        
+        const uint8_t* raw = bytes + signal.startByte;
+        int32_t value;
+        if (signal.length == 1) {
+            value = signal.isSigned ? (int8_t)raw[0] : raw[0];
+        } else {
+            uint16_t word = signal.bigEndian ? (raw[0] << 8) | raw[1] : (raw[1] << 8) | raw[0];
+            value = signal.isSigned ? (int16_t)word : word;
+        }
+        
+        data.values[(int)signal.field] = value * signal.scale + signal.offset;
+        data.updatedMask |= 1 << (int)signal.field;
+        matched = true;
     }
     
-    if (!readTotalKwhDischarged(data.totalKwhDischarged)) {
-        return false;
+    if (matched) {
+        data.frames++;
     }
+    return matched;
+}
 
-    data.isValid = true;
-    return true;
+template <typename Profile>
+void BasicOBDManager<Profile>::stopMonitor() {
+    if (!monitoring) {
+        return;
+    }
+    
+    LOG_INFO("Stopping passive monitor...");
+    Stream* port = elm327.elm_port;
+    
+    // Any character interrupts STM; the adapter answers with a prompt
+    port->print("\r");
+    unsigned long startTime = millis();
+    bool prompt = false;
+    while (!prompt && millis() - startTime < Monitor_Config::STOP_TIMEOUT) {
+        while (port->available()) {
+            prompt = prompt || port->read() == '>';
+        }
+        delay(Adaptive_Config::RESPONSE_POLL_MS);
+    }
+    monitoring = false;
+    transport->setRawMode(false);
+    transport->flush();
+    
+    if (!prompt) {
+        LOG_WARNING("No prompt after stopping the monitor");
+    }
+    
+    // Back to the settings the PID reads expect
+    elm327.sendCommand_Blocking("STFCP");
+    elm327.sendCommand_Blocking("ATCAF1");
 }
 
 uint8_t OBDManager::charToInt(uint8_t value) {
@@ -311,7 +711,8 @@ uint8_t OBDManager::charToInt(uint8_t value) {
         return 0;
 }
 
-void OBDManager::handleTimeout(const char* errorMsg) {
+template <typename Profile>
+void BasicOBDManager<Profile>::handleTimeout(const char* errorMsg) {
     LOG_ERROR_F("OBD timeout: %s", errorMsg);
     
     // Check if it's a Bluetooth-related timeout
@@ -326,10 +727,14 @@ void OBDManager::handleTimeout(const char* errorMsg) {
     }
 }
 
-void OBDManager::resetTimeoutCounter() {
+template <typename Profile>
+void BasicOBDManager<Profile>::resetTimeoutCounter() {
     if (consecutiveTimeouts > 0) {
         LOG_DEBUG_F("Resetting timeout counter from %d", consecutiveTimeouts);
         consecutiveTimeouts = 0;
         carConnectionLost = false;
     }
-}
\ No newline at end of file
+}
+
+template class BasicOBDManager<SealProfile>;
+template class BasicOBDManager<Atto3Profile>;
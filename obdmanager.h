@@ -3,52 +3,216 @@
 
 #include <Arduino.h>
 #include "ELMduino.h"
-#include "BLEClientSerial.h"
+#include "OBDTransport.h"
 #include "Config.h"
 #include "Logger.h"
+#include "Diagnostics.h"
+#include "AdaptiveTimeout.h"
+#include "VehicleProfiles.h"
+#include "CustomPids.h"
 
-struct VehicleData {
-    float stateOfCharge = 0.0;
-    float batteryTemperature = 0.0;
-    float batteryVoltage = 0.0;
-    float totalCharges = 0.0;
-    float totalKwhCharged = 0.0;
-    float totalKwhDischarged = 0.0;
-    bool isValid = false;
+// One reading of each PID kept as the car sent it (A + B*256) and scaled
+// by the decoders of the car's profile on access. 18 bytes instead of six
+// floats, so samples are cheap to queue and store, and nothing is lost to
+// rounding.
+struct __attribute__((packed)) VehicleData {
+    uint32_t capturedAt = 0;            // millis() of the latest field read
+    uint16_t raw[Pids::COUNT] = {};     // Indexed by Pids::indexOf()
+    uint8_t validMask = 0;              // Pids bits of the fields that were read
+    VehicleModel model = VehicleModel::SEAL;    // Whose decoders apply, set by the reads
+    
+    void set(uint8_t pid, uint16_t value) {
+        raw[Pids::indexOf(pid)] = value;
+        validMask |= pid;
+        capturedAt = millis();
+    }
+    bool isValid() const { return validMask == Pids::ALL; }   // Every field was read
+    
+    float stateOfCharge() const { return decode(Pids::SOC); }
+    float batteryTemperature() const { return decode(Pids::TEMP); }
+    float batteryVoltage() const { return decode(Pids::VOLTAGE); }
+    float totalCharges() const { return decode(Pids::TOTAL_CHARGES); }
+    float totalKwhCharged() const { return decode(Pids::KWH_CHARGED); }
+    float totalKwhDischarged() const { return decode(Pids::KWH_DISCHARGED); }
+    
+private:
+    float decode(uint8_t pid) const {
+        uint16_t value = raw[Pids::indexOf(pid)];
+        return visitProfile(model, [&](auto profile) {
+            return decodePid<decltype(profile)>(pid, value & 0xFF, value >> 8);
+        });
+    }
+};
+
+// Latest values decoded in monitor mode
+struct MonitorData {
+    float values[(int)MonitorField::COUNT] = {};
+    uint8_t updatedMask = 0;    // Bit per MonitorField, set when a value arrives
+    unsigned long frames = 0;   // Matching frames decoded
+};
+
+enum class CarState : uint8_t {
+    AWAKE,
+    ASLEEP
 };
 
+// A vehicle's link to its adapter and the reads from its car, whatever the
+// car's profile. create() picks the BasicOBDManager for the vehicle's model,
+// so each read is still compiled against that profile's constants
 class OBDManager {
 public:
-    OBDManager();
-    ~OBDManager();
+    virtual ~OBDManager() = default;
+    
+    // Allocated once per vehicle and kept for the lifetime of the device
+    static OBDManager* create(const VehicleConfig& vehicle);
+    
+    virtual const VehicleConfig& getVehicle() const = 0;
+    virtual const char* getProfileName() const = 0;
+    
+    virtual bool connect() = 0;
+    virtual void disconnect() = 0;
+    virtual bool isConnected() const = 0;
+    virtual bool takesWiFi() const = 0;       // See OBDTransport
+    
+    // Cheap check after connect(), before any PID: the 12 V level from
+    // ATRV, then one short request to the ECU if that doesn't show the car
+    // is on. A car that doesn't answer is asleep; its PIDs would only time out
+    virtual CarState checkAwake() = 0;
+    virtual float getAdapterVoltage() const = 0;    // From the last check, 0 if unknown
+    
+    // Each read stores its raw value in data and marks it valid
+    virtual bool readStateOfCharge(VehicleData& data) = 0;
+    virtual bool readBatteryTemperature(VehicleData& data) = 0;
+    virtual bool readBatteryVoltage(VehicleData& data) = 0;
+    virtual bool readAllData(VehicleData& data) = 0;     // True if any field was read, in planReads() order
+    virtual bool readTotalCharges(VehicleData& data) = 0;
+    virtual bool readTotalKwhCharged(VehicleData& data) = 0;
+    virtual bool readTotalKwhDischarged(VehicleData& data) = 0;
+    
+    // Every CustomPids entry, starting with those on the header already
+    // set. values and the bits of readMask are indexed like CustomPids;
+    // true if any was read
+    virtual bool readCustomPids(float values[Custom_Config::MAX_PIDS], uint32_t& readMask) = 0;
+    
+    virtual int getConsecutiveTimeouts() const = 0;
+    virtual bool isCarConnectionLost() const = 0;
+    virtual const char* getConnectError() const = 0;
+    virtual void resetTimeoutCounter() = 0;
+    
+    // Passive monitoring of broadcast frames (STN adapters only). Once
+    // started the adapter streams frames until stopMonitor(); call
+    // pollMonitor() often so the receive buffer doesn't overflow
+    virtual bool startMonitor() = 0;
+    virtual bool pollMonitor(MonitorData& data) = 0;     // True if any value was updated
+    virtual void stopMonitor() = 0;
+    virtual bool isMonitoring() const = 0;
+    
+    // Run the ELM327 initialization over an already open stream instead of
+    // the vehicle's transport
+    virtual bool attachStream(Stream& stream) = 0;
+    
+    // Order to read the PIDs in mask so each ECU header is set once: the
+    // PIDs on the header already set first, then one group per header.
+    // Fills order with Pids bits and returns how many there are
+    virtual int planReads(uint8_t mask, uint8_t order[Pids::COUNT]) const = 0;
+    virtual uint32_t getHeaderSwitches() const = 0;     // ATSH sent since construction
+    
+    // Learned latency of each PID, in Pids bit order
+    static const int PID_COUNT = 6;
+    virtual const AdaptiveTimeout& getPidTimeout(int index) const = 0;
+    virtual uint8_t getAdapterTimeout() const = 0;
+    
+    static uint8_t charToInt(uint8_t value);
+};
+
+// Profile is a vehicle profile policy (see VehicleProfiles.h). The member
+// definitions live in OBDManager.cpp, which instantiates every profile
+// visitProfile() lists
+template <typename Profile>
+class BasicOBDManager : public OBDManager {
+public:
+    BasicOBDManager();
+    explicit BasicOBDManager(const VehicleConfig& vehicle);
+    ~BasicOBDManager() override;
+    BasicOBDManager(const BasicOBDManager&) = delete;
+    BasicOBDManager& operator=(const BasicOBDManager&) = delete;
     
-    bool connect();
-    void disconnect();
-    bool isConnected() const { return connected; }
+    const VehicleConfig& getVehicle() const override { return *vehicle; }
+    const char* getProfileName() const override { return Profile::NAME; }
     
-    bool readStateOfCharge(float& soc);
-    bool readBatteryTemperature(float& temp);
-    bool readBatteryVoltage(float& voltage);
-    bool readAllData(VehicleData& data);
-    bool readTotalCharges(float& charges);
-    bool readTotalKwhCharged(float& kwh);
-    bool readTotalKwhDischarged(float& kwh);
+    bool connect() override;
+    void disconnect() override;
+    bool isConnected() const override { return connected; }
+    bool takesWiFi() const override { return connected && transport->takesWiFi(); }
     
-    int getConsecutiveTimeouts() const { return consecutiveTimeouts; }
-    bool isCarConnectionLost() const { return carConnectionLost; }
-    void resetTimeoutCounter();
+    CarState checkAwake() override;
+    float getAdapterVoltage() const override { return adapterVoltage; }
+    
+    bool readStateOfCharge(VehicleData& data) override;
+    bool readBatteryTemperature(VehicleData& data) override;
+    bool readBatteryVoltage(VehicleData& data) override;
+    bool readAllData(VehicleData& data) override;
+    bool readTotalCharges(VehicleData& data) override;
+    bool readTotalKwhCharged(VehicleData& data) override;
+    bool readTotalKwhDischarged(VehicleData& data) override;
+    bool readCustomPids(float values[Custom_Config::MAX_PIDS], uint32_t& readMask) override;
+    
+    int getConsecutiveTimeouts() const override { return consecutiveTimeouts; }
+    bool isCarConnectionLost() const override { return carConnectionLost; }
+    const char* getConnectError() const override { return connectError; }
+    void resetTimeoutCounter() override;
+    
+    bool startMonitor() override;
+    bool pollMonitor(MonitorData& data) override;
+    void stopMonitor() override;
+    bool isMonitoring() const override { return monitoring; }
+    
+    bool attachStream(Stream& stream) override;
+    
+    int planReads(uint8_t mask, uint8_t order[Pids::COUNT]) const override;
+    static uint16_t headerOf(uint8_t pid);
+    uint32_t getHeaderSwitches() const override { return headerSwitches; }
+    
+    const AdaptiveTimeout& getPidTimeout(int index) const override { return pidTimeouts[index]; }
+    uint8_t getAdapterTimeout() const override { return adapterTimeout; }
     
 private:
-    BLEClientSerial bleSerial;
+    const VehicleConfig* vehicle;
+    OBDTransport* transport;                  // From vehicle->transport, owned
     ELM327 elm327;
     bool connected;
     int consecutiveTimeouts;
     bool carConnectionLost;
+    const char* connectError;
+    bool elmStarted;
+    AdaptiveTimeout pidTimeouts[PID_COUNT];
+    AdaptiveTimeout customTimeout;            // Shared by the custom PIDs
+    uint8_t adapterTimeout;                   // ATST value currently programmed
+    uint16_t currentHeader;                   // ECU header currently set, 0 if unknown
+    uint32_t headerSwitches;                  // ATSH sent since construction
+    float adapterVoltage;
+    bool monitoring;
+    char monitorLine[Monitor_Config::MAX_LINE];
+    size_t monitorLength;
     
-    bool initializeELM327();
+    bool initializeELM327(Stream& stream);
+    bool beginELM327(Stream& stream);
+    void calibrateAdapterTimeout();
+    bool sendMonitorSetup(const char* command);
+    bool decodeMonitorLine(MonitorData& data);
     bool sendCommandWithTimeout(const char* command, unsigned long timeout);
-    uint8_t charToInt(uint8_t value);
+    bool selectHeader(uint16_t header);
+    int8_t waitForResponse(unsigned long startTime, unsigned long timeout);
+    bool queryPID(uint16_t header, const char* command, Stage stage, const char* name,
+                  const char* timeoutError, const char* failError);
+    bool readCustomPid(const CustomPid& pid, float& value);
+    int responseByte(int index);
+    uint16_t responseWord();
+    void store(VehicleData& data, uint8_t pid);
     void handleTimeout(const char* errorMsg);
 };
 
-#endif // OBD_MANAGER_H
\ No newline at end of file
+extern template class BasicOBDManager<SealProfile>;
+extern template class BasicOBDManager<Atto3Profile>;
+
+#endif // OBD_MANAGER_H
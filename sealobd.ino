@@ -5,9 +5,80 @@
 #include "MQTTNetworkManager.h"
 #include "TimeManager.h"
 #include "LEDManager.h"
+#include "Diagnostics.h"
+#include "Backoff.h"
+#include "MetricsEngine.h"
+#include "SampleBus.h"
+#include "ChargeCapture.h"
+#include "CustomPids.h"
+#if LAN_SERVER_ENABLED
+#include "LANServer.h"
+#endif
+#include "BLETrace.h"
+#if BENCHMARK_ENABLED
+#include "Benchmark.h"
+#endif
+
+// Per-vehicle polling state. Vehicles share the radios and are read one
+// at a time, each on its own schedule, so a car that is asleep or out of
+// range only delays its own next attempt
+struct Vehicle {
+    OBDManager* obd = nullptr;
+    VehicleData data;
+    const char* status = ErrorMessages::CONNECTED;
+    const char* lastError = nullptr; // Last PID failure of the current pass
+    Backoff backoff;
+    unsigned long nextPollTime = 0;
+    bool pendingPublish = false;     // Read (or failed) since the last publish
+    uint8_t readMask = Pids::ALL;    // PIDs read in the current pass
+    uint8_t readOrder[Pids::COUNT];  // readMask grouped by ECU header, see OBDManager::planReads()
+    int readCount = 0;
+    bool charging = false;           // Charge session being captured, see ChargeCapture
+    bool capturePass = false;        // Current pass only feeds the capture
+    uint8_t publishMask = 0;         // PIDs read but not yet published, partial reads included
+    DerivedMetrics metrics;          // From the last pass, published with it
+    int errorCode = 0;               // LED flash code of the last failed pass, 0 if none
+    float customValues[Custom_Config::MAX_PIDS] = {};
+    uint32_t customMask = 0;         // CustomPids read but not yet published
+    
+    // Set from the MQTT command channel
+    uint8_t demandMask = 0;          // PIDs requested for an immediate read
+    unsigned long interval = Intervals::NORMAL_UPDATE;
+    unsigned long burstInterval = 0;
+    unsigned long burstEndTime = 0;
+    bool monitorRequested = false;
+    unsigned long monitorEndTime = 0;
+    
+    // Passive monitor session
+    MonitorData monitorData;
+    unsigned long lastMonitorPublish = 0;
+};
+
+// State that reads each PID; the order they run in comes from the OBD manager
+struct ReadStep {
+    AppState state;
+    uint8_t pid;
+};
+
+const ReadStep READ_STATES[] = {
+    { AppState::OBD_READ_SOC, Pids::SOC },
+    { AppState::OBD_READ_BATTERY_TEMP, Pids::TEMP },
+    { AppState::OBD_READ_BATTERY_VOLTAGE, Pids::VOLTAGE },
+    { AppState::OBD_CHARGE_TIMES, Pids::TOTAL_CHARGES },
+    { AppState::OBD_TOTAL_CHARGED_KWH, Pids::KWH_CHARGED },
+    { AppState::OBD_TOTAL_DISCHARGED_KWH, Pids::KWH_DISCHARGED },
+};
 
 // Global Objects
-OBDManager obdManager;
+Vehicle vehicles[Vehicles::COUNT];
+int currentVehicle = 0;
+Backoff networkBackoff;
+SampleBus sampleBus;            // OBD passes out to the consumers below
+int metricsSubscriber = SampleBus::NO_SUBSCRIBER;
+ChargeCapture chargeCapture;    // Charge curve of one vehicle at a time
+#if LAN_SERVER_ENABLED
+LANServer lanServer(sampleBus);
+#endif
 MQTTNetworkManager networkManager;
 TimeManager timeManager;
 LEDManager ledManager;  // LED manager
@@ -17,9 +88,6 @@ AppState currentState = AppState::OBD_SETUP;
 unsigned long lastUpdateTime = 0;
 unsigned long updateInterval = Intervals::INITIAL_DELAY;
 
-// Vehicle Data
-VehicleData vehicleData;
-
 // Function declarations
 void processStateMachine();
 void handleOBDSetup();
@@ -29,12 +97,38 @@ void handleOBDReadVoltage();
 void handleOBDReadTotalCharges();
 void handleOBDReadKwhCharged();
 void handleOBDReadKwhDischarged();
+void handleOBDReadCustom();
 void handleWiFiConnect();
 void handleNTPSync();
 void handleMQTTConnect();
 void handleMQTTPublish();
 void handleWaitCycle();
-void handleError(const char* errorMessage);
+void handleOBDMonitor();
+void startMonitor(Vehicle& vehicle);
+void publishMonitor(Vehicle& vehicle);
+void handleVehicleError(const char* errorMessage, FailureType failure);
+void handleVehicleAsleep();
+void handlePidResult(bool success, uint8_t pid, const char* errorMessage);
+void beginRead(Vehicle& vehicle);
+void continueRead(int fromStep);
+void finishVehicleRead();
+void startCycle();
+void nextVehicle();
+int findDueVehicle(int from);
+bool hasPendingPublish();
+void scheduleWait(unsigned long maxInterval);
+bool isScheduleDue(const Vehicle& vehicle);
+bool inBurst(const Vehicle& vehicle);
+bool holdsLink(const Vehicle& vehicle);
+unsigned long pollInterval(const Vehicle& vehicle);
+void subscribeCommands();
+void applyCommand(const Command& command);
+void applyCommand(Vehicle& vehicle, const Command& command);
+void publishSample(int index);
+void consumeSamples();
+void publishVehicle(int index, const char* timestamp);
+void publishDiagnosticsIfDue();
+void showFailure(FailureType failure);
 void cleanup();
 
 void setup() {
@@ -56,10 +150,35 @@ void setup() {
     LOG_INFO("=================================");
     LOG_INFO("SealOBD System Starting...");
     LOG_INFO("=================================");
-    LOG_INFO_F("Version: 2.0.0");
+    LOG_INFO_F("Version: %s", FIRMWARE_VERSION);
     LOG_INFO_F("Normal Update Interval: %d ms", Intervals::NORMAL_UPDATE);
     LOG_INFO_F("Error Retry Interval: %d ms", Intervals::ERROR_RETRY);
     
+    // One OBD manager per configured vehicle, created once and kept for the
+    // lifetime of the device
+    for (int i = 0; i < Vehicles::COUNT; i++) {
+        vehicles[i].obd = OBDManager::create(Vehicles::LIST[i]);
+        LOG_INFO_F("Vehicle %d: %s, %s (topics under %s/)", i, Vehicles::LIST[i].name,
+                   vehicles[i].obd->getProfileName(), Vehicles::LIST[i].topicPrefix);
+    }
+    
+    // Restore per-stage latency statistics kept in RTC memory
+    Diagnostics::begin();
+    MetricsEngine::begin();
+    CustomPids::load(Custom_Config::FILE_PATH);
+    metricsSubscriber = sampleBus.subscribe("metrics");
+#if LAN_SERVER_ENABLED
+    lanServer.begin();
+#endif
+    
+#if BENCHMARK_ENABLED
+    Benchmark::runAll();
+#endif
+    
+    // Start recording BLE traffic (after the benchmarks, which replay the
+    // previous recording)
+    BLETrace::begin();
+    
     // Brief startup delay to show startup LED and ensure all systems ready
     delay(2000);
     
@@ -79,14 +198,32 @@ void loop() {
     // Poll MQTT if connected (non-blocking)
     networkManager.pollMQTT();
     
-    // Check if it's time for an update
+    // Hand new samples to their consumers
+    consumeSamples();
+#if LAN_SERVER_ENABLED
+    lanServer.poll();
+#endif
+    
+    // Commands preempt the wait cycle
     unsigned long currentTime = millis();
+    Command command;
+    bool commandReceived = false;
+    while (networkManager.takeCommand(command)) {
+        applyCommand(command);
+        commandReceived = true;
+    }
+    if (commandReceived && currentState == AppState::WAIT_CYCLE) {
+        scheduleWait(Intervals::NORMAL_UPDATE);
+        lastUpdateTime = currentTime;
+    }
+    
+    // Check if it's time for an update
     if (currentTime - lastUpdateTime >= updateInterval) {
         // Special handling for wait cycle - restart the cycle
         if (currentState == AppState::WAIT_CYCLE) {
             LOG_INFO("Wait cycle complete, starting new cycle...");
-            currentState = AppState::OBD_SETUP;
-            updateInterval = Intervals::INITIAL_DELAY;
+            Diagnostics::cycleComplete();
+            startCycle();
         }
         
         processStateMachine();
@@ -127,6 +264,10 @@ void processStateMachine() {
             handleOBDReadKwhDischarged();
             break;
             
+        case AppState::OBD_READ_CUSTOM:
+            handleOBDReadCustom();
+            break;
+            
         case AppState::WIFI_CONNECT:
             handleWiFiConnect();
             break;
@@ -146,21 +287,51 @@ void processStateMachine() {
         case AppState::WAIT_CYCLE:
             handleWaitCycle();
             break;
+            
+        case AppState::OBD_MONITOR:
+            handleOBDMonitor();
+            break;
     }
 }
 
 void handleOBDSetup() {
-    LOG_INFO("Step 1: Setting up OBD connection...");
+    Vehicle& vehicle = vehicles[currentVehicle];
+    
+    // A scheduled read covers every PID, an on-demand one only those asked
+    // for, and one while charging only what the charge curve needs
+    vehicle.capturePass = vehicle.charging && isScheduleDue(vehicle) && vehicle.demandMask == 0;
+    vehicle.readMask = vehicle.capturePass ? Charge_Config::PIDS :
+                       isScheduleDue(vehicle) ? Pids::ALL : vehicle.demandMask;
+    vehicle.demandMask = 0;
+    vehicle.data.validMask = 0;
+    vehicle.lastError = nullptr;
+    
+    if (vehicle.obd->isConnected()) {
+        // Link kept open during a burst or while charging
+        beginRead(vehicle);
+        return;
+    }
+    
+    LOG_INFO_F("Step 1: Setting up OBD connection to %s...", vehicle.obd->getVehicle().name);
     ledManager.indicateSetup();  // Purple LED for setup
     
-    if (obdManager.connect()) {
+    if (vehicle.obd->connect()) {
         LOG_INFO("OBD connection successful");
-        currentState = AppState::OBD_READ_SOC;
+        // A sleeping car would only run every PID into its timeout
+        if (vehicle.obd->checkAwake() == CarState::ASLEEP) {
+            handleVehicleAsleep();
+            return;
+        }
+        beginRead(vehicle);
     } else {
         LOG_ERROR("OBD connection failed");
-        handleError(obdManager.isCarConnectionLost() ? 
-                   ErrorMessages::NO_CAR : 
-                   ErrorMessages::BLE_TIMEOUT);
+        const char* error = vehicle.obd->getConnectError();
+        if (vehicle.obd->isCarConnectionLost()) {
+            handleVehicleError(ErrorMessages::NO_CAR, FailureType::NO_RESPONSE);
+        } else {
+            bool notFound = error == ErrorMessages::BLE_NOT_FOUND || error == ErrorMessages::ADAPTER_NOT_FOUND;
+            handleVehicleError(error, notFound ? FailureType::NOT_FOUND : FailureType::CONNECT);
+        }
     }
 }
 
@@ -168,79 +339,81 @@ void handleOBDReadSOC() {
     LOG_INFO("Step 2: Reading State of Charge...");
     ledManager.indicateOBDReading();  // GREEN LED for OBD reading
     
-    if (obdManager.readStateOfCharge(vehicleData.stateOfCharge)) {
-        currentState = AppState::OBD_READ_BATTERY_TEMP;
-    } else {
-        handleError(ErrorMessages::SOC_FAILED);
-    }
+    Vehicle& vehicle = vehicles[currentVehicle];
+    handlePidResult(vehicle.obd->readStateOfCharge(vehicle.data), Pids::SOC, ErrorMessages::SOC_FAILED);
 }
 
 void handleOBDReadTemp() {
     LOG_INFO("Step 3: Reading Battery Temperature...");
     ledManager.indicateOBDReading();  // GREEN LED for OBD reading
     
-    if (obdManager.readBatteryTemperature(vehicleData.batteryTemperature)) {
-        currentState = AppState::OBD_READ_BATTERY_VOLTAGE;
-    } else {
-        handleError(ErrorMessages::TEMP_FAILED);
-    }
+    Vehicle& vehicle = vehicles[currentVehicle];
+    handlePidResult(vehicle.obd->readBatteryTemperature(vehicle.data), Pids::TEMP, ErrorMessages::TEMP_FAILED);
 }
 
 void handleOBDReadVoltage() {
     LOG_INFO("Step 4: Reading Battery Voltage...");
     ledManager.indicateOBDReading();  // GREEN LED for OBD reading
     
-    if (obdManager.readBatteryVoltage(vehicleData.batteryVoltage)) {
-        currentState = AppState::OBD_CHARGE_TIMES;
-    } else {
-        handleError(ErrorMessages::VOLTAGE_FAILED);
-    }
+    Vehicle& vehicle = vehicles[currentVehicle];
+    handlePidResult(vehicle.obd->readBatteryVoltage(vehicle.data), Pids::VOLTAGE, ErrorMessages::VOLTAGE_FAILED);
 }
 
 void handleOBDReadTotalCharges() {
     LOG_INFO("Step 5: Reading total amount of charges...");
     ledManager.indicateOBDReading();  // GREEN LED for OBD reading
     
-    if (obdManager.readTotalCharges(vehicleData.totalCharges)) {
-        currentState = AppState::OBD_TOTAL_CHARGED_KWH;
-    } else {
-        handleError(ErrorMessages::TIMES_CHARGED_FAILED);
-    }
+    Vehicle& vehicle = vehicles[currentVehicle];
+    handlePidResult(vehicle.obd->readTotalCharges(vehicle.data), Pids::TOTAL_CHARGES, ErrorMessages::TIMES_CHARGED_FAILED);
 }
 
 void handleOBDReadKwhCharged() {
     LOG_INFO("Step 6: Reading total kWh charged...");
     ledManager.indicateOBDReading();  // GREEN LED for OBD reading
     
-    if (obdManager.readTotalKwhCharged(vehicleData.totalKwhCharged)) {
-        currentState = AppState::OBD_TOTAL_DISCHARGED_KWH;
-    } else {
-        handleError(ErrorMessages::TOTAL_KWH_CHARGED_FAILED);
-    }
+    Vehicle& vehicle = vehicles[currentVehicle];
+    handlePidResult(vehicle.obd->readTotalKwhCharged(vehicle.data), Pids::KWH_CHARGED, ErrorMessages::TOTAL_KWH_CHARGED_FAILED);
 }
 
 void handleOBDReadKwhDischarged() {
     LOG_INFO("Step 7: Reading total kWh discharged...");
     ledManager.indicateOBDReading();  // GREEN LED for OBD reading
     
-    if (obdManager.readTotalKwhDischarged(vehicleData.totalKwhDischarged)) {
-        vehicleData.isValid = true;
-        currentState = AppState::WIFI_CONNECT;
-    } else {
-        handleError(ErrorMessages::TOTAL_KWH_DISCHARGED_FAILED);
-    }
+    Vehicle& vehicle = vehicles[currentVehicle];
+    handlePidResult(vehicle.obd->readTotalKwhDischarged(vehicle.data), Pids::KWH_DISCHARGED, ErrorMessages::TOTAL_KWH_DISCHARGED_FAILED);
+}
+
+void handleOBDReadCustom() {
+    LOG_INFO_F("Reading %d custom PIDs...", CustomPids::count());
+    ledManager.indicateOBDReading();  // GREEN LED for OBD reading
+    
+    Vehicle& vehicle = vehicles[currentVehicle];
+    uint32_t read = 0;
+    vehicle.obd->readCustomPids(vehicle.customValues, read);
+    vehicle.customMask |= read;
+    
+    // Custom PID failures never fail the pass, the built-in values stand
+    finishVehicleRead();
 }
 
 void handleWiFiConnect() {
     LOG_INFO("Step 8: Connecting to WiFi...");
     ledManager.indicateNetworkOperation();  // Blue LED for network operations
     
+    // A link kept open (burst, charging) to a WiFi adapter with its own
+    // network holds WiFi away from the broker; it reconnects next pass
+    for (Vehicle& vehicle : vehicles) {
+        if (vehicle.obd->takesWiFi()) {
+            vehicle.obd->disconnect();
+        }
+    }
+    
     if (networkManager.connectWiFi()) {
         currentState = AppState::NTP_SYNC;
     } else {
         LOG_ERROR("WiFi connection failed, retrying next cycle");
-        currentState = AppState::WAIT_CYCLE;
-        updateInterval = Intervals::ERROR_RETRY;
+        scheduleWait(networkBackoff.nextDelay(FailureType::NETWORK));
+        showFailure(FailureType::NETWORK);
     }
 }
 
@@ -248,25 +421,34 @@ void handleNTPSync() {
     LOG_INFO("Step 9: Synchronizing time...");
     ledManager.indicateNetworkOperation();  // Blue LED for network operations
     
-    if (timeManager.syncWithNTP()) {
-        currentState = AppState::MQTT_CONNECT;
-    } else {
+    if (!timeManager.needsSync()) {
+        LOG_INFO_F("Clock within drift budget (~%lu ms), skipping NTP", timeManager.getExpectedErrorMs());
+    } else if (timeManager.isSynced()) {
+        // Clock is still usable, let SNTP correct it in the background
+        timeManager.startSync();
+    } else if (!timeManager.syncWithNTP()) {
         LOG_WARNING("NTP sync failed, continuing without time sync");
-        currentState = AppState::MQTT_CONNECT;
     }
+    
+    currentState = AppState::MQTT_CONNECT;
 }
 
 void handleMQTTConnect() {
     LOG_INFO("Step 10: Connecting to MQTT broker...");
     ledManager.indicateNetworkOperation();  // Blue LED for network operations
     
+    bool wasConnected = networkManager.isMQTTConnected();
     if (networkManager.connectMQTT()) {
+        if (!wasConnected) {
+            subscribeCommands();
+        }
+        networkBackoff.reset();
         currentState = AppState::MQTT_PUBLISH;
     } else {
         LOG_ERROR("MQTT connection failed");
         cleanup();
-        currentState = AppState::WAIT_CYCLE;
-        updateInterval = Intervals::ERROR_RETRY;
+        scheduleWait(networkBackoff.nextDelay(FailureType::NETWORK));
+        showFailure(FailureType::NETWORK);
     }
 }
 
@@ -274,50 +456,115 @@ void handleMQTTPublish() {
     LOG_INFO("Step 11: Publishing data to MQTT...");
     ledManager.indicateNetworkOperation();  // Blue LED for network operations
     
-    // Publish status
-    const char* status = obdManager.isCarConnectionLost() ? 
-                        ErrorMessages::NO_CAR : 
-                        ErrorMessages::CONNECTED;
-    networkManager.publishStatus(status);
-    
-    // Publish vehicle data if valid
-    if (vehicleData.isValid && !obdManager.isCarConnectionLost()) {
-        networkManager.publishFloat(MQTT::TOPIC_SOC, vehicleData.stateOfCharge);
-        networkManager.publishFloat(MQTT::TOPIC_TEMP, vehicleData.batteryTemperature);
-        networkManager.publishFloat(MQTT::TOPIC_VOLTAGE, vehicleData.batteryVoltage);
-        networkManager.publishFloat(MQTT::TOPIC_CHARGES_UPDATE, vehicleData.totalCharges);
-        networkManager.publishFloat(MQTT::TOPIC_KWH_CHARGED_UPDATE, vehicleData.totalKwhCharged);
-        networkManager.publishFloat(MQTT::TOPIC_KWH_DISCHARGED_UPDATE, vehicleData.totalKwhDischarged);
-        
-        LOG_INFO("=== Vehicle Data Published ===");
-        LOG_INFO_F("SoC: %.2f%%", vehicleData.stateOfCharge);
-        LOG_INFO_F("Temperature: %.1f°C", vehicleData.batteryTemperature);
-        LOG_INFO_F("Voltage: %.2fV", vehicleData.batteryVoltage);
-        LOG_INFO_F("Total charges: %.0f", vehicleData.totalCharges);
-        LOG_INFO_F("Total kWh charged: %.2f kWh", vehicleData.totalKwhCharged);
-        LOG_INFO_F("Total kWh discharged: %.2f kWh", vehicleData.totalKwhDischarged);
+    char timestamp[64];
+    timeManager.getCurrentTimestamp(timestamp, sizeof(timestamp));
+    
+    for (int i = 0; i < Vehicles::COUNT; i++) {
+        if (vehicles[i].pendingPublish) {
+            publishVehicle(i, timestamp);
+        }
+    }
+    
+    // Device-wide topics stay under the device prefix
+    networkManager.setTopicPrefix(MQTT::DEVICE_PREFIX);
+    networkManager.publishHeap();
+    publishDiagnosticsIfDue();
+    // Last, so the cycle's radio time includes the publishing above
+    networkManager.publishRadioStats();
+    
+    // Cleanup and prepare for next cycle. With the command channel on the
+    // network stays up, and bursting or charging vehicles keep their OBD link
+    if (Commands::ENABLED) {
+        for (Vehicle& vehicle : vehicles) {
+            if (!holdsLink(vehicle)) {
+                vehicle.obd->disconnect();
+            }
+        }
+    } else {
+        cleanup();
+    }
+    
+    LOG_INFO("Cycle complete, setting up wait cycle...");
+    scheduleWait(Intervals::NORMAL_UPDATE);
+    
+    // Set LED to yellow for waiting, flashing the code of a failed vehicle
+    ledManager.setColor(LED::YELLOW);
+    LOG_INFO("LED set to YELLOW for wait cycle");
+    for (const Vehicle& vehicle : vehicles) {
+        if (vehicle.errorCode != 0) {
+            ledManager.showCode(LED::RED, vehicle.errorCode);
+            break;
+        }
+    }
+}
+
+void publishVehicle(int index, const char* timestamp) {
+    Vehicle& vehicle = vehicles[index];
+    const VehicleConfig& config = vehicle.obd->getVehicle();
+    networkManager.setTopicPrefix(config.topicPrefix);
+    networkManager.publishStatus(vehicle.status);
+    
+    // Publish the values read since the last publish, even if others failed
+    VehicleSample sample;
+    if (vehicle.publishMask != 0 && sampleBus.latest(index, sample)) {
+        const VehicleData& data = sample.data;
+        uint8_t mask = vehicle.publishMask;
+        LOG_INFO_F("=== %s Data Published ===", config.name);
+        if (mask & Pids::SOC) {
+            networkManager.publishFloat(MQTT::TOPIC_SOC, data.stateOfCharge());
+            LOG_INFO_F("SoC: %.2f%%", data.stateOfCharge());
+        }
+        if (mask & Pids::TEMP) {
+            networkManager.publishFloat(MQTT::TOPIC_TEMP, data.batteryTemperature());
+            LOG_INFO_F("Temperature: %.1f°C", data.batteryTemperature());
+        }
+        if (mask & Pids::VOLTAGE) {
+            networkManager.publishFloat(MQTT::TOPIC_VOLTAGE, data.batteryVoltage());
+            LOG_INFO_F("Voltage: %.2fV", data.batteryVoltage());
+        }
+        if (mask & Pids::TOTAL_CHARGES) {
+            networkManager.publishFloat(MQTT::TOPIC_CHARGES_UPDATE, data.totalCharges());
+            LOG_INFO_F("Total charges: %.0f", data.totalCharges());
+        }
+        if (mask & Pids::KWH_CHARGED) {
+            networkManager.publishFloat(MQTT::TOPIC_KWH_CHARGED_UPDATE, data.totalKwhCharged());
+            LOG_INFO_F("Total kWh charged: %.2f kWh", data.totalKwhCharged());
+        }
+        if (mask & Pids::KWH_DISCHARGED) {
+            networkManager.publishFloat(MQTT::TOPIC_KWH_DISCHARGED_UPDATE, data.totalKwhDischarged());
+            LOG_INFO_F("Total kWh discharged: %.2f kWh", data.totalKwhDischarged());
+        }
         LOG_INFO("==============================");
         
         // Brief success indication with green blink
         ledManager.blink(LED::GREEN, 2, 300);
     }
     
-    // Publish timestamp
-    String timestamp = timeManager.getCurrentTimestamp();
-    networkManager.publishLastUpdate(timestamp.c_str());
+    for (int i = 0; i < CustomPids::count(); i++) {
+        if (vehicle.customMask & (1UL << i)) {
+            networkManager.publishFloat(CustomPids::get(i).topic, vehicle.customValues[i]);
+        }
+    }
+    vehicle.customMask = 0;
     
-    // Cleanup and prepare for next cycle
-    cleanup();
+    if (vehicle.metrics.validMask != 0) {
+        networkManager.publishMetrics(vehicle.metrics);
+        vehicle.metrics.validMask = 0;
+    }
     
-    LOG_INFO("Cycle complete, setting up wait cycle...");
+    // Kept for the next publish if the upload fails
+    if (chargeCapture.hasSession(index)) {
+        if (networkManager.publishChargeSession(chargeCapture)) {
+            chargeCapture.clearSession();
+        } else {
+            chargeCapture.uploadFailed();
+        }
+    }
     
-    // Set up wait cycle
-    currentState = AppState::WAIT_CYCLE;
-    updateInterval = Intervals::NORMAL_UPDATE;
+    networkManager.publishLastUpdate(timestamp);
     
-    // Set LED to yellow for waiting
-    ledManager.setColor(LED::YELLOW);
-    LOG_INFO("LED set to YELLOW for wait cycle");
+    vehicle.pendingPublish = false;
+    vehicle.publishMask = 0;
 }
 
 void handleWaitCycle() {
@@ -327,54 +574,455 @@ void handleWaitCycle() {
     // State transition is handled in main loop
 }
 
-void handleError(const char* errorMessage) {
-    LOG_ERROR_F("Error occurred: %s", errorMessage);
-    ledManager.indicateError();  // Red LED for errors
+void handleOBDMonitor() {
+    Vehicle& vehicle = vehicles[currentVehicle];
+    unsigned long now = millis();
+    
+    if (vehicle.monitorRequested) {
+        startMonitor(vehicle);
+        return;
+    }
     
-    // Try to report error via MQTT if possible (with timeouts to prevent hanging)
-    bool mqttReportAttempted = false;
+    // Runs on every loop pass (updateInterval is 0) so the receive buffer
+    // is drained as frames arrive
+    vehicle.obd->pollMonitor(vehicle.monitorData);
     
-    if (!networkManager.isWiFiConnected()) {
-        // Try WiFi connection with shorter timeout when in error state
-        networkManager.connectWiFi();
+    if (now - vehicle.lastMonitorPublish >= Monitor_Config::PUBLISH_INTERVAL) {
+        publishMonitor(vehicle);
+        vehicle.lastMonitorPublish = now;
     }
     
-    if (networkManager.isWiFiConnected()) {
-        if (!timeManager.isSynced()) {
-            timeManager.syncWithNTP();
+    if ((long)(now - vehicle.monitorEndTime) >= 0) {
+        LOG_INFO_F("%s: monitor session over, %lu frames decoded", 
+                   vehicle.obd->getVehicle().name, vehicle.monitorData.frames);
+        publishMonitor(vehicle);
+        vehicle.obd->stopMonitor();
+        if (!holdsLink(vehicle)) {
+            vehicle.obd->disconnect();
         }
-        
-        if (!networkManager.isMQTTConnected()) {
-            networkManager.connectMQTT();
+        scheduleWait(Intervals::NORMAL_UPDATE);
+        ledManager.setColor(LED::YELLOW);
+    }
+}
+
+void startMonitor(Vehicle& vehicle) {
+    LOG_INFO_F("Starting monitor session on %s...", vehicle.obd->getVehicle().name);
+    ledManager.indicateSetup();  // Purple LED for setup
+    vehicle.monitorRequested = false;
+    
+    // Values are published while streaming, which the adapter's own WiFi
+    // network can't carry
+    const VehicleConfig& config = vehicle.obd->getVehicle();
+    if (config.transport == Transport::TCP && config.deviceName[0] != '\0') {
+        LOG_ERROR("Monitor mode needs WiFi to the broker, not available with this adapter");
+        handleVehicleError(ErrorMessages::MONITOR_FAILED, FailureType::CONNECT);
+        return;
+    }
+    
+    // Bring the network up first, the adapter streams as soon as STM is sent
+    if (networkManager.connectWiFi()) {
+        bool wasConnected = networkManager.isMQTTConnected();
+        if (networkManager.connectMQTT() && !wasConnected) {
+            subscribeCommands();
         }
+    }
+    
+    if (!vehicle.obd->isConnected() && !vehicle.obd->connect()) {
+        handleVehicleError(vehicle.obd->getConnectError(), FailureType::CONNECT);
+        return;
+    }
+    
+    if (!vehicle.obd->startMonitor()) {
+        handleVehicleError(ErrorMessages::MONITOR_FAILED, FailureType::CONNECT);
+        return;
+    }
+    
+    vehicle.monitorData = MonitorData();
+    vehicle.lastMonitorPublish = millis();
+    ledManager.indicateOBDReading();  // GREEN LED while frames stream in
+    updateInterval = Intervals::INITIAL_DELAY;
+}
+
+void publishMonitor(Vehicle& vehicle) {
+    MonitorData& data = vehicle.monitorData;
+    if (data.updatedMask == 0 || !networkManager.isMQTTConnected()) {
+        return;
+    }
+    
+    networkManager.setTopicPrefix(vehicle.obd->getVehicle().topicPrefix);
+    if (data.updatedMask & (1 << (int)MonitorField::SOC)) {
+        networkManager.publishFloat(MQTT::TOPIC_SOC, data.values[(int)MonitorField::SOC]);
+    }
+    if (data.updatedMask & (1 << (int)MonitorField::VOLTAGE)) {
+        networkManager.publishFloat(MQTT::TOPIC_VOLTAGE, data.values[(int)MonitorField::VOLTAGE]);
+    }
+    if (data.updatedMask & (1 << (int)MonitorField::CURRENT)) {
+        networkManager.publishFloat(MQTT::TOPIC_CURRENT, data.values[(int)MonitorField::CURRENT]);
+    }
+    
+    char timestamp[64];
+    timeManager.getCurrentTimestamp(timestamp, sizeof(timestamp));
+    networkManager.publishLastUpdate(timestamp);
+    networkManager.setTopicPrefix(MQTT::DEVICE_PREFIX);
+    
+    data.updatedMask = 0;
+}
+
+void handleVehicleError(const char* errorMessage, FailureType failure) {
+    Vehicle& vehicle = vehicles[currentVehicle];
+    LOG_ERROR_F("Error occurred on %s: %s", vehicle.obd->getVehicle().name, errorMessage);
+    ledManager.indicateError();  // Red LED for errors
+    
+    // The error is reported with the other vehicles' data once the network
+    // is up, along with anything read before it; only this vehicle backs off
+    vehicle.obd->disconnect();
+    chargeCapture.stop(currentVehicle);
+    vehicle.charging = false;
+    vehicle.publishMask |= vehicle.data.validMask;
+    if (vehicle.data.validMask != 0) {
+        publishSample(currentVehicle);
+    }
+    vehicle.status = errorMessage;
+    vehicle.errorCode = (int)failure + 1;
+    vehicle.pendingPublish = true;
+    vehicle.nextPollTime = millis() + vehicle.backoff.nextDelay(failure);
+    
+    nextVehicle();
+}
+
+void handleVehicleAsleep() {
+    Vehicle& vehicle = vehicles[currentVehicle];
+    LOG_INFO_F("%s is asleep, checking again in %lu s", vehicle.obd->getVehicle().name,
+               Sleep_Config::POLL_INTERVAL / 1000);
+    
+    // A parked car is the normal case, not a failure: no flash code, and a
+    // fixed interval instead of the backoff, so a car that wakes to charge
+    // is seen within POLL_INTERVAL. The adapter answered, so its backoff
+    // starts over
+    vehicle.obd->disconnect();
+    chargeCapture.stop(currentVehicle);
+    vehicle.charging = false;
+    vehicle.status = ErrorMessages::CAR_ASLEEP;
+    vehicle.errorCode = 0;
+    vehicle.pendingPublish = true;
+    vehicle.backoff.reset();
+    vehicle.nextPollTime = millis() + Sleep_Config::POLL_INTERVAL;
+    
+    nextVehicle();
+}
+
+void handlePidResult(bool success, uint8_t pid, const char* errorMessage) {
+    Vehicle& vehicle = vehicles[currentVehicle];
+    
+    if (success) {
+        vehicle.data.validMask |= pid;
+    } else {
+        LOG_WARNING_F("%s failed, continuing with the remaining PIDs", errorMessage);
+        vehicle.lastError = errorMessage;
         
-        if (networkManager.isMQTTConnected()) {
-            networkManager.publishStatus(errorMessage);
-            String timestamp = timeManager.getCurrentTimestamp();
-            networkManager.publishLastUpdate(timestamp.c_str());
-            mqttReportAttempted = true;
+        // Not worth asking for the rest once the car stops answering
+        if (vehicle.obd->isCarConnectionLost()) {
+            handleVehicleError(ErrorMessages::NO_CAR, FailureType::NO_RESPONSE);
+            return;
+        }
+    }
+    
+    for (int i = 0; i < vehicle.readCount; i++) {
+        if (vehicle.readOrder[i] == pid) {
+            continueRead(i + 1);
+            return;
+        }
+    }
+}
+
+void beginRead(Vehicle& vehicle) {
+    // Planned once per pass, after connecting, so it starts on the header
+    // the adapter already has
+    vehicle.readCount = vehicle.obd->planReads(vehicle.readMask, vehicle.readOrder);
+    continueRead(0);
+}
+
+void continueRead(int fromStep) {
+    // Move to the state reading the next planned PID
+    const Vehicle& vehicle = vehicles[currentVehicle];
+    if (fromStep < vehicle.readCount) {
+        for (const ReadStep& step : READ_STATES) {
+            if (step.pid == vehicle.readOrder[fromStep]) {
+                currentState = step.state;
+                return;
+            }
+        }
+    }
+    // Full passes also read the custom PIDs, after the built-in ones
+    if (fromStep == vehicle.readCount && vehicle.readMask == Pids::ALL && CustomPids::count() > 0) {
+        currentState = AppState::OBD_READ_CUSTOM;
+        return;
+    }
+    finishVehicleRead();
+}
+
+void finishVehicleRead() {
+    Vehicle& vehicle = vehicles[currentVehicle];
+    uint8_t missing = vehicle.readMask & ~vehicle.data.validMask;
+    
+    if (vehicle.data.validMask == 0) {
+        handleVehicleError(vehicle.lastError, FailureType::NO_RESPONSE);
+        return;
+    }
+    
+    // Passes while charging go into the capture instead of being published;
+    // the session is published once, when it ends
+    chargeCapture.add(currentVehicle, vehicle.data, timeManager.isSynced() ? time(nullptr) : 0);
+    vehicle.charging = chargeCapture.isCapturing(currentVehicle);
+    if (!vehicle.capturePass || chargeCapture.hasSession(currentVehicle)) {
+        vehicle.pendingPublish = true;
+    }
+    vehicle.publishMask |= vehicle.data.validMask;
+    publishSample(currentVehicle);
+    
+    if (missing == 0) {
+        vehicle.status = ErrorMessages::CONNECTED;
+        vehicle.errorCode = 0;
+        vehicle.backoff.reset();
+        // On-demand reads leave the regular schedule alone
+        if (vehicle.readMask == Pids::ALL || vehicle.capturePass) {
+            vehicle.nextPollTime = millis() + pollInterval(vehicle);
+        }
+    } else {
+        // Publish what was read and come back early for the rest
+        vehicle.status = vehicle.lastError;
+        vehicle.errorCode = (int)FailureType::PARTIAL + 1;
+        unsigned long retry = min(vehicle.backoff.nextDelay(FailureType::PARTIAL), pollInterval(vehicle));
+        vehicle.nextPollTime = millis() + retry;
+    }
+    
+    // Free the adapter link before moving on to the next adapter
+    if (!holdsLink(vehicle)) {
+        vehicle.obd->disconnect();
+    }
+    nextVehicle();
+}
+
+void startCycle() {
+    // A requested monitor session takes over until it ends
+    for (int i = 0; i < Vehicles::COUNT; i++) {
+        if (vehicles[i].monitorRequested) {
+            currentVehicle = i;
+            currentState = AppState::OBD_MONITOR;
+            updateInterval = Intervals::INITIAL_DELAY;
+            return;
         }
     }
     
-    // Show error for a moment before cleanup
-    delay(mqttReportAttempted ? 1000 : 2000);
+    int due = findDueVehicle(0);
+    if (due >= 0) {
+        currentVehicle = due;
+        currentState = AppState::OBD_SETUP;
+        updateInterval = Intervals::INITIAL_DELAY;
+    } else if (hasPendingPublish()) {
+        // Nothing to read, but results from a failed network attempt remain
+        currentState = AppState::WIFI_CONNECT;
+        updateInterval = Intervals::INITIAL_DELAY;
+    } else {
+        scheduleWait(Intervals::NORMAL_UPDATE);
+    }
+}
+
+void nextVehicle() {
+    int due = findDueVehicle(currentVehicle + 1);
+    if (due >= 0) {
+        currentVehicle = due;
+        currentState = AppState::OBD_SETUP;
+    } else if (hasPendingPublish()) {
+        currentState = AppState::WIFI_CONNECT;
+    } else {
+        // Only capture passes this time, nothing to send
+        scheduleWait(Intervals::NORMAL_UPDATE);
+    }
+}
+
+int findDueVehicle(int from) {
+    unsigned long now = millis();
+    for (int i = from; i < Vehicles::COUNT; i++) {
+        if (vehicles[i].demandMask != 0 || (long)(now - vehicles[i].nextPollTime) >= 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+bool isScheduleDue(const Vehicle& vehicle) {
+    return (long)(millis() - vehicle.nextPollTime) >= 0;
+}
+
+bool inBurst(const Vehicle& vehicle) {
+    return vehicle.burstInterval > 0 && (long)(millis() - vehicle.burstEndTime) < 0;
+}
+
+bool holdsLink(const Vehicle& vehicle) {
+    return inBurst(vehicle) || vehicle.charging;
+}
+
+unsigned long pollInterval(const Vehicle& vehicle) {
+    if (vehicle.charging) {
+        return chargeCapture.getSampleInterval();
+    }
+    unsigned long interval = inBurst(vehicle) ? vehicle.burstInterval : vehicle.interval;
+    if (chargeCapture.isConfirming(&vehicle - vehicles)) {
+        return min(interval, Charge_Config::CONFIRM_INTERVAL);
+    }
+    return interval;
+}
+
+bool hasPendingPublish() {
+    for (const Vehicle& vehicle : vehicles) {
+        if (vehicle.pendingPublish) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void scheduleWait(unsigned long maxInterval) {
+    // Wake up for whichever vehicle is due first
+    unsigned long now = millis();
+    unsigned long interval = maxInterval;
+    for (const Vehicle& vehicle : vehicles) {
+        long remaining = (long)(vehicle.nextPollTime - now);
+        if (remaining < 0 || vehicle.demandMask != 0 || vehicle.monitorRequested) {
+            remaining = 0;
+        }
+        if ((unsigned long)remaining < interval) {
+            interval = remaining;
+        }
+    }
     
-    // Cleanup and retry
-    cleanup();
     currentState = AppState::WAIT_CYCLE;
-    updateInterval = Intervals::ERROR_RETRY;
+    updateInterval = interval;
+}
+
+void subscribeCommands() {
+    if (!Commands::ENABLED) {
+        return;
+    }
+    
+    networkManager.subscribeCommands(MQTT::DEVICE_PREFIX);
+    for (int i = 0; i < Vehicles::COUNT; i++) {
+        const char* prefix = Vehicles::LIST[i].topicPrefix;
+        if (strcmp(prefix, MQTT::DEVICE_PREFIX) != 0) {
+            networkManager.subscribeCommands(prefix);
+        }
+    }
+}
+
+void applyCommand(const Command& command) {
+    // A command on a vehicle's own prefix targets that vehicle, one on the
+    // device prefix (when no vehicle uses it) targets all of them
+    bool matched = false;
+    for (Vehicle& vehicle : vehicles) {
+        if (strcmp(vehicle.obd->getVehicle().topicPrefix, command.prefix) == 0) {
+            applyCommand(vehicle, command);
+            matched = true;
+        }
+    }
+    
+    if (!matched) {
+        for (Vehicle& vehicle : vehicles) {
+            applyCommand(vehicle, command);
+        }
+    }
+}
+
+void applyCommand(Vehicle& vehicle, const Command& command) {
+    const char* name = vehicle.obd->getVehicle().name;
+    unsigned long now = millis();
+    
+    switch (command.type) {
+        case CommandType::READ:
+            vehicle.demandMask |= command.pids;
+            LOG_INFO_F("%s: on-demand read of PIDs 0x%02X", name, command.pids);
+            break;
+            
+        case CommandType::SET_INTERVAL:
+            vehicle.interval = command.intervalMs == 0 ? Intervals::NORMAL_UPDATE : 
+                               max(command.intervalMs, Commands::MIN_INTERVAL);
+            // Bring the next read forward if the new interval is shorter
+            if ((long)(vehicle.nextPollTime - (now + vehicle.interval)) > 0) {
+                vehicle.nextPollTime = now + vehicle.interval;
+            }
+            LOG_INFO_F("%s: update interval set to %lu ms", name, vehicle.interval);
+            break;
+            
+        case CommandType::BURST:
+            if (command.intervalMs == 0) {
+                vehicle.burstEndTime = now;
+                LOG_INFO_F("%s: burst stopped", name);
+                break;
+            }
+            vehicle.burstInterval = max(command.intervalMs, Commands::MIN_BURST_INTERVAL);
+            vehicle.burstEndTime = now + min(command.durationMs, Commands::MAX_BURST_DURATION);
+            vehicle.nextPollTime = now;
+            LOG_INFO_F("%s: burst every %lu ms until %lu", name, vehicle.burstInterval, vehicle.burstEndTime);
+            break;
+            
+        case CommandType::MONITOR:
+            if (command.durationMs == 0) {
+                vehicle.monitorRequested = false;
+                vehicle.monitorEndTime = now;
+                LOG_INFO_F("%s: monitor stopped", name);
+                break;
+            }
+            if (Monitor_Config::SIGNAL_COUNT == 0) {
+                LOG_WARNING_F("%s: monitor ignored, no signals in Monitor_Config::SIGNALS", name);
+                break;
+            }
+            vehicle.monitorRequested = true;
+            vehicle.monitorEndTime = now + min(command.durationMs, Monitor_Config::MAX_DURATION);
+            LOG_INFO_F("%s: monitor requested until %lu", name, vehicle.monitorEndTime);
+            break;
+    }
+}
+
+void publishDiagnosticsIfDue() {
+    if (Diagnostics::isPublishDue()) {
+        LOG_INFO("Publishing stage diagnostics...");
+        networkManager.publishDiagnostics();
+    }
+}
+
+void publishSample(int index) {
+    VehicleSample sample;
+    sample.vehicle = index;
+    sample.epoch = timeManager.isSynced() ? time(nullptr) : 0;
+    sample.data = vehicles[index].data;
+    sampleBus.publish(sample);
+}
+
+void consumeSamples() {
+    VehicleSample sample;
+    while (sampleBus.poll(metricsSubscriber, sample)) {
+        Vehicle& vehicle = vehicles[sample.vehicle];
+        MetricsEngine::update(sample.vehicle, sample.data, sample.epoch,
+                              vehicle.obd->getVehicle().capacityKwh, vehicle.metrics);
+    }
+}
+
+void showFailure(FailureType failure) {
+    // Flash codes count from 1 in FailureType order (see the readme)
+    ledManager.showCode(LED::RED, (int)failure + 1);
 }
 
 void cleanup() {
     LOG_DEBUG("Performing cleanup...");
     
-    // Disconnect in reverse order
+    // Disconnect in reverse order, letting a background NTP resync finish
+    // first so the drift estimate gets its sample
     networkManager.disconnectMQTT();
+    timeManager.finishSync();
     networkManager.disconnectWiFi();
-    obdManager.disconnect();
-    
-    // Reset vehicle data
-    vehicleData.isValid = false;
+    for (Vehicle& vehicle : vehicles) {
+        vehicle.obd->disconnect();
+    }
     
     LOG_DEBUG("Cleanup complete");
 }
@@ -1,17 +1,31 @@
 #include "TimeManager.h"
+#include <esp_sntp.h>
 
-TimeManager::TimeManager() : timeSynced(false) {
+TimeManager* TimeManager::instance = nullptr;
+
+TimeManager::TimeManager()
+    : timeSynced(false), sntpStarted(false), syncInProgress(false), syncStartMillis(0),
+      lastSyncEpochMs(0), lastSyncMillis(0), driftPpm(NTP::DEFAULT_DRIFT_PPM), driftMeasured(false),
+      syncPending(false), pendingEpochMs(0), pendingMillis(0) {
+    instance = this;
 }
 
 bool TimeManager::syncWithNTP() {
     LOG_INFO("Synchronizing time with NTP servers...");
+    unsigned long startTime = millis();
     
-    configTime(0, 0, NTP::SERVER1, NTP::SERVER2, NTP::SERVER3);
-    setenv("TZ", NTP::TIMEZONE, 1);
-    tzset();
+    startSync();
     
     if (waitForSync(NTP::MAX_RETRY)) {
-        timeSynced = true;
+        syncInProgress = false;
+        processPendingSync();
+        if (!timeSynced) {
+            // Clock is valid but the callback has not run yet
+            struct timeval tv;
+            gettimeofday(&tv, nullptr);
+            applySync((int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000, millis());
+        }
+        Diagnostics::record(Stage::NTP_SYNC, startTime, StageResult::SUCCESS);
         
         char timeStr[64];
         getFormattedTime(timeStr, sizeof(timeStr));
@@ -20,9 +34,122 @@ bool TimeManager::syncWithNTP() {
     }
     
     LOG_ERROR("Failed to sync time with NTP");
+    syncInProgress = false;
+    Diagnostics::record(Stage::NTP_SYNC, startTime, StageResult::TIMEOUT);
     return false;
 }
 
+void TimeManager::startSync() {
+    syncStartMillis = millis();
+    syncInProgress = true;
+    
+    if (!sntpStarted) {
+        sntp_set_sync_mode(SNTP_SYNC_MODE_IMMED);
+        sntp_set_time_sync_notification_cb(onTimeSync);
+        // Resyncs are requested explicitly, so keep SNTP's own polling rare
+        sntp_set_sync_interval(NTP::MAX_SYNC_AGE);
+        configTime(0, 0, NTP::SERVER1, NTP::SERVER2, NTP::SERVER3);
+        setenv("TZ", NTP::TIMEZONE, 1);
+        tzset();
+        sntpStarted = true;
+        LOG_DEBUG("SNTP started");
+    } else {
+        sntp_restart();
+        LOG_DEBUG("SNTP resync requested");
+    }
+}
+
+bool TimeManager::finishSync() {
+    processPendingSync();
+    while (syncInProgress && millis() - syncStartMillis < NTP::RESYNC_TIMEOUT) {
+        delay(50);
+        processPendingSync();
+    }
+    if (!syncInProgress) {
+        return true;
+    }
+    
+    // Without WiFi the answer can't arrive; the next cycle asks again
+    syncInProgress = false;
+    LOG_WARNING("NTP resync did not complete before WiFi was dropped");
+    Diagnostics::record(Stage::NTP_SYNC, syncStartMillis, StageResult::TIMEOUT);
+    return false;
+}
+
+bool TimeManager::needsSync() {
+    processPendingSync();
+    
+    if (!timeSynced) {
+        return true;
+    }
+    
+    unsigned long sinceSync = millis() - lastSyncMillis;
+    unsigned long expectedError = getExpectedErrorMs();
+    LOG_DEBUG_F("Last NTP sync %lu s ago, drift %.1f ppm, expected error %lu ms",
+                sinceSync / 1000, driftPpm, expectedError);
+    
+    return sinceSync >= NTP::MAX_SYNC_AGE || expectedError > NTP::MAX_ERROR_MS;
+}
+
+bool TimeManager::isSynced() {
+    processPendingSync();
+    return timeSynced;
+}
+
+unsigned long TimeManager::getExpectedErrorMs() {
+    if (!timeSynced) {
+        return ULONG_MAX;
+    }
+    
+    unsigned long sinceSync = millis() - lastSyncMillis;
+    return NTP::SYNC_ACCURACY_MS + (unsigned long)(fabsf(driftPpm) * (sinceSync / 1000000.0f));
+}
+
+void TimeManager::onTimeSync(struct timeval* tv) {
+    if (instance == nullptr || tv == nullptr) return;
+    
+    instance->pendingEpochMs = (int64_t)tv->tv_sec * 1000 + tv->tv_usec / 1000;
+    instance->pendingMillis = millis();
+    instance->syncPending.store(true, std::memory_order_release);
+}
+
+void TimeManager::processPendingSync() {
+    if (!syncPending.load(std::memory_order_acquire)) return;
+    
+    int64_t epochMs = pendingEpochMs;
+    unsigned long receivedMillis = pendingMillis;
+    syncPending.store(false, std::memory_order_release);
+    
+    applySync(epochMs, receivedMillis);
+    
+    if (syncInProgress) {
+        syncInProgress = false;
+        Diagnostics::record(Stage::NTP_SYNC, syncStartMillis, StageResult::SUCCESS);
+    }
+}
+
+void TimeManager::applySync(int64_t epochMs, unsigned long receivedMillis) {
+    if (timeSynced) {
+        // Compare NTP with where the local clock says we should be
+        unsigned long elapsed = receivedMillis - lastSyncMillis;
+        if (elapsed >= NTP::MIN_DRIFT_INTERVAL) {
+            int64_t expectedMs = lastSyncEpochMs + elapsed;
+            float offsetMs = (float)(epochMs - expectedMs);
+            float measuredPpm = offsetMs * 1000000.0f / elapsed;
+            
+            // Smooth the estimate, but take the first measurement as is
+            driftPpm = driftMeasured ? driftPpm + 0.3f * (measuredPpm - driftPpm) : measuredPpm;
+            driftMeasured = true;
+            LOG_INFO_F("Clock offset %.0f ms over %lu s, drift %.1f ppm",
+                       offsetMs, elapsed / 1000, driftPpm);
+        }
+    }
+    
+    lastSyncEpochMs = epochMs;
+    lastSyncMillis = receivedMillis;
+    timeSynced = true;
+}
+
 bool TimeManager::waitForSync(int maxRetries) {
     time_t now = 0;
     struct tm timeinfo = {0};
@@ -39,14 +166,14 @@ bool TimeManager::waitForSync(int maxRetries) {
     return timeinfo.tm_year >= (2024 - 1900);
 }
 
-String TimeManager::getCurrentTimestamp() {
-    if (!timeSynced) {
-        return String(ErrorMessages::TIME_NOT_SYNCED);
+void TimeManager::getCurrentTimestamp(char* buffer, size_t bufferSize) {
+    if (!isSynced()) {
+        strncpy(buffer, ErrorMessages::TIME_NOT_SYNCED, bufferSize - 1);
+        buffer[bufferSize - 1] = '\0';
+        return;
     }
     
-    char buffer[64];
-    getFormattedTime(buffer, sizeof(buffer));
-    return String(buffer);
+    getFormattedTime(buffer, bufferSize);
 }
 
 void TimeManager::getFormattedTime(char* buffer, size_t bufferSize) {
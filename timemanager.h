@@ -3,22 +3,55 @@
 
 #include <Arduino.h>
 #include <time.h>
+#include <atomic>
 #include "Config.h"
 #include "Logger.h"
+#include "Diagnostics.h"
 
 class TimeManager {
 public:
     TimeManager();
     
+    // Blocking sync, used until the clock has been set once
     bool syncWithNTP();
-    bool isSynced() const { return timeSynced; }
+    // Ask SNTP for a fresh sync and return immediately
+    void startSync();
+    // Wait for a sync started above, up to NTP::RESYNC_TIMEOUT after it was
+    // asked for; call before dropping WiFi. False if it never came
+    bool finishSync();
+    // True when the clock was never set or its expected error is over budget
+    bool needsSync();
+    bool isSynced();
     
-    String getCurrentTimestamp();
+    // Estimated clock error (ms) given the time since the last sync and measured drift
+    unsigned long getExpectedErrorMs();
+    float getDriftPpm() const { return driftPpm; }
+    
+    // Writes the current time, or TIME_NOT_SYNCED if no sync happened yet
+    void getCurrentTimestamp(char* buffer, size_t bufferSize);
     void getFormattedTime(char* buffer, size_t bufferSize);
     
 private:
     bool timeSynced;
+    bool sntpStarted;
+    bool syncInProgress;
+    unsigned long syncStartMillis;
+    
+    // Last applied sync: NTP time and the millis() at which it was received
+    int64_t lastSyncEpochMs;
+    unsigned long lastSyncMillis;
+    float driftPpm;
+    bool driftMeasured;
+    
+    // Filled in by the SNTP callback (lwIP task), applied from the main loop
+    static TimeManager* instance;
+    std::atomic<bool> syncPending;
+    int64_t pendingEpochMs;
+    unsigned long pendingMillis;
     
+    static void onTimeSync(struct timeval* tv);
+    void processPendingSync();
+    void applySync(int64_t epochMs, unsigned long receivedMillis);
     bool waitForSync(int maxRetries);
 };
 